@@ -8,17 +8,55 @@
 #define ADC121_REG_RES 0x00
 #define ADC121_REG_STS 0x01
 #define ADC121_REG_CFG 0x02
+#define ADC121_REG_ALERT_LOW 0x03
+#define ADC121_REG_ALERT_HIGH 0x04
+#define ADC121_REG_HYST 0x05
+#define ADC121_REG_LOWEST 0x06
+#define ADC121_REG_HIGHEST 0x07
+
+#define ADC121_REG_RES_ALERT 15
+
+#define ADC121_REG_STS_UNDER 0
+#define ADC121_REG_STS_OVER 1
+
+#define ADC121_REG_CFG_POLARITY 0
+#define ADC121_REG_CFG_ALERT_PIN 2
+#define ADC121_REG_CFG_ALERT_FLAG 3
+#define ADC121_REG_CFG_ALERT_HOLD 4
+#define ADC121_REG_CFG_CYCLE 5
+
+typedef enum
+{
+	ADC121_CYCLE_OFF,
+	ADC121_CYCLE_32, // 27 ksps
+	ADC121_CYCLE_64, // 13.5 ksps
+	ADC121_CYCLE_128, // 6.7 ksps
+	ADC121_CYCLE_256, // 3.4 ksps
+	ADC121_CYCLE_512, // 1.7 ksps
+	ADC121_CYCLE_1024, // 0.9 ksps
+	ADC121_CYCLE_2048, // 0.4 ksps
+} ADC121_cycle_E;
 
 typedef struct
 {
 	I2C_HandleTypeDef *hi2c;
 	uint32_t timeout_ms;
+	uint8_t config;
+	uint8_t alert;
 	uint16_t data;
 } ADC121_inst_S;
 
 HAL_StatusTypeDef ADC121_init(ADC121_inst_S * inst, I2C_HandleTypeDef *hi2c, uint32_t timeout_ms);
+HAL_StatusTypeDef ADC121_setCycleTime(ADC121_inst_S *inst, ADC121_cycle_E cycle);
+HAL_StatusTypeDef ADC121_setAlertWindow(ADC121_inst_S *inst, uint16_t low, uint16_t high, uint16_t hyst);
+HAL_StatusTypeDef ADC121_enableAlert(ADC121_inst_S *inst, uint8_t enable);
+HAL_StatusTypeDef ADC121_readAlertStatus(ADC121_inst_S *inst, uint8_t *status);
+HAL_StatusTypeDef ADC121_clearAlert(ADC121_inst_S *inst);
+HAL_StatusTypeDef ADC121_readExtremes(ADC121_inst_S *inst, uint16_t *lowest, uint16_t *highest);
+HAL_StatusTypeDef ADC121_resetExtremes(ADC121_inst_S *inst);
 HAL_StatusTypeDef ADC121_update(ADC121_inst_S *inst);
 uint16_t ADC121_read(ADC121_inst_S *inst);
+uint8_t ADC121_getAlert(ADC121_inst_S *inst);
 HAL_StatusTypeDef ADC121_shutdown(ADC121_inst_S *inst);
 
 #endif // __ADC121_H__
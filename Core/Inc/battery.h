@@ -50,10 +50,12 @@ typedef enum
 	BQ_1,
 	BQ_2,
 	BQ_3,
+	TEMP_FET,
 
 	TEMP_COUNT,
 
 	TEMP_MAX,
+	TEMP_AVG, // cell thermistors
 } batt_temp_E;
 
 typedef enum
@@ -65,22 +67,76 @@ typedef enum
 	FAULT_BQ,
 	FAULT_OT,
 	FAULT_COMMS,
+	FAULT_PRECHARGE,
 
 	FAULT_COUNT,
 } batt_fault_E;
 
+typedef enum
+{
+	SENSE_CURRENT,
+	SENSE_FET_TEMP,
+	SENSE_PACK,
+	SENSE_CHARGER,
+
+	SENSE_COUNT,
+} batt_sense_E;
+
+typedef struct
+{
+	int32_t gain; // output milliunits per adc count
+	int32_t offset; // adc counts << 8
+} batt_cal_S;
+
+typedef struct
+{
+	int32_t value;
+	uint32_t tick;
+} batt_senseResult_S;
+
+// current samples decimated by the last update
+typedef struct
+{
+	uint32_t start;
+	uint32_t end;
+	int32_t mean;
+	int32_t min;
+	int32_t max;
+} batt_currentWindow_S;
+
 void batt_init(void);
+void batt_sample(void);
 void batt_update(void);
 uint16_t batt_getCellVoltage(batt_cell_E cell);
 uint16_t batt_getPackVoltage(void);
+uint16_t batt_getChargerVoltage(void);
 int32_t batt_getPackCurrent(void);
+int32_t batt_getPackCurrentFast(void);
+void batt_getCurrentWindow(batt_currentWindow_S *window);
+uint32_t batt_getCellTick(void);
+int32_t batt_getOverCurrentPeak(void);
+uint8_t batt_getFuseHeat(void);
+int32_t batt_getFuseLimit(batt_fet_E fet, uint32_t window_ms);
+uint32_t batt_getQuiescentCurrent(void);
+void batt_setLowPower(uint8_t enable);
+int32_t batt_takeCharge(void);
 uint8_t batt_getTemp(batt_temp_E temp);
 uint8_t batt_getFault(batt_fault_E fault);
 uint8_t batt_getFaultMask(void);
+uint16_t batt_getFaultCount(batt_fault_E fault);
+void batt_latchFault(batt_fault_E fault);
+uint8_t batt_isReady(void);
 batt_fetState_E batt_getFetState(batt_fet_E fet);
+batt_fetState_E batt_getFetOutput(batt_fet_E fet);
 batt_fetState_E batt_getBalanceState(batt_cell_E cell);
 void batt_setFetState(batt_fet_E fet, batt_fetState_E state);
 void batt_setBalance(batt_cell_E cell, batt_fetState_E state);
 void batt_shutdown(void);
+void batt_getSense(batt_sense_E sense, batt_senseResult_S *result);
+void batt_getCalibration(batt_sense_E sense, batt_cal_S *cal);
+HAL_StatusTypeDef batt_calibrateOffset(batt_sense_E sense);
+HAL_StatusTypeDef batt_calibrateGain(batt_sense_E sense, int32_t reference);
+HAL_StatusTypeDef batt_saveCalibration(void);
+void batt_resetCalibration(void);
 
 #endif // __BATTERY_H__
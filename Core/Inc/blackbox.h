@@ -0,0 +1,54 @@
+#ifndef __BLACKBOX_H__
+#define __BLACKBOX_H__
+
+#include <stdint.h>
+
+#include "stm32l0xx_hal.h"
+
+#include "battery.h"
+
+#define BLACKBOX_LEN 40 // 80 ms at the 2 ms current rate
+#define BLACKBOX_POST 8 // samples kept after the trigger
+#define BLACKBOX_POST_TIMEOUT_MS 200 // current is only sampled in windows with the fets open
+
+#define BLACKBOX_CHUNK_SIZE 60
+
+// uart chunk framing, the payload is blackbox_header_S followed by the samples, oldest first
+#define BLACKBOX_SYNC_0 0xA5
+#define BLACKBOX_SYNC_1 0xB8
+#define BLACKBOX_CHUNK_HEADER 4 // sync, sync, length, sequence
+
+#define BLACKBOX_FET_PCH (1 << 0)
+#define BLACKBOX_FET_CHG (1 << 1)
+#define BLACKBOX_FET_DSG (1 << 2)
+
+typedef struct
+{
+	uint16_t tick; // low half of HAL_GetTick
+	int16_t current; // 10 mA
+	uint16_t v_min;
+	uint16_t v_max;
+	uint16_t pack_voltage;
+	int8_t t_max;
+	uint8_t fet;
+} blackbox_sample_S;
+
+typedef struct
+{
+	uint32_t tick; // of the trigger
+	uint8_t fault;
+	uint8_t count;
+	uint8_t trigger; // index of the last sample before the trigger
+	uint8_t stored; // 1 when restored from eeprom, currents are quantised
+} blackbox_header_S;
+
+void blackbox_init(void);
+void blackbox_record(const blackbox_sample_S *sample);
+void blackbox_trigger(batt_fault_E fault);
+void blackbox_update(void);
+uint8_t blackbox_isDumping(void);
+HAL_StatusTypeDef blackbox_drain(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef blackbox_getHeader(blackbox_header_S *header);
+HAL_StatusTypeDef blackbox_getSample(uint32_t index, blackbox_sample_S *sample);
+
+#endif // __BLACKBOX_H__
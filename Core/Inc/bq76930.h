@@ -158,6 +158,8 @@ typedef struct
 
 HAL_StatusTypeDef BQ76930_init(BQ76930_inst_S *inst, I2C_HandleTypeDef *hi2c, BQ76930_config_S *config, uint32_t timeout_ms);
 HAL_StatusTypeDef BQ76930_update(BQ76930_inst_S *inst);
+HAL_StatusTypeDef BQ76930_updateFaults(BQ76930_inst_S *inst);
+HAL_StatusTypeDef BQ76930_updateFets(BQ76930_inst_S *inst);
 HAL_StatusTypeDef BQ76930_clearFaults(BQ76930_inst_S *inst);
 uint16_t BQ76930_getVoltage(BQ76930_inst_S *inst, BQ76930_cell_E cell);
 uint16_t BQ76930_getTemp(BQ76930_inst_S *inst, BQ76930_temp_E temp);
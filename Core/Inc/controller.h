@@ -1,6 +1,24 @@
 #ifndef __CONTROLLER_H__
 #define __CONTROLLER_H__
 
+#include <stdint.h>
+
+#include "battery.h"
+#include "energy.h"
+#include "profile.h"
+#include "sop.h"
+
+#define CONTROLLER_DATA_CODE 0xDEADBEEF
+#define CONTROLLER_LOG_LEN 16
+#define CONTROLLER_WAKE_PENDING 0xFFFF // wake_dsg_ms until the dsg fet is on
+
+// uart service commands, the command byte then its arguments, little endian
+#define CONTROLLER_CMD_CAL_OFFSET 'O' // sense, with no current or voltage applied
+#define CONTROLLER_CMD_CAL_GAIN 'G' // sense, int32 reference in mA or mV
+#define CONTROLLER_CMD_CAL_SAVE 'S'
+#define CONTROLLER_CMD_LEN_MAX 6
+#define CONTROLLER_CAL_NONE 0xFF // cal_status before the first calibration command
+
 typedef enum
 {
 	STATE_OFF,
@@ -13,7 +31,71 @@ typedef enum
 	STATE_SHUTDOWN,
 } controller_state_E;
 
+typedef enum
+{
+	CAUSE_NONE,
+	CAUSE_AFE_READY,
+	CAUSE_AFE_TIMEOUT,
+	CAUSE_PRECHARGE_DONE,
+	CAUSE_FAULT,
+	CAUSE_BUTTON,
+	CAUSE_CURRENT,
+	CAUSE_CHARGE_LIMIT,
+	CAUSE_BALANCED,
+	CAUSE_RECOVERED,
+} controller_cause_E;
+
+typedef struct
+{
+	uint32_t tick;
+	uint8_t from;
+	uint8_t to;
+	uint8_t cause;
+	uint8_t faults;
+} controller_logEntry_S;
+
+// telemetry frame sent every loop
+typedef struct
+{
+	uint32_t code;
+	uint32_t capacity;
+	uint16_t soc;
+	int16_t state;
+	uint16_t volt[CELL_COUNT];
+	uint16_t temp[TEMP_COUNT];
+	uint16_t fet;
+	uint16_t pack_voltage;
+	int16_t pack_current;
+	uint16_t faults;
+	uint16_t loop_time;
+	uint16_t charger_voltage;
+	uint16_t iq_ua;
+	uint16_t wake_dsg_ms;
+	uint16_t transitions;
+	uint8_t last_cause;
+	uint8_t cal_status; // HAL_StatusTypeDef of the last calibration command
+	uint16_t stack_used;
+	uint16_t ram_free;
+	uint8_t reset_flags;
+	uint8_t reset_task; // stalled task in the high nibble, last check-in in the low
+	uint16_t sop_dsg[SOP_WINDOW_COUNT]; // mA, 2 s, 10 s and continuous
+	uint16_t sop_chg[SOP_WINDOW_COUNT];
+	int16_t power[ENERGY_WINDOW_COUNT]; // W over 10 s, 60 s and 300 s, discharge positive
+	uint16_t tte; // minutes, ENERGY_TIME_UNKNOWN when idle
+	uint16_t ttf;
+	uint32_t energy_out; // mWh since power up
+	uint32_t energy_in;
+	int16_t t_core; // 0.1 C, hottest cell group from its i2r heating
+	int16_t t_predicted; // a minute ahead at the present load
+#if PROFILE_ENABLE
+	profile_stats_S profile; // last field, a build without it just sends a shorter frame
+#endif
+} controller_data_S;
+
 void controller_init(void);
 void controller_run(void);
+controller_state_E controller_getState(void);
+uint32_t controller_getTransitionCount(void);
+HAL_StatusTypeDef controller_getLogEntry(uint32_t age, controller_logEntry_S *entry);
 
 #endif // __CONTROLLER_H__
@@ -0,0 +1,60 @@
+#ifndef __DATALOG_H__
+#define __DATALOG_H__
+
+#include <stdint.h>
+
+#include "stm32l0xx_hal.h"
+
+// the LOG region in STM32L010C6TX_FLASH.ld, keep both in step
+#define DATALOG_OFFSET 0x7000
+#define DATALOG_PAGES 32
+#define DATALOG_BASE (FLASH_BASE + DATALOG_OFFSET)
+
+#define DATALOG_PERIOD_MS 30000 // 32 pages of 6 records hold about 1.6 h of riding
+
+#define DATALOG_CHUNK_SIZE 60 // ~5.6 ms on the wire, inside the telemetry guard
+
+// uart chunk framing, the payload is the raw flash pages back to back, oldest first
+#define DATALOG_SYNC_0 0xA5
+#define DATALOG_SYNC_1 0xC3
+#define DATALOG_CHUNK_HEADER 4 // sync, sync, length, sequence
+#define DATALOG_DUMP_SIZE (DATALOG_PAGES * FLASH_PAGE_SIZE)
+
+#define DATALOG_CMD_DUMP 'L'
+
+// page: header, then records, an erased word reads as zero
+typedef struct
+{
+	uint32_t seq;
+	uint16_t boot;
+	uint16_t crc;
+} datalog_pageHeader_S;
+
+typedef struct
+{
+	uint32_t time_s; // since power up
+	uint8_t soc;
+	uint8_t state;
+	uint8_t faults; // every fault seen in the period
+	uint8_t t_max;
+	uint16_t v_min; // lowest and highest cell in the period
+	uint16_t v_max;
+	int16_t i_mean; // 10 mA
+	int16_t i_min;
+	int16_t i_max;
+	uint16_t crc;
+} datalog_record_S;
+
+#define DATALOG_RECORDS_PER_PAGE ((FLASH_PAGE_SIZE - sizeof(datalog_pageHeader_S)) / sizeof(datalog_record_S))
+
+void datalog_init(void);
+void datalog_update(uint8_t state, uint8_t soc);
+uint8_t datalog_service(void);
+void datalog_requestDump(void);
+uint8_t datalog_isDumping(void);
+HAL_StatusTypeDef datalog_drain(UART_HandleTypeDef *huart);
+uint16_t datalog_getBoot(void);
+uint32_t datalog_getRecordCount(void);
+HAL_StatusTypeDef datalog_getRecord(uint32_t age, datalog_record_S *record);
+
+#endif // __DATALOG_H__
@@ -0,0 +1,28 @@
+#ifndef __EEPROM_H__
+#define __EEPROM_H__
+
+#include <stdint.h>
+
+#include "stm32l0xx_hal.h"
+
+// data eeprom map, all records are word aligned
+#define EEPROM_ADDR_CAL 0x00
+#define EEPROM_SIZE_CAL 0x24
+#define EEPROM_ADDR_BLACKBOX 0x28
+#define EEPROM_SIZE_BLACKBOX 0x54
+#define EEPROM_ADDR_USAGE 0x80
+#define EEPROM_SIZE_USAGE 0x5C
+#define EEPROM_ADDR_R0 0xE0
+#define EEPROM_SIZE_R0 0x10
+#define EEPROM_ADDR_SOH 0xF4
+#define EEPROM_SIZE_SOH 0x08
+
+#define EEPROM_SIZE (DATA_EEPROM_END - DATA_EEPROM_BASE + 1)
+
+HAL_StatusTypeDef eeprom_read(uint32_t addr, void *data, uint32_t len);
+HAL_StatusTypeDef eeprom_write(uint32_t addr, const void *data, uint32_t len);
+HAL_StatusTypeDef eeprom_readRecord(uint32_t addr, void *data, uint32_t len);
+HAL_StatusTypeDef eeprom_writeRecord(uint32_t addr, const void *data, uint32_t len);
+uint32_t eeprom_recordTrailer(const void *data, uint32_t len);
+
+#endif // __EEPROM_H__
@@ -0,0 +1,25 @@
+#ifndef __ENERGY_H__
+#define __ENERGY_H__
+
+#include <stdint.h>
+
+#define ENERGY_TIME_UNKNOWN 0xFFFF // not discharging, or not charging, hard enough to tell
+
+typedef enum
+{
+	ENERGY_WINDOW_10S,
+	ENERGY_WINDOW_60S,
+	ENERGY_WINDOW_300S,
+
+	ENERGY_WINDOW_COUNT,
+} energy_window_E;
+
+void energy_init(void);
+void energy_update(uint32_t to_empty, uint32_t to_full);
+int32_t energy_getPower(energy_window_E window);
+uint32_t energy_getDischarged(void);
+uint32_t energy_getCharged(void);
+uint16_t energy_getTimeToEmpty(void);
+uint16_t energy_getTimeToFull(void);
+
+#endif // __ENERGY_H__
@@ -0,0 +1,24 @@
+#ifndef __FAULT_H__
+#define __FAULT_H__
+
+#include <stdint.h>
+
+#include "battery.h"
+
+typedef struct
+{
+	int32_t set_thresh; // trips upwards when above clear_thresh, downwards when below
+	int32_t clear_thresh;
+	uint16_t set_ms; // condition has to hold this long to trip
+	uint16_t clear_ms;
+	uint8_t latch; // only batt_init clears it
+} fault_policy_S;
+
+void fault_reset(void);
+void fault_update(batt_fault_E fault, int32_t value, uint32_t now);
+void fault_latch(batt_fault_E fault);
+uint8_t fault_isActive(batt_fault_E fault);
+uint8_t fault_getMask(void);
+uint16_t fault_getCount(batt_fault_E fault);
+
+#endif // __FAULT_H__
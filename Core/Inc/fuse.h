@@ -0,0 +1,33 @@
+#ifndef __FUSE_H__
+#define __FUSE_H__
+
+#include <stdint.h>
+
+#define FUSE_HEAT_TRIP (1UL << 24)
+
+typedef struct
+{
+	int32_t current_ma;
+	uint32_t trip_ms; // held at current_ma from cold
+} fuse_point_S;
+
+typedef struct
+{
+	int32_t rated_ma; // never trips at or below, the heat drains here
+	uint32_t cool_ms; // from the trip point back to cold
+	const fuse_point_S *points; // rising current, falling trip time
+	uint8_t count;
+} fuse_curve_S;
+
+typedef struct
+{
+	const fuse_curve_S *curve;
+	uint32_t heat; // FUSE_HEAT_TRIP is the trip point
+} fuse_S;
+
+void fuse_init(fuse_S *fuse, const fuse_curve_S *curve);
+uint8_t fuse_update(fuse_S *fuse, int32_t current, uint32_t dt_ms);
+int32_t fuse_getLimit(const fuse_S *fuse, uint32_t window_ms);
+uint8_t fuse_getHeat(const fuse_S *fuse);
+
+#endif // __FUSE_H__
@@ -0,0 +1,48 @@
+#ifndef __I2C_TRACE_H__
+#define __I2C_TRACE_H__
+
+#include <stdint.h>
+
+#include "stm32l0xx_hal.h"
+
+#ifndef I2C_TRACE_ENABLE
+#define I2C_TRACE_ENABLE 1
+#endif
+
+#define I2C_TRACE_BUF_SIZE 512
+#define I2C_TRACE_CHUNK_SIZE 60
+
+// uart chunk framing, the payload is a slice of the record stream
+#define I2C_TRACE_SYNC_0 0xA5
+#define I2C_TRACE_SYNC_1 0x5A
+#define I2C_TRACE_CHUNK_HEADER 4 // sync, sync, length, sequence
+
+// record: flags, tick delta (varint), register, payload
+// flags: device[7:6] write[5] error[4] length[3:0], reads that failed carry no payload
+// marker: 0xC0 | type, tick delta (varint), length, payload
+#define I2C_TRACE_DEV_BQ 0
+#define I2C_TRACE_DEV_TCA 1
+#define I2C_TRACE_DEV_ADC 2
+#define I2C_TRACE_DEV_MARK 3
+
+#define I2C_TRACE_FLAG_WRITE (1 << 5)
+#define I2C_TRACE_FLAG_ERROR (1 << 4)
+#define I2C_TRACE_LEN_MASK 0x0F
+
+typedef enum
+{
+	I2C_TRACE_MARK_START, // absolute tick
+	I2C_TRACE_MARK_DROP, // records lost to a full buffer
+	I2C_TRACE_MARK_CAL, // calibration record, replay needs it to match conversions
+} i2c_trace_mark_E;
+
+void i2c_trace_init(void);
+void i2c_trace_enable(uint8_t enable);
+void i2c_trace_mark(i2c_trace_mark_E type, const void *data, uint8_t len);
+HAL_StatusTypeDef i2c_trace_drain(UART_HandleTypeDef *huart);
+uint32_t i2c_trace_getDropped(void);
+
+HAL_StatusTypeDef i2c_trace_memRead(I2C_HandleTypeDef *hi2c, uint16_t dev_addr, uint16_t reg, uint16_t reg_size, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef i2c_trace_memWrite(I2C_HandleTypeDef *hi2c, uint16_t dev_addr, uint16_t reg, uint16_t reg_size, uint8_t *data, uint16_t size, uint32_t timeout);
+
+#endif // __I2C_TRACE_H__
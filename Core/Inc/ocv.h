@@ -0,0 +1,12 @@
+#ifndef __OCV_H__
+#define __OCV_H__
+
+#include <stdint.h>
+
+#define OCV_SOC_FULL 1000 // permille
+#define OCV_TEMP_REF 25 // the column the soc limits are read from
+
+uint16_t ocv_getVoltage(uint16_t soc, uint8_t temp);
+uint16_t ocv_getSoc(uint16_t mv, uint8_t temp);
+
+#endif // __OCV_H__
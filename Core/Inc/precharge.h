@@ -0,0 +1,17 @@
+#ifndef __PRECHARGE_H__
+#define __PRECHARGE_H__
+
+#include <stdint.h>
+
+typedef enum
+{
+	PRECHARGE_RUNNING,
+	PRECHARGE_DONE,
+	PRECHARGE_FAIL,
+} precharge_result_E;
+
+void precharge_start(void);
+precharge_result_E precharge_update(void);
+uint32_t precharge_getEta(void);
+
+#endif // __PRECHARGE_H__
@@ -0,0 +1,53 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdint.h>
+
+#include "stm32l0xx_hal.h"
+
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE 1
+#endif
+
+#define PROFILE_HIST_BINS 8 // <16, <64, <256, <1024, <4096, <16384, <65536, more us
+
+typedef enum
+{
+	PROFILE_STAGE_ADC,
+	PROFILE_STAGE_BQ,
+	PROFILE_STAGE_TCA,
+	PROFILE_STAGE_STATE,
+	PROFILE_STAGE_DISPLAY,
+	PROFILE_STAGE_TELEMETRY,
+	PROFILE_STAGE_LOOP,
+	PROFILE_STAGE_COUNT,
+} profile_stage_E;
+
+// one stage per telemetry frame, the window restarts once it has been sent
+typedef struct
+{
+	uint8_t stage;
+	uint8_t reserved;
+	uint16_t count;
+	uint16_t min_us;
+	uint16_t max_us;
+	uint16_t mean_us;
+	uint16_t hist[PROFILE_HIST_BINS];
+} profile_stats_S;
+
+// disabled, none of the api or its state is built and callers guard their uses
+#if PROFILE_ENABLE
+#define PROFILE_START(stage) profile_start(stage)
+#define PROFILE_STOP(stage) profile_stop(stage)
+
+void profile_init(void);
+uint32_t profile_now(void);
+void profile_start(profile_stage_E stage);
+void profile_stop(profile_stage_E stage);
+void profile_export(profile_stats_S *stats);
+#else
+#define PROFILE_START(stage)
+#define PROFILE_STOP(stage)
+#endif
+
+#endif // __PROFILE_H__
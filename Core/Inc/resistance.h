@@ -0,0 +1,20 @@
+#ifndef __RESISTANCE_H__
+#define __RESISTANCE_H__
+
+#include <stdint.h>
+
+#include "stm32l0xx_hal.h"
+
+#include "battery.h"
+
+#define RESISTANCE_STEP_MA 3000 // smallest current step that moves the cells well clear of the bq lsb
+#define RESISTANCE_DEFAULT_UOHM 10000 // until a cell has seen its first step
+
+void resistance_init(void);
+void resistance_update(void);
+HAL_StatusTypeDef resistance_save(void);
+uint32_t resistance_getNominal(batt_cell_E cell);
+uint32_t resistance_getCell(batt_cell_E cell);
+uint32_t resistance_getCount(void);
+
+#endif // __RESISTANCE_H__
@@ -0,0 +1,21 @@
+#ifndef __SOH_H__
+#define __SOH_H__
+
+#include <stdint.h>
+
+#include "stm32l0xx_hal.h"
+
+#define SOH_NOMINAL_MAH 12000 // four 3000 mAh cells in parallel, full on the ocv table
+
+#define SOH_REST_MA 200
+#define SOH_REST_MS (20 * 60 * 1000) // the cells have to relax before the voltage reads as ocv
+
+void soh_init(void);
+void soh_update(int32_t charge, uint32_t ocv_capacity);
+HAL_StatusTypeDef soh_save(void);
+uint16_t soh_getCapacity(void);
+uint8_t soh_getPercent(void);
+uint32_t soh_getCycles(void);
+uint8_t soh_getLearnCount(void);
+
+#endif // __SOH_H__
@@ -0,0 +1,22 @@
+#ifndef __SOP_H__
+#define __SOP_H__
+
+#include <stdint.h>
+
+#include "stm32l0xx_hal.h"
+
+typedef enum
+{
+	SOP_PEAK_2S,
+	SOP_PEAK_10S,
+	SOP_CONTINUOUS,
+
+	SOP_WINDOW_COUNT,
+} sop_window_E;
+
+void sop_init(void);
+void sop_update(uint8_t soc);
+uint16_t sop_getDischarge(sop_window_E window);
+uint16_t sop_getCharge(sop_window_E window);
+
+#endif // __SOP_H__
@@ -0,0 +1,15 @@
+#ifndef __STACK_MON_H__
+#define __STACK_MON_H__
+
+#include <stdint.h>
+
+#ifndef STACK_MON_ENABLE
+#define STACK_MON_ENABLE 1
+#endif
+
+void stack_mon_init(void);
+void stack_mon_update(void);
+uint32_t stack_mon_getUsed(void);
+uint32_t stack_mon_getFree(void);
+
+#endif // __STACK_MON_H__
@@ -43,6 +43,8 @@ typedef struct
 HAL_StatusTypeDef TCA9534_init(TCA9534_inst_S *inst, I2C_HandleTypeDef *hi2c, uint32_t timeout_ms);
 void TCA9534_setPinDirection(TCA9534_inst_S *inst, TCA9534_channel_E channel, TCA9534_pinDirection_E dir);
 HAL_StatusTypeDef TCA9534_update(TCA9534_inst_S *inst);
+HAL_StatusTypeDef TCA9534_updateOutputs(TCA9534_inst_S *inst);
+HAL_StatusTypeDef TCA9534_updateInputs(TCA9534_inst_S *inst);
 GPIO_PinState TCA9534_readPin(TCA9534_inst_S *inst, TCA9534_channel_E channel);
 void TCA9534_writePin(TCA9534_inst_S *inst, TCA9534_channel_E channel, GPIO_PinState state);
 HAL_StatusTypeDef TCA9534_shutdown(TCA9534_inst_S *inst);
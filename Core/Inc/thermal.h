@@ -0,0 +1,20 @@
+#ifndef __THERMAL_H__
+#define __THERMAL_H__
+
+#include <stdint.h>
+
+#define THERMAL_DERATE_FULL 256 // q8
+
+typedef enum
+{
+	THERMAL_DISCHARGE,
+	THERMAL_CHARGE,
+} thermal_dir_E;
+
+void thermal_init(void);
+void thermal_update(void);
+int16_t thermal_getCore(void);
+int16_t thermal_getPredicted(void);
+uint16_t thermal_getDerate(thermal_dir_E dir);
+
+#endif // __THERMAL_H__
@@ -0,0 +1,29 @@
+#ifndef __USAGE_H__
+#define __USAGE_H__
+
+#include <stdint.h>
+
+#include "stm32l0xx_hal.h"
+
+#define USAGE_CHECKPOINT_MS (60 * 60 * 1000) // and on every shutdown, eeprom words wear out
+#define USAGE_COUNT_MAX 0xFFFFFF // counters are stored as 24 bits, ~194 days
+
+typedef enum
+{
+	USAGE_VOLTAGE, // highest cell
+	USAGE_TEMP, // hottest sensor
+	USAGE_CURRENT,
+	USAGE_SOC,
+
+	USAGE_COUNT,
+} usage_hist_E;
+
+void usage_init(void);
+void usage_update(uint8_t soc);
+void usage_requestCheckpoint(void);
+uint8_t usage_service(void);
+HAL_StatusTypeDef usage_checkpoint(void);
+uint8_t usage_getBinCount(usage_hist_E hist);
+uint32_t usage_getSeconds(usage_hist_E hist, uint8_t bin);
+
+#endif // __USAGE_H__
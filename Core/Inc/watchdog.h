@@ -0,0 +1,41 @@
+#ifndef __WATCHDOG_H__
+#define __WATCHDOG_H__
+
+#include <stdint.h>
+
+#define WATCHDOG_TIMEOUT_MS 500 // at the nominal 37 kHz lsi, 330 to 710 ms over its spread
+
+typedef enum
+{
+	WATCHDOG_TASK_SAMPLE,
+	WATCHDOG_TASK_UPDATE,
+	WATCHDOG_TASK_CONTROL,
+	WATCHDOG_TASK_TELEMETRY,
+	WATCHDOG_TASK_COUNT,
+	WATCHDOG_TASK_NONE = 0xF,
+} watchdog_task_E;
+
+typedef enum
+{
+	WATCHDOG_RESET_POWER,
+	WATCHDOG_RESET_PIN,
+	WATCHDOG_RESET_SOFTWARE,
+	WATCHDOG_RESET_IWDG,
+	WATCHDOG_RESET_LOW_POWER,
+	WATCHDOG_RESET_STANDBY,
+	WATCHDOG_RESET_WAKEUP,
+} watchdog_reset_E;
+
+void watchdog_init(void);
+void watchdog_start(void);
+void watchdog_restartDeadlines(void);
+void watchdog_checkIn(watchdog_task_E task);
+void watchdog_kick(void);
+void watchdog_prepareStandby(void);
+
+uint8_t watchdog_getResetFlags(void);
+uint8_t watchdog_getResetTask(void);
+uint16_t watchdog_getResetCount(void);
+uint8_t watchdog_isStandbyTimeout(void);
+
+#endif // __WATCHDOG_H__
@@ -1,23 +1,127 @@
 #include "adc121.h"
 
+#include "i2c_trace.h"
+
 static HAL_StatusTypeDef ADC121_readReg(ADC121_inst_S * inst, uint8_t regAddr, uint8_t *data, uint8_t size)
 {
-	return HAL_I2C_Mem_Read(inst->hi2c, ADC121_I2C_ADDR << 1, regAddr, 1, data, size, inst->timeout_ms);
+	return i2c_trace_memRead(inst->hi2c, ADC121_I2C_ADDR << 1, regAddr, 1, data, size, inst->timeout_ms);
 }
 
 static HAL_StatusTypeDef ADC121_writeReg(ADC121_inst_S * inst, uint8_t regAddr, uint8_t *data, uint8_t size)
 {
-	return HAL_I2C_Mem_Write(inst->hi2c, ADC121_I2C_ADDR << 1, regAddr, 1, data, size, inst->timeout_ms);
+	return i2c_trace_memWrite(inst->hi2c, ADC121_I2C_ADDR << 1, regAddr, 1, data, size, inst->timeout_ms);
+}
+
+static HAL_StatusTypeDef ADC121_writeReg16(ADC121_inst_S * inst, uint8_t regAddr, uint16_t value)
+{
+	uint8_t data[2];
+
+	data[0] = (value >> 8) & 0x0F;
+	data[1] = value & 0xFF;
+
+	return ADC121_writeReg(inst, regAddr, data, sizeof(data));
+}
+
+static HAL_StatusTypeDef ADC121_readReg16(ADC121_inst_S * inst, uint8_t regAddr, uint16_t *value)
+{
+	uint8_t data[2];
+
+	HAL_StatusTypeDef status = ADC121_readReg(inst, regAddr, data, sizeof(data));
+
+	if (status == HAL_OK)
+	{
+		*value = ((uint16_t)(data[0] << 8) | data[1]) & 0x0FFF;
+	}
+
+	return status;
 }
 
 HAL_StatusTypeDef ADC121_init(ADC121_inst_S * inst, I2C_HandleTypeDef *hi2c, uint32_t timeout_ms)
 {
 	inst->hi2c = hi2c;
 	inst->timeout_ms = timeout_ms;
+	inst->config = ADC121_CYCLE_2048 << ADC121_REG_CFG_CYCLE;
+	inst->alert = 0;
 
-	uint8_t data = 0b11100000;
+	return ADC121_writeReg(inst, ADC121_REG_CFG, &inst->config, sizeof(inst->config));
+}
 
-	return ADC121_writeReg(inst, ADC121_REG_CFG, &data, sizeof(data));
+HAL_StatusTypeDef ADC121_setCycleTime(ADC121_inst_S *inst, ADC121_cycle_E cycle)
+{
+	inst->config &= ~(0b111 << ADC121_REG_CFG_CYCLE);
+	inst->config |= (cycle & 0b111) << ADC121_REG_CFG_CYCLE;
+
+	return ADC121_writeReg(inst, ADC121_REG_CFG, &inst->config, sizeof(inst->config));
+}
+
+HAL_StatusTypeDef ADC121_setAlertWindow(ADC121_inst_S *inst, uint16_t low, uint16_t high, uint16_t hyst)
+{
+	HAL_StatusTypeDef status = ADC121_writeReg16(inst, ADC121_REG_ALERT_LOW, low);
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	status = ADC121_writeReg16(inst, ADC121_REG_ALERT_HIGH, high);
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	return ADC121_writeReg16(inst, ADC121_REG_HYST, hyst);
+}
+
+HAL_StatusTypeDef ADC121_enableAlert(ADC121_inst_S *inst, uint8_t enable)
+{
+	// flag only, latched until cleared, the alert pin is not routed
+	inst->config &= ~((1 << ADC121_REG_CFG_ALERT_FLAG) | (1 << ADC121_REG_CFG_ALERT_HOLD));
+
+	if (enable)
+	{
+		inst->config |= (1 << ADC121_REG_CFG_ALERT_FLAG) | (1 << ADC121_REG_CFG_ALERT_HOLD);
+	}
+
+	return ADC121_writeReg(inst, ADC121_REG_CFG, &inst->config, sizeof(inst->config));
+}
+
+HAL_StatusTypeDef ADC121_readAlertStatus(ADC121_inst_S *inst, uint8_t *status)
+{
+	return ADC121_readReg(inst, ADC121_REG_STS, status, sizeof(*status));
+}
+
+HAL_StatusTypeDef ADC121_clearAlert(ADC121_inst_S *inst)
+{
+	uint8_t data = (1 << ADC121_REG_STS_UNDER) | (1 << ADC121_REG_STS_OVER);
+
+	inst->alert = 0;
+
+	return ADC121_writeReg(inst, ADC121_REG_STS, &data, sizeof(data));
+}
+
+HAL_StatusTypeDef ADC121_readExtremes(ADC121_inst_S *inst, uint16_t *lowest, uint16_t *highest)
+{
+	HAL_StatusTypeDef status = ADC121_readReg16(inst, ADC121_REG_LOWEST, lowest);
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	return ADC121_readReg16(inst, ADC121_REG_HIGHEST, highest);
+}
+
+HAL_StatusTypeDef ADC121_resetExtremes(ADC121_inst_S *inst)
+{
+	HAL_StatusTypeDef status = ADC121_writeReg16(inst, ADC121_REG_LOWEST, 0x0FFF);
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	return ADC121_writeReg16(inst, ADC121_REG_HIGHEST, 0x0000);
 }
 
 HAL_StatusTypeDef ADC121_update(ADC121_inst_S *inst)
@@ -29,6 +133,7 @@ HAL_StatusTypeDef ADC121_update(ADC121_inst_S *inst)
 	if (status == HAL_OK)
 	{
 		inst->data = (uint16_t)(data[0] << 8) | data[1];
+		inst->alert = (inst->data >> ADC121_REG_RES_ALERT) & 1;
 		inst->data &= 0x0FFF;
 	}
 
@@ -40,6 +145,11 @@ uint16_t ADC121_read(ADC121_inst_S *inst)
 	return inst->data;
 }
 
+uint8_t ADC121_getAlert(ADC121_inst_S *inst)
+{
+	return inst->alert;
+}
+
 HAL_StatusTypeDef ADC121_shutdown(ADC121_inst_S *inst)
 {
 	uint8_t data = 0b00000000;
@@ -1,7 +1,13 @@
 #include "battery.h"
 
 #include "adc121.h"
+#include "blackbox.h"
 #include "bq76930.h"
+#include "eeprom.h"
+#include "fault.h"
+#include "fuse.h"
+#include "i2c_trace.h"
+#include "profile.h"
 #include "tca9534.h"
 
 #define BATT_SET_BIT(bits, bit, value) ((bits & ~(1 << bit)) | (value << bit))
@@ -11,9 +17,17 @@
 
 #define OV_THRESH_MV 4200
 #define UV_THRESH_MV 2000
-#define OC_THRESH 0x5 // 22A // bq datasheet pg 33
+#define CELL_VALID_MIN_MV 1000 // the bq reads zeros until its first adc cycle is done
+#define OC_THRESH 0xF // 50A // bq datasheet pg 33
 #define SC_THRESH 0x3 // 56A
-#define OT_THRESH_C 60
+
+// adc121 hardware window on the current channel, a tier below the bq OCD trip
+#define OC_ALERT_DSG_MA 48000
+#define OC_ALERT_CHG_MA -16000
+#define OC_ALERT_HYST_MA 1000
+#define OC_ALERT_SAMPLES 2 // consecutive samples out of the window, one conversion can be noise
+
+#define FUSE_DT_MAX_MS 100 // the idle visit period, a longer gap means the channel was parked
 
 #define CHANNEL_PCHG_EN TCA9534_CHANNEL_1
 #define CHANNEL_PMON_EN TCA9534_CHANNEL_2
@@ -24,25 +38,176 @@
 #define CHANNEL_TMUX_EN TCA9534_CHANNEL_7
 #define CHANNEL_BQ_ALERT TCA9534_CHANNEL_8
 
+#define CAL_OFFSET_SHIFT 8
+#define CAL_SAMPLES 64
+#define CAL_SAMPLE_PERIOD_MS 3
+#define CAL_SETTLE_MS 50
+
+#define ACQ_PERIOD_MS 2
+#define ACQ_FAST_FILTER 4
+
+#define RAIL_WARMUP_MS 10
+
+// modelled quiescent draw from datasheet typicals at 48 V
+#define IQ_BASE_UA 900 // mcu at 4 MHz, bq76930, tca9534, adc121
+#define IQ_SNS_UA 10000 // hall sensor
+#define IQ_PMON_UA 250 // pack divider
+#define IQ_TMUX_UA 10
+#define IQ_CP_UA 1500
+
+#define NTC_PULLUP_OHM 10000
+#define NTC_SUPPLY_MV 3300
+#define NTC_TABLE_LEN 15
+
+#define AUTOZERO_SETTLE_MS 500
+#define AUTOZERO_FILTER 16
+#define AUTOZERO_LIMIT (40 << CAL_OFFSET_SHIFT) // ~2A
+#define AUTOZERO_SAVE_THRESH (1 << CAL_OFFSET_SHIFT)
+
+typedef enum
+{
+	ACQ_IDLE,
+	ACQ_SETTLE,
+	ACQ_SAMPLE,
+} batt_acqState_E;
+
+typedef enum
+{
+	ACQ_MODE_FAST, // fets closed, current is sampled continuously
+	ACQ_MODE_PRECHARGE, // as fast, and the pack node is watched until it converges
+	ACQ_MODE_IDLE, // fets closed but no load expected
+	ACQ_MODE_STORAGE, // fets open
+
+	ACQ_MODE_COUNT,
+} batt_acqMode_E;
+
+typedef enum
+{
+	RAIL_SNS,
+	RAIL_PMON,
+	RAIL_TMUX,
+	RAIL_CP,
+
+	RAIL_COUNT,
+} batt_rail_E;
+
+typedef struct
+{
+	uint16_t period_ms[ACQ_MODE_COUNT]; // 0 marks the home channel, sampled whenever no window is due
+	uint8_t settle_ms;
+	uint8_t samples;
+	uint8_t rails;
+} batt_senseSchedule_S;
+
 extern I2C_HandleTypeDef hi2c1;
 
 static ADC121_inst_S adc;
 static BQ76930_inst_S bq;
 static TCA9534_inst_S tca;
 
-static uint16_t pack_voltage;
-static int32_t pack_current;
-static uint8_t adc_select;
+static batt_senseResult_S sense_result[SENSE_COUNT];
+static int32_t pack_current_fast;
+static int32_t charge_mams;
+static batt_acqState_E acq_state;
+static batt_sense_E acq_sense;
+static uint32_t acq_switch_time;
+static uint32_t acq_adc_sum;
+static uint32_t acq_adc_count;
+static uint8_t acq_low_power;
+static uint32_t sense_visit_time[SENSE_COUNT];
+static uint8_t rails_on;
+static uint32_t rail_on_ms[RAIL_COUNT];
+static uint32_t iq_window_start;
+static uint32_t iq_ua;
+static uint32_t last_sample_time;
+static uint32_t current_adc_sum;
+static uint32_t current_adc_count;
+static int32_t current_window_min;
+static int32_t current_window_max;
+static batt_currentWindow_S current_window;
+static uint32_t cell_tick;
+static uint8_t fet_temp;
+static HAL_StatusTypeDef acq_status;
+static uint8_t oc_alert;
+static uint8_t oc_alert_count;
+static int32_t oc_alert_peak;
+static uint8_t bq_alert; // alert pin level at the last current sample
+static fuse_S fuse_dsg;
+static fuse_S fuse_chg; // fed the negated current
+static uint32_t fuse_tick;
 static batt_fetState_E pch_state;
 static batt_fetState_E chg_state;
 static batt_fetState_E dsg_state;
+static uint8_t fets_applied; // chg and dsg bits sys_ctrl2 was last written with
 static batt_fetState_E bal_state[CELL_COUNT];
-static uint8_t faults;
 static uint16_t v_min;
 static uint16_t v_max;
 static uint16_t v_avg;
 static uint16_t v_sum;
 static uint8_t t_max;
+static batt_cal_S cal[SENSE_COUNT];
+static int32_t current_offset_ref;
+static uint32_t last_fet_on_time;
+static uint8_t sense_ready; // channels converted at least once since init
+static uint8_t bq_ready;
+
+static const batt_cal_S cal_default[SENSE_COUNT] =
+{
+	[SENSE_CURRENT] = { .gain = 50366, .offset = 519395 }, // 62.5 mA/mV about 1635 mV
+	[SENSE_FET_TEMP] = { .gain = 806, .offset = 0 }, // mV at the adc pin
+	[SENSE_PACK] = { .gain = 15027, .offset = 0 }, // 18.647 divider
+	[SENSE_CHARGER] = { .gain = 15027, .offset = 0 },
+};
+
+static const batt_senseSchedule_S sense_schedule[SENSE_COUNT] =
+{
+	[SENSE_CURRENT] = { .period_ms = { 0, 0, 100, 1000 }, .settle_ms = 4, .samples = 4, .rails = (1 << RAIL_SNS) },
+	[SENSE_FET_TEMP] = { .period_ms = { 1000, 1000, 1000, 5000 }, .settle_ms = 10, .samples = 4, .rails = 0 },
+	[SENSE_PACK] = { .period_ms = { 200, 20, 200, 1000 }, .settle_ms = 4, .samples = 4, .rails = (1 << RAIL_PMON) },
+	[SENSE_CHARGER] = { .period_ms = { 500, 500, 500, 2000 }, .settle_ms = 4, .samples = 2, .rails = 0 },
+};
+
+static const TCA9534_channel_E rail_channel[RAIL_COUNT] =
+{
+	[RAIL_SNS] = CHANNEL_SNS_EN,
+	[RAIL_PMON] = CHANNEL_PMON_EN,
+	[RAIL_TMUX] = CHANNEL_TMUX_EN,
+	[RAIL_CP] = CHANNEL_CP_EN,
+};
+
+static const uint16_t rail_iq_ua[RAIL_COUNT] =
+{
+	[RAIL_SNS] = IQ_SNS_UA,
+	[RAIL_PMON] = IQ_PMON_UA,
+	[RAIL_TMUX] = IQ_TMUX_UA,
+	[RAIL_CP] = IQ_CP_UA,
+};
+
+// fuse curves on the current stream, everything below the alert window is
+// left to these so a motor can pull bursts the cells and fets can take
+static const fuse_point_S fuse_dsg_points[] =
+{
+	{ 25000, 5000 },
+	{ 30000, 3500 },
+	{ 40000, 2000 },
+	{ 45000, 500 },
+};
+
+static const fuse_point_S fuse_chg_points[] =
+{
+	{ 10000, 5000 },
+	{ 12000, 2000 },
+	{ 15000, 500 },
+};
+
+static const fuse_curve_S fuse_dsg_curve = { .rated_ma = 20000, .cool_ms = 30000, .points = fuse_dsg_points, .count = sizeof(fuse_dsg_points) / sizeof(fuse_dsg_points[0]) };
+static const fuse_curve_S fuse_chg_curve = { .rated_ma = 8000, .cool_ms = 30000, .points = fuse_chg_points, .count = sizeof(fuse_chg_points) / sizeof(fuse_chg_points[0]) };
+
+static const uint16_t ntc_resistance_table[NTC_TABLE_LEN] =
+{
+	35820, 27340, 21020, 16290, 12720, 10000, 7921, 6315,
+	5067, 4090, 3319, 2709, 2222, 1832, 1518,
+};
 
 static BQ76930_cell_E getBQCell(batt_cell_E cell)
 {
@@ -65,6 +230,413 @@ static BQ76930_cell_E getBQCell(batt_cell_E cell)
 	}
 }
 
+static int32_t batt_convert(batt_sense_E sense, int32_t adc_q8)
+{
+	int32_t delta = adc_q8 - cal[sense].offset;
+
+	return ((int64_t)cal[sense].gain * delta) / (1000 << CAL_OFFSET_SHIFT);
+}
+
+static uint16_t batt_convertInverse(batt_sense_E sense, int32_t value)
+{
+	int32_t adc_q8 = cal[sense].offset + (((int64_t)value * (1000 << CAL_OFFSET_SHIFT)) / cal[sense].gain);
+	int32_t adc = adc_q8 >> CAL_OFFSET_SHIFT;
+
+	if (adc < 0)
+	{
+		return 0;
+	}
+
+	if (adc > 0x0FFF)
+	{
+		return 0x0FFF;
+	}
+
+	return adc;
+}
+
+static uint8_t batt_ntc2Temp(int32_t mv)
+{
+	if (mv >= NTC_SUPPLY_MV)
+	{
+		return 0;
+	}
+
+	int32_t r = (NTC_PULLUP_OHM * mv) / (NTC_SUPPLY_MV - mv);
+
+	if (r >= ntc_resistance_table[0])
+	{
+		return 0;
+	}
+
+	uint32_t i = 1;
+	while ((i < (NTC_TABLE_LEN - 1)) && (r < ntc_resistance_table[i]))
+	{
+		i++;
+	}
+
+	if (r < ntc_resistance_table[i])
+	{
+		return 5 * i;
+	}
+
+	// 5 C per table step
+	int32_t r1 = ntc_resistance_table[i - 1];
+	int32_t r2 = ntc_resistance_table[i];
+
+	return (5 * (i - 1)) + ((5 * (r1 - r)) / (r1 - r2));
+}
+
+static void batt_selectSense(batt_sense_E sense)
+{
+	TCA9534_writePin(&tca, CHANNEL_TMUX_SEL_0, (sense & 1) ? GPIO_PIN_SET : GPIO_PIN_RESET);
+	TCA9534_writePin(&tca, CHANNEL_TMUX_SEL_1, (sense & 2) ? GPIO_PIN_SET : GPIO_PIN_RESET);
+}
+
+static void batt_setRails(uint8_t rails)
+{
+	for (uint32_t i = 0; i < RAIL_COUNT; i++)
+	{
+		TCA9534_writePin(&tca, rail_channel[i], ((rails >> i) & 1) ? GPIO_PIN_SET : GPIO_PIN_RESET);
+	}
+
+	rails_on = rails;
+}
+
+static batt_acqMode_E batt_acqMode(void)
+{
+	if ((pch_state == FET_OFF) && (chg_state == FET_OFF) && (dsg_state == FET_OFF))
+	{
+		return ACQ_MODE_STORAGE;
+	}
+
+	if ((pch_state == FET_ON) && (dsg_state == FET_OFF))
+	{
+		return ACQ_MODE_PRECHARGE;
+	}
+
+	return acq_low_power ? ACQ_MODE_IDLE : ACQ_MODE_FAST;
+}
+
+static void batt_loadCalibration(void)
+{
+	if (eeprom_readRecord(EEPROM_ADDR_CAL, cal, sizeof(cal)) != HAL_OK)
+	{
+		batt_resetCalibration();
+	}
+
+	current_offset_ref = cal[SENSE_CURRENT].offset;
+
+	i2c_trace_mark(I2C_TRACE_MARK_CAL, cal, sizeof(cal));
+}
+
+// no path for current and long enough since the last one closed for the sensor to settle
+static uint8_t batt_isZeroCurrent(void)
+{
+	if ((pch_state != FET_OFF) || (chg_state != FET_OFF) || (dsg_state != FET_OFF))
+	{
+		last_fet_on_time = HAL_GetTick();
+		return 0;
+	}
+
+	return (HAL_GetTick() - last_fet_on_time) >= AUTOZERO_SETTLE_MS;
+}
+
+static void batt_autoZero(int32_t adc_q8)
+{
+	if (!batt_isZeroCurrent())
+	{
+		return;
+	}
+
+	int32_t drift = adc_q8 - current_offset_ref;
+
+	// a reading this far off is a real current (leakage, fault), not offset drift
+	if ((drift > AUTOZERO_LIMIT) || (drift < -AUTOZERO_LIMIT))
+	{
+		return;
+	}
+
+	cal[SENSE_CURRENT].offset += (adc_q8 - cal[SENSE_CURRENT].offset) / AUTOZERO_FILTER;
+}
+
+static uint8_t batt_fetBits(void)
+{
+	return ((chg_state == FET_ON) << FET_CHG) | ((dsg_state == FET_ON) << FET_DSG);
+}
+
+static HAL_StatusTypeDef batt_applyFets(void)
+{
+	HAL_StatusTypeDef status = BQ76930_updateFets(&bq);
+
+	if (status == HAL_OK)
+	{
+		fets_applied = batt_fetBits();
+	}
+
+	return status;
+}
+
+static HAL_StatusTypeDef batt_armCurrentAlert(void)
+{
+	uint16_t low = batt_convertInverse(SENSE_CURRENT, OC_ALERT_CHG_MA);
+	uint16_t high = batt_convertInverse(SENSE_CURRENT, OC_ALERT_DSG_MA);
+	uint16_t hyst = batt_convertInverse(SENSE_CURRENT, OC_ALERT_HYST_MA) - batt_convertInverse(SENSE_CURRENT, 0);
+
+	return ADC121_setAlertWindow(&adc, low, high, hyst);
+}
+
+static void batt_currentAlert(void)
+{
+	// the adc latched a conversion outside the window since the last read or
+	// a fuse ran out, open the fets now rather than waiting for the state machine
+	oc_alert = 1;
+	oc_alert_count = 0;
+
+	blackbox_trigger(FAULT_OC);
+
+	uint16_t lowest;
+	uint16_t highest;
+
+	acq_status |= ADC121_readExtremes(&adc, &lowest, &highest);
+
+	int32_t i_low = batt_convert(SENSE_CURRENT, (int32_t)lowest << CAL_OFFSET_SHIFT);
+	int32_t i_high = batt_convert(SENSE_CURRENT, (int32_t)highest << CAL_OFFSET_SHIFT);
+
+	oc_alert_peak = (i_high > -i_low) ? i_high : i_low;
+
+	chg_state = FET_OFF;
+	dsg_state = FET_OFF;
+
+	BQ76930_setCharge(&bq, BQ76930_FET_STATE_OFF);
+	BQ76930_setDischarge(&bq, BQ76930_FET_STATE_OFF);
+
+	acq_status |= batt_applyFets();
+	acq_status |= ADC121_clearAlert(&adc);
+}
+
+static void batt_pollBqAlert(void)
+{
+	// sys_stat is only read every update, the alert pin follows it at the sample rate
+	acq_status |= TCA9534_updateInputs(&tca);
+
+	uint8_t alert = (TCA9534_readPin(&tca, CHANNEL_BQ_ALERT) == GPIO_PIN_SET);
+	uint8_t rising = alert && !bq_alert;
+
+	bq_alert = alert;
+
+	if (!rising)
+	{
+		return;
+	}
+
+	// the bq has already opened the fets on an ocd or scd, name the trip while
+	// the samples leading up to it are still in the capture
+	acq_status |= BQ76930_updateFaults(&bq);
+
+	if (BQ76930_getFault(&bq, BQ76930_FAULT_SCD))
+	{
+		blackbox_trigger(FAULT_SC);
+	}
+	else if (BQ76930_getFault(&bq, BQ76930_FAULT_OCD))
+	{
+		blackbox_trigger(FAULT_OC);
+	}
+}
+
+static batt_sense_E batt_nextSense(batt_acqMode_E mode, uint32_t now)
+{
+	batt_sense_E next = SENSE_COUNT;
+	uint32_t next_overdue = 0;
+
+	for (uint32_t i = 0; i < SENSE_COUNT; i++)
+	{
+		uint32_t period = sense_schedule[i].period_ms[mode];
+		uint32_t elapsed = now - sense_visit_time[i];
+
+		if ((period == 0) || (elapsed < period))
+		{
+			continue;
+		}
+
+		if ((next == SENSE_COUNT) || ((elapsed - period) > next_overdue))
+		{
+			next = i;
+			next_overdue = elapsed - period;
+		}
+	}
+
+	return next;
+}
+
+static void batt_senseComplete(batt_sense_E sense, int32_t adc_q8, uint32_t now)
+{
+	sense_result[sense].value = batt_convert(sense, adc_q8);
+	sense_result[sense].tick = now;
+	sense_visit_time[sense] = now;
+	sense_ready |= (1 << sense);
+
+	if (sense == SENSE_FET_TEMP)
+	{
+		fet_temp = batt_ntc2Temp(sense_result[sense].value);
+	}
+}
+
+static void batt_recordSample(int32_t current)
+{
+	blackbox_sample_S sample;
+
+	sample.tick = HAL_GetTick();
+	sample.current = current / 10;
+	sample.v_min = v_min;
+	sample.v_max = v_max;
+	sample.pack_voltage = sense_result[SENSE_PACK].value;
+	sample.t_max = t_max;
+	sample.fet = ((pch_state == FET_ON) ? BLACKBOX_FET_PCH : 0) | ((chg_state == FET_ON) ? BLACKBOX_FET_CHG : 0) | ((dsg_state == FET_ON) ? BLACKBOX_FET_DSG : 0);
+
+	blackbox_record(&sample);
+}
+
+static void batt_sampleCurrent(uint16_t adc_raw)
+{
+	int32_t current = batt_convert(SENSE_CURRENT, (int32_t)adc_raw << CAL_OFFSET_SHIFT);
+
+	current_adc_sum += adc_raw;
+	current_adc_count++;
+	current_window_min = (current < current_window_min) ? current : current_window_min;
+	current_window_max = (current > current_window_max) ? current : current_window_max;
+
+	batt_recordSample(current);
+
+	if (ADC121_getAlert(&adc))
+	{
+		if (++oc_alert_count >= OC_ALERT_SAMPLES)
+		{
+			batt_currentAlert();
+		}
+		else
+		{
+			// rearm so the next sample only sees the next conversion
+			acq_status |= ADC121_clearAlert(&adc);
+		}
+	}
+	else
+	{
+		oc_alert_count = 0;
+	}
+
+	uint32_t now = HAL_GetTick();
+	uint32_t dt = now - fuse_tick;
+
+	fuse_tick = now;
+	dt = (dt > FUSE_DT_MAX_MS) ? FUSE_DT_MAX_MS : dt;
+
+	if ((fuse_update(&fuse_dsg, current, dt) | fuse_update(&fuse_chg, -current, dt)) && !oc_alert)
+	{
+		batt_currentAlert();
+	}
+
+	pack_current_fast += (current - pack_current_fast) / ACQ_FAST_FILTER;
+}
+
+static void batt_acqSelect(batt_sense_E sense, batt_acqMode_E mode)
+{
+	// the window only applies to the current channel
+	if ((acq_state != ACQ_IDLE) && (acq_sense == SENSE_CURRENT))
+	{
+		acq_status |= ADC121_enableAlert(&adc, 0);
+	}
+
+	uint8_t rails = (rails_on & (1 << RAIL_CP)) | (1 << RAIL_TMUX) | sense_schedule[sense].rails;
+
+	// keep the hall sensor warm while current is the home channel
+	if ((mode == ACQ_MODE_FAST) || (mode == ACQ_MODE_PRECHARGE))
+	{
+		rails |= (1 << RAIL_SNS);
+	}
+
+	// and the pack divider while precharge keeps coming back to it
+	if (mode == ACQ_MODE_PRECHARGE)
+	{
+		rails |= (1 << RAIL_PMON);
+	}
+
+	uint8_t warmup = (rails & ~rails_on) ? RAIL_WARMUP_MS : 0;
+
+	batt_selectSense(sense);
+	batt_setRails(rails);
+
+	PROFILE_START(PROFILE_STAGE_TCA);
+	acq_status |= TCA9534_updateOutputs(&tca);
+	PROFILE_STOP(PROFILE_STAGE_TCA);
+
+	acq_sense = sense;
+	acq_state = ACQ_SETTLE;
+	acq_switch_time = HAL_GetTick() + warmup;
+}
+
+static void batt_acqStop(void)
+{
+	if ((acq_state != ACQ_IDLE) && (acq_sense == SENSE_CURRENT))
+	{
+		acq_status |= ADC121_enableAlert(&adc, 0);
+	}
+
+	batt_setRails(rails_on & (1 << RAIL_CP));
+
+	acq_status |= TCA9534_updateOutputs(&tca);
+
+	acq_state = ACQ_IDLE;
+}
+
+static void batt_acqNext(batt_acqMode_E mode, uint32_t now)
+{
+	batt_sense_E next = batt_nextSense(mode, now);
+
+	if (next != SENSE_COUNT)
+	{
+		batt_acqSelect(next, mode);
+	}
+	else if ((mode == ACQ_MODE_FAST) || (mode == ACQ_MODE_PRECHARGE))
+	{
+		if ((acq_state == ACQ_IDLE) || (acq_sense != SENSE_CURRENT))
+		{
+			batt_acqSelect(SENSE_CURRENT, mode);
+		}
+	}
+	else if (acq_state != ACQ_IDLE)
+	{
+		batt_acqStop();
+	}
+}
+
+static HAL_StatusTypeDef batt_sampleAverage(batt_sense_E sense, int32_t *adc_avg)
+{
+	HAL_StatusTypeDef status = HAL_OK;
+
+	batt_acqSelect(sense, ACQ_MODE_FAST);
+
+	HAL_Delay(CAL_SETTLE_MS);
+
+	int32_t sum = 0;
+
+	for (uint32_t i = 0; i < CAL_SAMPLES; i++)
+	{
+		HAL_Delay(CAL_SAMPLE_PERIOD_MS);
+
+		status |= ADC121_update(&adc);
+
+		sum += ADC121_read(&adc);
+	}
+
+	*adc_avg = (sum << CAL_OFFSET_SHIFT) / CAL_SAMPLES;
+
+	// hand the mux back to the acquisition stage
+	batt_acqStop();
+
+	return status;
+}
+
 void batt_init(void)
 {
 	BQ76930_config_S config =
@@ -77,13 +649,31 @@ void batt_init(void)
 
 	HAL_StatusTypeDef status = HAL_OK;
 
-	pack_voltage = 0;
-	pack_current = 0;
-	adc_select = 1;
+	pack_current_fast = 0;
+	charge_mams = 0;
+	acq_adc_sum = 0;
+	acq_adc_count = 0;
+	current_adc_sum = 0;
+	current_adc_count = 0;
+	fet_temp = 0;
+	acq_status = HAL_OK;
+	acq_state = ACQ_IDLE;
+	acq_sense = SENSE_CURRENT;
+	acq_low_power = 0;
+	iq_ua = IQ_BASE_UA;
+	iq_window_start = HAL_GetTick();
+	oc_alert = 0;
+	oc_alert_count = 0;
+	bq_alert = 0;
+	oc_alert_peak = 0;
+	fuse_init(&fuse_dsg, &fuse_dsg_curve);
+	fuse_init(&fuse_chg, &fuse_chg_curve);
+	fuse_tick = HAL_GetTick();
 	pch_state = FET_OFF;
 	chg_state = FET_OFF;
 	dsg_state = FET_OFF;
-	faults = 0;
+	fets_applied = 0;
+	fault_reset();
 	v_min = 0;
 	v_max = 0;
 	v_avg = 0;
@@ -95,7 +685,36 @@ void batt_init(void)
 		bal_state[i] = FET_OFF;
 	}
 
+	// everything is due for a first window
+	for (uint32_t i = 0; i < SENSE_COUNT; i++)
+	{
+		sense_result[i].value = 0;
+		sense_result[i].tick = HAL_GetTick();
+		sense_visit_time[i] = HAL_GetTick() - sense_schedule[i].period_ms[ACQ_MODE_STORAGE];
+	}
+
+	for (uint32_t i = 0; i < RAIL_COUNT; i++)
+	{
+		rail_on_ms[i] = 0;
+	}
+
+	last_fet_on_time = HAL_GetTick();
+	sense_ready = 0;
+	bq_ready = 0;
+	current_window_min = INT32_MAX;
+	current_window_max = INT32_MIN;
+	current_window.start = HAL_GetTick();
+	current_window.end = HAL_GetTick();
+	current_window.mean = 0;
+	current_window.min = 0;
+	current_window.max = 0;
+	cell_tick = 0;
+
+	batt_loadCalibration();
+
 	status |= ADC121_init(&adc, &hi2c1, I2C_TIMEOUT_MS);
+	status |= ADC121_setCycleTime(&adc, ADC121_CYCLE_1024);
+	status |= batt_armCurrentAlert();
 	status |= BQ76930_init(&bq, &hi2c1, &config, I2C_TIMEOUT_MS);
 	status |= TCA9534_init(&tca, &hi2c1, I2C_TIMEOUT_MS);
 
@@ -109,54 +728,180 @@ void batt_init(void)
     TCA9534_setPinDirection(&tca, CHANNEL_BQ_ALERT, TCA9534_INPUT);
 
     TCA9534_writePin(&tca, CHANNEL_PCHG_EN, GPIO_PIN_RESET);
-    TCA9534_writePin(&tca, CHANNEL_PMON_EN, GPIO_PIN_SET);
 
-    TCA9534_writePin(&tca, CHANNEL_CP_EN, GPIO_PIN_SET);
+    // sense rails and the charge pump come up with the acquisition schedule and fets
+    batt_selectSense(SENSE_CURRENT);
+    batt_setRails(0);
 
-    TCA9534_writePin(&tca, CHANNEL_TMUX_SEL_0, GPIO_PIN_RESET);
-    TCA9534_writePin(&tca, CHANNEL_TMUX_SEL_1, GPIO_PIN_SET);
+    status |= TCA9534_update(&tca);
 
-    TCA9534_writePin(&tca, CHANNEL_SNS_EN, GPIO_PIN_SET);
-    TCA9534_writePin(&tca, CHANNEL_TMUX_EN, GPIO_PIN_SET);
+    last_sample_time = HAL_GetTick();
 
-    status |= TCA9534_update(&tca);
+    fault_update(FAULT_COMMS, (status != HAL_OK), HAL_GetTick());
+}
+
+void batt_sample(void)
+{
+	uint32_t now = HAL_GetTick();
+	uint32_t dt = now - last_sample_time;
+
+	if (dt < ACQ_PERIOD_MS)
+	{
+		return;
+	}
 
-    faults = BATT_SET_BIT(faults, FAULT_COMMS, (status != HAL_OK));
+	last_sample_time = now;
+
+	// hold the filtered current across pack windows and bus stalls
+	charge_mams += pack_current_fast * (int32_t)dt;
+
+	for (uint32_t i = 0; i < RAIL_COUNT; i++)
+	{
+		if ((rails_on >> i) & 1)
+		{
+			rail_on_ms[i] += dt;
+		}
+	}
+
+	// the bq can only trip with a fet closed, every other channel visit included
+	if ((chg_state == FET_ON) || (dsg_state == FET_ON))
+	{
+		batt_pollBqAlert();
+	}
+
+	batt_acqMode_E mode = batt_acqMode();
+	HAL_StatusTypeDef adc_status;
+
+	switch (acq_state)
+	{
+	case ACQ_IDLE:
+		batt_acqNext(mode, now);
+		break;
+
+	case ACQ_SETTLE:
+		if ((int32_t)(now - acq_switch_time) >= sense_schedule[acq_sense].settle_ms)
+		{
+			if (acq_sense == SENSE_CURRENT)
+			{
+				acq_status |= ADC121_clearAlert(&adc);
+				acq_status |= ADC121_resetExtremes(&adc);
+				acq_status |= ADC121_enableAlert(&adc, 1);
+			}
+
+			acq_adc_sum = 0;
+			acq_adc_count = 0;
+			acq_state = ACQ_SAMPLE;
+		}
+		break;
+
+	case ACQ_SAMPLE:
+		PROFILE_START(PROFILE_STAGE_ADC);
+		adc_status = ADC121_update(&adc);
+		PROFILE_STOP(PROFILE_STAGE_ADC);
+
+		if (adc_status != HAL_OK)
+		{
+			acq_status = HAL_ERROR;
+			break;
+		}
+
+		acq_adc_count++;
+
+		if (acq_sense == SENSE_CURRENT)
+		{
+			batt_sampleCurrent(ADC121_read(&adc));
+
+			if ((sense_schedule[SENSE_CURRENT].period_ms[mode] == 0) || (acq_adc_count >= sense_schedule[SENSE_CURRENT].samples))
+			{
+				sense_visit_time[SENSE_CURRENT] = now;
+
+				batt_acqNext(mode, now);
+			}
+		}
+		else
+		{
+			acq_adc_sum += ADC121_read(&adc);
+
+			if (acq_adc_count >= sense_schedule[acq_sense].samples)
+			{
+				batt_senseComplete(acq_sense, (acq_adc_sum << CAL_OFFSET_SHIFT) / acq_adc_count, now);
+
+				batt_acqNext(mode, now);
+			}
+		}
+		break;
+
+	default:
+		batt_acqStop();
+		break;
+	}
 }
 
 void batt_update(void)
 {
-	HAL_StatusTypeDef status = HAL_OK;
+	HAL_StatusTypeDef status = acq_status;
 
-	status |= ADC121_update(&adc);
+	acq_status = HAL_OK;
 
-	uint32_t adc_mv = (3300 * ADC121_read(&adc)) / 4095;
-
-	if (adc_select)
+	// decimate the high-rate current samples taken since the last update
+	if (current_adc_count > 0)
 	{
-		pack_voltage = (18647 * adc_mv) / 1000;
+		int32_t adc_avg = (current_adc_sum << CAL_OFFSET_SHIFT) / current_adc_count;
+
+		batt_autoZero(adc_avg);
 
-	    TCA9534_writePin(&tca, CHANNEL_TMUX_SEL_0, GPIO_PIN_RESET);
-	    TCA9534_writePin(&tca, CHANNEL_TMUX_SEL_1, GPIO_PIN_RESET);
+		sense_result[SENSE_CURRENT].value = batt_convert(SENSE_CURRENT, adc_avg);
+		sense_result[SENSE_CURRENT].tick = last_sample_time;
+		sense_ready |= (1 << SENSE_CURRENT);
 
-	    TCA9534_writePin(&tca, CHANNEL_PMON_EN, GPIO_PIN_RESET);
+		current_window.start = current_window.end;
+		current_window.end = last_sample_time;
+		current_window.mean = sense_result[SENSE_CURRENT].value;
+		current_window.min = current_window_min;
+		current_window.max = current_window_max;
 
-		adc_select = 0;
+		current_adc_sum = 0;
+		current_adc_count = 0;
+		current_window_min = INT32_MAX;
+		current_window_max = INT32_MIN;
 	}
-	else
+
+	uint32_t iq_window = HAL_GetTick() - iq_window_start;
+
+	if (iq_window > 0)
 	{
-		pack_current = ((62500 * ((int32_t)adc_mv - 1650)) / 1000) + 937;
+		iq_ua = IQ_BASE_UA;
+
+		for (uint32_t i = 0; i < RAIL_COUNT; i++)
+		{
+			iq_ua += (rail_iq_ua[i] * rail_on_ms[i]) / iq_window;
+			rail_on_ms[i] = 0;
+		}
+
+		iq_window_start = HAL_GetTick();
+	}
 
-	    TCA9534_writePin(&tca, CHANNEL_TMUX_SEL_0, GPIO_PIN_RESET);
-	    TCA9534_writePin(&tca, CHANNEL_TMUX_SEL_1, GPIO_PIN_SET);
+	PROFILE_START(PROFILE_STAGE_BQ);
+	HAL_StatusTypeDef bq_status = BQ76930_update(&bq);
+	PROFILE_STOP(PROFILE_STAGE_BQ);
 
-	    TCA9534_writePin(&tca, CHANNEL_PMON_EN, GPIO_PIN_SET);
+	status |= bq_status;
 
-		adc_select = 1;
+	if (bq_status == HAL_OK)
+	{
+		cell_tick = HAL_GetTick();
+		fets_applied = batt_fetBits();
 	}
 
-	status |= BQ76930_update(&bq);
+	// the fets are open on the bq now, the charge pump can go
+	if ((pch_state == FET_OFF) && (chg_state == FET_OFF) && (dsg_state == FET_OFF))
+	{
+		batt_setRails(rails_on & ~(1 << RAIL_CP));
+	}
+
+	PROFILE_START(PROFILE_STAGE_TCA);
 	status |= TCA9534_update(&tca);
+	PROFILE_STOP(PROFILE_STAGE_TCA);
 
 	v_min = batt_getCellVoltage(CELL_1);
 	v_max = v_min;
@@ -181,9 +926,12 @@ void batt_update(void)
 
 	v_avg = v_sum / CELL_COUNT;
 
+	bq_ready |= (bq_status == HAL_OK) && (v_min >= CELL_VALID_MIN_MV);
+
 	t_max = batt_getTemp(THERMISTOR_1);
 
-	for (uint32_t i = 1; i < TEMP_COUNT; i++)
+	// the fet heatsink is not a cell temperature
+	for (uint32_t i = 1; i < TEMP_FET; i++)
 	{
 		uint8_t t = batt_getTemp(i);
 
@@ -193,24 +941,20 @@ void batt_update(void)
 		}
 	}
 
-	uint8_t fault_ov = BQ76930_getFault(&bq, BQ76930_FAULT_OV);
-	uint8_t fault_uv = BQ76930_getFault(&bq, BQ76930_FAULT_UV);
-	uint8_t fault_oc = BQ76930_getFault(&bq, BQ76930_FAULT_OCD);
-	uint8_t fault_sc = BQ76930_getFault(&bq, BQ76930_FAULT_SCD);
-	uint8_t fault_bq = BQ76930_getFault(&bq, BQ76930_FAULT_INTERNAL);
-	uint8_t fault_ot = 0;
+	uint32_t now = HAL_GetTick();
 
-//	fault_ov |= (v_max > OV_THRESH_MV);
-//	fault_uv |= (v_min < UV_THRESH_MV);
-	fault_ot |= (t_max > OT_THRESH_C);
+	fault_update(FAULT_OV, BQ76930_getFault(&bq, BQ76930_FAULT_OV), now);
+	fault_update(FAULT_UV, BQ76930_getFault(&bq, BQ76930_FAULT_UV), now);
+	fault_update(FAULT_OC, BQ76930_getFault(&bq, BQ76930_FAULT_OCD) | oc_alert, now);
+	fault_update(FAULT_SC, BQ76930_getFault(&bq, BQ76930_FAULT_SCD), now);
+	fault_update(FAULT_BQ, BQ76930_getFault(&bq, BQ76930_FAULT_INTERNAL), now);
+	fault_update(FAULT_COMMS, (status != HAL_OK), now);
 
-	faults = BATT_SET_BIT(faults, FAULT_OV, fault_ov);
-	faults = BATT_SET_BIT(faults, FAULT_UV, fault_uv);
-	faults = BATT_SET_BIT(faults, FAULT_OC, fault_oc);
-	faults = BATT_SET_BIT(faults, FAULT_SC, fault_sc);
-	faults = BATT_SET_BIT(faults, FAULT_BQ, fault_bq);
-	faults = BATT_SET_BIT(faults, FAULT_OT, fault_ot);
-	faults = BATT_SET_BIT(faults, FAULT_COMMS, (status != HAL_OK));
+	// a failed read leaves the temperatures stale, hold the ot timer where it is
+	if (bq_status == HAL_OK)
+	{
+		fault_update(FAULT_OT, t_max, now);
+	}
 }
 
 uint16_t batt_getCellVoltage(batt_cell_E cell)
@@ -252,12 +996,72 @@ uint16_t batt_getCellVoltage(batt_cell_E cell)
 
 uint16_t batt_getPackVoltage(void)
 {
-	return pack_voltage;
+	return sense_result[SENSE_PACK].value;
+}
+
+uint16_t batt_getChargerVoltage(void)
+{
+	return sense_result[SENSE_CHARGER].value;
 }
 
 int32_t batt_getPackCurrent(void)
 {
-	return pack_current;
+	return sense_result[SENSE_CURRENT].value;
+}
+
+int32_t batt_getPackCurrentFast(void)
+{
+	return pack_current_fast;
+}
+
+void batt_getCurrentWindow(batt_currentWindow_S *window)
+{
+	*window = current_window;
+}
+
+// when the cell voltages were last read
+uint32_t batt_getCellTick(void)
+{
+	return cell_tick;
+}
+
+int32_t batt_getOverCurrentPeak(void)
+{
+	return oc_alert_peak;
+}
+
+// percent of the way to a fuse trip, whichever direction is closer
+uint8_t batt_getFuseHeat(void)
+{
+	uint8_t dsg = fuse_getHeat(&fuse_dsg);
+	uint8_t chg = fuse_getHeat(&fuse_chg);
+
+	return (dsg > chg) ? dsg : chg;
+}
+
+// mA that fet's direction can carry for window_ms on what is left of its fuse budget
+int32_t batt_getFuseLimit(batt_fet_E fet, uint32_t window_ms)
+{
+	return fuse_getLimit((fet == FET_CHG) ? &fuse_chg : &fuse_dsg, window_ms);
+}
+
+uint32_t batt_getQuiescentCurrent(void)
+{
+	return iq_ua;
+}
+
+void batt_setLowPower(uint8_t enable)
+{
+	acq_low_power = enable;
+}
+
+int32_t batt_takeCharge(void)
+{
+	int32_t charge = charge_mams / 1000;
+
+	charge_mams -= charge * 1000;
+
+	return charge;
 }
 
 uint8_t batt_getTemp(batt_temp_E temp)
@@ -271,9 +1075,15 @@ uint8_t batt_getTemp(batt_temp_E temp)
 	case BQ_2:
 		return BQ76930_getTemp(&bq, (BQ76930_temp_E)temp);
 
+	case TEMP_FET:
+		return fet_temp;
+
 	case TEMP_MAX:
 		return t_max;
 
+	case TEMP_AVG:
+		return (batt_getTemp(THERMISTOR_1) + batt_getTemp(THERMISTOR_2) + batt_getTemp(THERMISTOR_3)) / 3;
+
 	case TEMP_COUNT:
 	default:
 		return 0;
@@ -282,12 +1092,28 @@ uint8_t batt_getTemp(batt_temp_E temp)
 
 uint8_t batt_getFault(batt_fault_E fault)
 {
-	return (faults >> fault) & 1;
+	return fault_isActive(fault);
 }
 
 uint8_t batt_getFaultMask(void)
 {
-	return faults;
+	return fault_getMask();
+}
+
+uint16_t batt_getFaultCount(batt_fault_E fault)
+{
+	return fault_getCount(fault);
+}
+
+// held until the next batt_init
+void batt_latchFault(batt_fault_E fault)
+{
+	fault_latch(fault);
+}
+
+uint8_t batt_isReady(void)
+{
+	return bq_ready && (sense_ready == ((1 << SENSE_COUNT) - 1));
 }
 
 batt_fetState_E batt_getFetState(batt_fet_E fet)
@@ -308,6 +1134,17 @@ batt_fetState_E batt_getFetState(batt_fet_E fet)
 	}
 }
 
+// what the afe has been told, the precharge fet has no write to wait on
+batt_fetState_E batt_getFetOutput(batt_fet_E fet)
+{
+	if (fet == FET_PCH)
+	{
+		return pch_state;
+	}
+
+	return (fets_applied & (1 << fet)) ? FET_ON : FET_OFF;
+}
+
 batt_fetState_E batt_getBalanceState(batt_cell_E cell)
 {
 	return bal_state[cell];
@@ -315,6 +1152,16 @@ batt_fetState_E batt_getBalanceState(batt_cell_E cell)
 
 void batt_setFetState(batt_fet_E fet, batt_fetState_E state)
 {
+	// bring the charge pump up ahead of the fet so the gate drive is ready
+	if ((state == FET_ON) && !(rails_on & (1 << RAIL_CP)))
+	{
+		batt_setRails(rails_on | (1 << RAIL_CP));
+
+		(void)TCA9534_updateOutputs(&tca);
+	}
+
+	uint8_t fets = batt_fetBits();
+
 	switch (fet)
 	{
 	case FET_PCH:
@@ -335,6 +1182,12 @@ void batt_setFetState(batt_fet_E fet, batt_fetState_E state)
 	default:
 		break;
 	}
+
+	// write sys_ctrl2 now rather than on the next update, a failed write is retried there
+	if (batt_fetBits() != fets)
+	{
+		acq_status |= batt_applyFets();
+	}
 }
 
 void batt_setBalance(batt_cell_E cell, batt_fetState_E state)
@@ -345,6 +1198,13 @@ void batt_setBalance(batt_cell_E cell, batt_fetState_E state)
 
 void batt_shutdown(void)
 {
+	int32_t drift = cal[SENSE_CURRENT].offset - current_offset_ref;
+
+	if ((drift > AUTOZERO_SAVE_THRESH) || (drift < -AUTOZERO_SAVE_THRESH))
+	{
+		(void)batt_saveCalibration();
+	}
+
     TCA9534_writePin(&tca, CHANNEL_PCHG_EN, GPIO_PIN_RESET);
     TCA9534_writePin(&tca, CHANNEL_PMON_EN, GPIO_PIN_RESET);
     TCA9534_writePin(&tca, CHANNEL_CP_EN, GPIO_PIN_RESET);
@@ -359,3 +1219,91 @@ void batt_shutdown(void)
     (void)BQ76930_shutdown(&bq);
     (void)ADC121_shutdown(&adc);
 }
+
+void batt_getSense(batt_sense_E sense, batt_senseResult_S *result)
+{
+	*result = sense_result[sense];
+}
+
+void batt_getCalibration(batt_sense_E sense, batt_cal_S *cal_out)
+{
+	*cal_out = cal[sense];
+}
+
+HAL_StatusTypeDef batt_calibrateOffset(batt_sense_E sense)
+{
+	int32_t adc_avg;
+
+	// a load current taken as the zero would sit outside the auto-zero limit for good
+	if (!batt_isZeroCurrent())
+	{
+		return HAL_ERROR;
+	}
+
+	HAL_StatusTypeDef status = batt_sampleAverage(sense, &adc_avg);
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	cal[sense].offset = adc_avg;
+
+	if (sense == SENSE_CURRENT)
+	{
+		current_offset_ref = adc_avg;
+	}
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef batt_calibrateGain(batt_sense_E sense, int32_t reference)
+{
+	int32_t adc_avg;
+
+	// the capture blocks sampling, the fuses and the alert polling, keep the
+	// reference where the fuses would not have counted it anyway
+	if ((sense == SENSE_CURRENT) && ((reference > fuse_dsg_curve.rated_ma) || (reference < -fuse_chg_curve.rated_ma)))
+	{
+		return HAL_ERROR;
+	}
+
+	HAL_StatusTypeDef status = batt_sampleAverage(sense, &adc_avg);
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	int32_t delta = adc_avg - cal[sense].offset;
+
+	// reference must be applied in the positive direction and well above the offset
+	if (delta < (16 << CAL_OFFSET_SHIFT))
+	{
+		return HAL_ERROR;
+	}
+
+	cal[sense].gain = ((int64_t)reference * (1000 << CAL_OFFSET_SHIFT)) / delta;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef batt_saveCalibration(void)
+{
+	HAL_StatusTypeDef status = eeprom_writeRecord(EEPROM_ADDR_CAL, cal, sizeof(cal));
+
+	if (status == HAL_OK)
+	{
+		current_offset_ref = cal[SENSE_CURRENT].offset;
+	}
+
+	return status;
+}
+
+void batt_resetCalibration(void)
+{
+	for (uint32_t i = 0; i < SENSE_COUNT; i++)
+	{
+		cal[i] = cal_default[i];
+	}
+}
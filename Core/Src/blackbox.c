@@ -0,0 +1,328 @@
+#include "blackbox.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "eeprom.h"
+
+#define BLACKBOX_DT_UNIT_MS 2
+#define BLACKBOX_DT_MAX 15
+
+typedef enum
+{
+	BLACKBOX_ARMED,
+	BLACKBOX_POST_TRIGGER,
+	BLACKBOX_COMMIT,
+	BLACKBOX_DUMP,
+} blackbox_state_E;
+
+// eeprom copy of a capture, currents share one shift and cell values are only
+// refreshed every update so the trigger and last sample stand in for the rest
+typedef struct
+{
+	uint32_t tick;
+	uint8_t fault;
+	uint8_t count;
+	uint8_t trigger;
+	uint8_t shift;
+	uint16_t v_min[2]; // trigger, last
+	uint16_t v_max[2];
+	uint16_t pack_voltage[2];
+	int8_t t_max;
+	uint8_t fet[2];
+	uint8_t reserved;
+	uint8_t dt[BLACKBOX_LEN / 2]; // sample spacing in 2 ms steps, two per byte
+	int8_t current[BLACKBOX_LEN];
+} blackbox_snapshot_S;
+
+_Static_assert(sizeof(blackbox_snapshot_S) == EEPROM_SIZE_BLACKBOX, "blackbox record does not match the eeprom map");
+
+static blackbox_sample_S ring[BLACKBOX_LEN];
+static uint8_t ring_head;
+static uint8_t ring_count;
+static uint8_t post_count;
+static blackbox_state_E state;
+static blackbox_header_S header;
+static uint16_t dump_pos;
+static uint8_t dump_seq;
+static uint8_t dump_tx[BLACKBOX_CHUNK_HEADER + BLACKBOX_CHUNK_SIZE];
+
+// index 0 is the oldest sample
+static blackbox_sample_S *blackbox_at(uint32_t index)
+{
+	return &ring[(ring_head + BLACKBOX_LEN - ring_count + index) % BLACKBOX_LEN];
+}
+
+static void blackbox_arm(void)
+{
+	ring_head = 0;
+	ring_count = 0;
+	post_count = 0;
+	state = BLACKBOX_ARMED;
+}
+
+static void blackbox_freeze(void)
+{
+	if (ring_count == 0)
+	{
+		blackbox_arm();
+		return;
+	}
+
+	header.count = ring_count;
+	header.trigger = (ring_count > post_count) ? (ring_count - 1 - post_count) : 0;
+	header.stored = 0;
+
+	state = BLACKBOX_COMMIT;
+}
+
+static void blackbox_pack(blackbox_snapshot_S *snap)
+{
+	const blackbox_sample_S *at_trigger = blackbox_at(header.trigger);
+	const blackbox_sample_S *last = blackbox_at(header.count - 1);
+	int32_t peak = 0;
+
+	memset(snap, 0, sizeof(*snap));
+
+	snap->tick = header.tick;
+	snap->fault = header.fault;
+	snap->count = header.count;
+	snap->trigger = header.trigger;
+	snap->v_min[0] = at_trigger->v_min;
+	snap->v_min[1] = last->v_min;
+	snap->v_max[0] = at_trigger->v_max;
+	snap->v_max[1] = last->v_max;
+	snap->pack_voltage[0] = at_trigger->pack_voltage;
+	snap->pack_voltage[1] = last->pack_voltage;
+	snap->fet[0] = at_trigger->fet;
+	snap->fet[1] = last->fet;
+	snap->t_max = INT8_MIN;
+
+	for (uint32_t i = 0; i < header.count; i++)
+	{
+		const blackbox_sample_S *sample = blackbox_at(i);
+
+		peak = (abs(sample->current) > peak) ? abs(sample->current) : peak;
+		snap->t_max = (sample->t_max > snap->t_max) ? sample->t_max : snap->t_max;
+	}
+
+	while ((peak >> snap->shift) > INT8_MAX)
+	{
+		snap->shift++;
+	}
+
+	for (uint32_t i = 0; i < header.count; i++)
+	{
+		const blackbox_sample_S *sample = blackbox_at(i);
+
+		snap->current[i] = sample->current >> snap->shift;
+
+		if (i > 0)
+		{
+			uint16_t dt = (uint16_t)(sample->tick - blackbox_at(i - 1)->tick) / BLACKBOX_DT_UNIT_MS;
+
+			snap->dt[i / 2] |= ((dt > BLACKBOX_DT_MAX) ? BLACKBOX_DT_MAX : dt) << ((i & 1) * 4);
+		}
+	}
+}
+
+static void blackbox_unpack(const blackbox_snapshot_S *snap)
+{
+	uint16_t offset = 0;
+	uint16_t trigger_offset = 0;
+
+	header.tick = snap->tick;
+	header.fault = snap->fault;
+	header.count = snap->count;
+	header.trigger = snap->trigger;
+	header.stored = 1;
+
+	for (uint32_t i = 0; i < snap->count; i++)
+	{
+		offset += ((snap->dt[i / 2] >> ((i & 1) * 4)) & BLACKBOX_DT_MAX) * BLACKBOX_DT_UNIT_MS;
+
+		ring[i].tick = offset;
+		ring[i].current = snap->current[i] * (1 << snap->shift);
+
+		uint8_t after = i > snap->trigger;
+
+		ring[i].v_min = snap->v_min[after];
+		ring[i].v_max = snap->v_max[after];
+		ring[i].pack_voltage = snap->pack_voltage[after];
+		ring[i].fet = snap->fet[after];
+		ring[i].t_max = snap->t_max;
+
+		if (i == snap->trigger)
+		{
+			trigger_offset = offset;
+		}
+	}
+
+	// ticks were stored relative, line them up on the trigger
+	for (uint32_t i = 0; i < snap->count; i++)
+	{
+		ring[i].tick += (uint16_t)snap->tick - trigger_offset;
+	}
+
+	ring_count = snap->count;
+	ring_head = snap->count % BLACKBOX_LEN;
+}
+
+static uint8_t blackbox_streamByte(uint16_t pos)
+{
+	if (pos < sizeof(header))
+	{
+		return ((const uint8_t *)&header)[pos];
+	}
+
+	pos -= sizeof(header);
+
+	return ((const uint8_t *)blackbox_at(pos / sizeof(blackbox_sample_S)))[pos % sizeof(blackbox_sample_S)];
+}
+
+void blackbox_init(void)
+{
+	blackbox_snapshot_S snap;
+
+	blackbox_arm();
+	dump_seq = 0;
+
+	// the last capture survives resets, send it once per boot before arming again
+	if (eeprom_readRecord(EEPROM_ADDR_BLACKBOX, &snap, sizeof(snap)) != HAL_OK)
+	{
+		return;
+	}
+
+	if ((snap.count == 0) || (snap.count > BLACKBOX_LEN) || (snap.trigger >= snap.count))
+	{
+		return;
+	}
+
+	blackbox_unpack(&snap);
+
+	dump_pos = 0;
+	state = BLACKBOX_DUMP;
+}
+
+void blackbox_record(const blackbox_sample_S *sample)
+{
+	if ((state != BLACKBOX_ARMED) && (state != BLACKBOX_POST_TRIGGER))
+	{
+		return;
+	}
+
+	ring[ring_head] = *sample;
+	ring_head = (ring_head + 1) % BLACKBOX_LEN;
+
+	if (ring_count < BLACKBOX_LEN)
+	{
+		ring_count++;
+	}
+
+	if ((state == BLACKBOX_POST_TRIGGER) && (++post_count >= BLACKBOX_POST))
+	{
+		blackbox_freeze();
+	}
+}
+
+// the first fault of a cascade owns the capture
+void blackbox_trigger(batt_fault_E fault)
+{
+	if (state != BLACKBOX_ARMED)
+	{
+		return;
+	}
+
+	header.tick = HAL_GetTick();
+	header.fault = fault;
+	post_count = 0;
+
+	state = BLACKBOX_POST_TRIGGER;
+}
+
+void blackbox_update(void)
+{
+	if ((state == BLACKBOX_POST_TRIGGER) && ((HAL_GetTick() - header.tick) >= BLACKBOX_POST_TIMEOUT_MS))
+	{
+		blackbox_freeze();
+	}
+
+	if (state != BLACKBOX_COMMIT)
+	{
+		return;
+	}
+
+	blackbox_snapshot_S snap;
+
+	blackbox_pack(&snap);
+
+	// blocks for up to ~3 ms per changed word, once per fault
+	(void)eeprom_writeRecord(EEPROM_ADDR_BLACKBOX, &snap, sizeof(snap));
+
+	dump_pos = 0;
+	state = BLACKBOX_DUMP;
+}
+
+uint8_t blackbox_isDumping(void)
+{
+	return state == BLACKBOX_DUMP;
+}
+
+HAL_StatusTypeDef blackbox_drain(UART_HandleTypeDef *huart)
+{
+	uint16_t total = sizeof(header) + (header.count * sizeof(blackbox_sample_S));
+
+	if ((state != BLACKBOX_DUMP) || (huart->gState != HAL_UART_STATE_READY))
+	{
+		return HAL_OK;
+	}
+
+	uint16_t len = total - dump_pos;
+
+	if (len > BLACKBOX_CHUNK_SIZE)
+	{
+		len = BLACKBOX_CHUNK_SIZE;
+	}
+
+	dump_tx[0] = BLACKBOX_SYNC_0;
+	dump_tx[1] = BLACKBOX_SYNC_1;
+	dump_tx[2] = len;
+	dump_tx[3] = dump_seq++;
+
+	for (uint16_t i = 0; i < len; i++)
+	{
+		dump_tx[BLACKBOX_CHUNK_HEADER + i] = blackbox_streamByte(dump_pos++);
+	}
+
+	// the chunk is staged in its own buffer, recording can resume
+	if (dump_pos >= total)
+	{
+		blackbox_arm();
+	}
+
+	return HAL_UART_Transmit_IT(huart, dump_tx, BLACKBOX_CHUNK_HEADER + len);
+}
+
+HAL_StatusTypeDef blackbox_getHeader(blackbox_header_S *out)
+{
+	if ((state != BLACKBOX_COMMIT) && (state != BLACKBOX_DUMP))
+	{
+		return HAL_ERROR;
+	}
+
+	*out = header;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef blackbox_getSample(uint32_t index, blackbox_sample_S *sample)
+{
+	if (((state != BLACKBOX_COMMIT) && (state != BLACKBOX_DUMP)) || (index >= header.count))
+	{
+		return HAL_ERROR;
+	}
+
+	*sample = *blackbox_at(index);
+
+	return HAL_OK;
+}
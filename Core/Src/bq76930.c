@@ -1,10 +1,13 @@
 #include "bq76930.h"
+#include "i2c_trace.h"
 #include <string.h>
 #include <stdio.h>
 
 #define BQ76930_SET_BIT(bits, bit, value) ((bits & ~(1 << bit)) | (value << bit))
 #define BQ76930_GET_BIT(bits, bit) (bits & (1 << bit))
 
+#define BQ76930_READ_MAX 2 // longest block the driver reads, one 14-bit adc word
+
 static const uint8_t crc8_table[256] = {
 	0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
 	0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65, 0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
@@ -24,7 +27,7 @@ static const uint8_t crc8_table[256] = {
 	0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB, 0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3,
 };
 
-#define THERMISTOR_TABLE_LEN 17
+#define THERMISTOR_TABLE_LEN 15
 
 static const uint16_t thermistor_resistance_table[THERMISTOR_TABLE_LEN] = {
 	35820,
@@ -95,8 +98,9 @@ static uint8_t BQ76930_adc2Temp(BQ76930_inst_S *inst, uint16_t adc)
 	uint32_t mv = BQ76930_adc2Volt(inst, adc);
 	uint32_t r = (10000 * mv) / (3300 - mv);
 
+	// stop one short of the end, past 70 C the last segment is extrapolated
 	uint32_t i = 1;
-	while (i < THERMISTOR_TABLE_LEN)
+	while (i < (THERMISTOR_TABLE_LEN - 2))
 	{
 		if (r > thermistor_resistance_table[i])
 		{
@@ -111,7 +115,10 @@ static uint8_t BQ76930_adc2Temp(BQ76930_inst_S *inst, uint16_t adc)
 	int32_t t1 = 1000000 * thermistor_temperature_table[i];
 	int32_t t2 = 1000000 * thermistor_temperature_table[i + 1];
 
-	return (interpolate(r, r1, r2, t1, t2) / 1000000);
+	int64_t temp = interpolate(r, r1, r2, t1, t2) / 1000000;
+
+	// below the table the extrapolation goes negative, and a uint8 would wrap it into the hottest reading
+	return (temp < 0) ? 0 : ((temp > UINT8_MAX) ? UINT8_MAX : temp);
 }
 
 //static uint8_t BQ76930_adc2TempInternal(BQ76930_inst_S *inst, uint16_t adc)
@@ -130,7 +137,7 @@ static HAL_StatusTypeDef BQ76930_writeReg(BQ76930_inst_S *inst, uint8_t addr, ui
 	data[2] = *byte;
 	data[3] = crc8(&data[0], 3);
 
-	return HAL_I2C_Mem_Write(inst->hi2c, BQ76930_I2C_ADDR << 1, addr, 1, &data[2], 2, inst->timeout_ms);
+	return i2c_trace_memWrite(inst->hi2c, BQ76930_I2C_ADDR << 1, addr, 1, &data[2], 2, inst->timeout_ms);
 }
 
 static HAL_StatusTypeDef BQ76930_readReg(BQ76930_inst_S *inst, uint8_t addr, uint8_t *byte)
@@ -139,7 +146,7 @@ static HAL_StatusTypeDef BQ76930_readReg(BQ76930_inst_S *inst, uint8_t addr, uin
 
 	data[0] = (BQ76930_I2C_ADDR << 1) | 0b1;
 
-	HAL_StatusTypeDef status = HAL_I2C_Mem_Read(inst->hi2c, BQ76930_I2C_ADDR << 1, addr, 1, &data[1], 2, inst->timeout_ms);
+	HAL_StatusTypeDef status = i2c_trace_memRead(inst->hi2c, BQ76930_I2C_ADDR << 1, addr, 1, &data[1], 2, inst->timeout_ms);
 
 	if (status != HAL_OK)
 	{
@@ -160,17 +167,24 @@ static HAL_StatusTypeDef BQ76930_readReg(BQ76930_inst_S *inst, uint8_t addr, uin
 
 static HAL_StatusTypeDef BQ76930_readRegMultiple(BQ76930_inst_S *inst, uint8_t addr, uint8_t *data, uint8_t len)
 {
-	uint8_t buf[258];
+	// address byte, then every data byte followed by its crc
+	uint8_t buf[1 + (2 * BQ76930_READ_MAX)];
+
+	if (len > BQ76930_READ_MAX)
+	{
+		return HAL_ERROR;
+	}
 
 	buf[0] = (BQ76930_I2C_ADDR << 1) | 0b1;
 
-	HAL_StatusTypeDef status = HAL_I2C_Mem_Read(inst->hi2c, BQ76930_I2C_ADDR << 1, addr, 1, &buf[1], 4, inst->timeout_ms);
+	HAL_StatusTypeDef status = i2c_trace_memRead(inst->hi2c, BQ76930_I2C_ADDR << 1, addr, 1, &buf[1], 2 * len, inst->timeout_ms);
 
 	if (status != HAL_OK)
 	{
 		return status;
 	}
 
+	// the first crc also covers the address byte
 	uint8_t expected_crc = crc8(&buf[0], 2);
 
 	if (expected_crc != buf[2])
@@ -178,15 +192,20 @@ static HAL_StatusTypeDef BQ76930_readRegMultiple(BQ76930_inst_S *inst, uint8_t a
 		status = HAL_ERROR;
 	}
 
-	expected_crc = crc8(&buf[3], 1);
-
-	if (expected_crc != buf[4])
+	for (uint32_t i = 1; i < len; i++)
 	{
-		status = HAL_ERROR;
+		expected_crc = crc8(&buf[1 + (2 * i)], 1);
+
+		if (expected_crc != buf[2 + (2 * i)])
+		{
+			status = HAL_ERROR;
+		}
 	}
 
-	data[1] = buf[3];
-	data[0] = buf[1];
+	for (uint32_t i = 0; i < len; i++)
+	{
+		data[i] = buf[1 + (2 * i)];
+	}
 
 	return status;
 }
@@ -283,23 +302,38 @@ HAL_StatusTypeDef BQ76930_init(BQ76930_inst_S *inst, I2C_HandleTypeDef *hi2c, BQ
 	return BQ76930_clearFaults(inst);
 }
 
+// sys_stat on its own, for when the alert pin says it changed between updates
+HAL_StatusTypeDef BQ76930_updateFaults(BQ76930_inst_S *inst)
+{
+	uint8_t buf;
+
+	HAL_StatusTypeDef status = BQ76930_readReg(inst, BQ76930_REG_SYS_STAT, &buf);
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	inst->faults = buf & 0xF;
+	inst->faults = BQ76930_SET_BIT(inst->faults, BQ76930_FAULT_INTERNAL, (buf >> BQ76930_REG_SYS_STAT_DEVICE_XREADY) & 1);
+
+	return HAL_OK;
+}
+
 HAL_StatusTypeDef BQ76930_update(BQ76930_inst_S *inst)
 {
 	HAL_StatusTypeDef status = HAL_OK;
 
-	uint8_t buf[256];
+	uint8_t buf[2];
 
 	// read faults
-	status = BQ76930_readReg(inst, BQ76930_REG_SYS_STAT, buf);
+	status = BQ76930_updateFaults(inst);
 
 	if (status != HAL_OK)
 	{
 		return status;
 	}
 
-	inst->faults = buf[0] & 0xF;
-	inst->faults = BQ76930_SET_BIT(inst->faults, BQ76930_FAULT_INTERNAL, (buf[0] >> BQ76930_REG_SYS_STAT_DEVICE_XREADY) & 1);
-
 	// read volt data
 	for (uint32_t i = 0; i < BQ76930_CELL_COUNT; i++)
 	{
@@ -365,17 +399,24 @@ HAL_StatusTypeDef BQ76930_update(BQ76930_inst_S *inst)
 	}
 
 	// set mosfet state
-	status = BQ76930_readReg(inst, BQ76930_REG_SYS_CTRL2, buf);
+	return BQ76930_updateFets(inst);
+}
+
+HAL_StatusTypeDef BQ76930_updateFets(BQ76930_inst_S *inst)
+{
+	uint8_t buf;
+
+	HAL_StatusTypeDef status = BQ76930_readReg(inst, BQ76930_REG_SYS_CTRL2, &buf);
 
 	if (status != HAL_OK)
 	{
 		return status;
 	}
 
-	buf[0] = BQ76930_SET_BIT(buf[0], BQ76930_REG_SYS_CTRL2_CHG_ON, inst->chg);
-	buf[0] = BQ76930_SET_BIT(buf[0], BQ76930_REG_SYS_CTRL2_DSG_ON, inst->dsg);
+	buf = BQ76930_SET_BIT(buf, BQ76930_REG_SYS_CTRL2_CHG_ON, inst->chg);
+	buf = BQ76930_SET_BIT(buf, BQ76930_REG_SYS_CTRL2_DSG_ON, inst->dsg);
 
-	return BQ76930_writeReg(inst, BQ76930_REG_SYS_CTRL2, buf);
+	return BQ76930_writeReg(inst, BQ76930_REG_SYS_CTRL2, &buf);
 }
 
 uint16_t BQ76930_getVoltage(BQ76930_inst_S *inst, BQ76930_cell_E cell)
@@ -3,14 +3,28 @@
 #include "stm32l0xx_hal.h"
 
 #include "battery.h"
+#include "blackbox.h"
+#include "datalog.h"
 #include "display.h"
+#include "energy.h"
+#include "i2c_trace.h"
+#include "ocv.h"
+#include "precharge.h"
+#include "profile.h"
+#include "resistance.h"
+#include "soh.h"
+#include "sop.h"
+#include "stack_mon.h"
+#include "thermal.h"
+#include "usage.h"
+#include "watchdog.h"
 
 #include <stdio.h>
 
-#define PRECHARGE_THRESHOLD_MV 8000
-#define PRECHARGE_TIMEOUT_MS 5000
-#define IDLE_TIMEOUT_MS 30000
+#define OFF_READY_TIMEOUT_MS 1000 // give up on a clean afe read, precharge reports the fault
 #define IDLE_CURRENT_HYST_MA 100
+#define ACTIVE_ENTER_MS 100 // two loops, idle re-reads capacity from the cells so keep it short
+#define ACTIVE_EXIT_MS 1000 // ride through short stops without flapping
 
 #define CHARGE_LIMIT_MV 4200
 #define DISCHARGE_LIMIT_MV 3000
@@ -23,94 +37,86 @@
 #define BALANCE_GROUP_TIME_MS 5000
 
 #define LOOP_PERIOD_MS 100
+#define TRACE_DRAIN_GUARD_MS 10 // keep the uart free for the telemetry frame
+#define CMD_GAP_MS 50 // a pause this long starts a new command
 
-#define SOC_TABLE_SIZE 12
+#define UART_BYTE_US 87 // 10 bits at 115200
+#define UART_WIRE_MS(bytes) ((((bytes) * UART_BYTE_US) + 999) / 1000)
 
-extern UART_HandleTypeDef hlpuart1;
+// a chunk started at the edge of the slack window has to be off the wire before the next frame
+_Static_assert(UART_WIRE_MS(BLACKBOX_CHUNK_HEADER + BLACKBOX_CHUNK_SIZE) < TRACE_DRAIN_GUARD_MS, "blackbox chunk outlasts the drain guard");
+_Static_assert(UART_WIRE_MS(DATALOG_CHUNK_HEADER + DATALOG_CHUNK_SIZE) < TRACE_DRAIN_GUARD_MS, "datalog chunk outlasts the drain guard");
+_Static_assert(UART_WIRE_MS(I2C_TRACE_CHUNK_HEADER + I2C_TRACE_CHUNK_SIZE) < TRACE_DRAIN_GUARD_MS, "i2c trace chunk outlasts the drain guard");
+
+typedef uint8_t (*controller_guard_F)(void);
+typedef void (*controller_action_F)(void);
+
+typedef struct
+{
+	controller_state_E from;
+	controller_guard_F guard;
+	controller_state_E to;
+	controller_cause_E cause;
+	uint16_t hold_ms;
+} controller_transition_S;
 
 typedef struct
 {
-	uint32_t code;
-	uint32_t capacity;
-	uint16_t soc;
-	int16_t state;
-	uint16_t volt[CELL_COUNT];
-	uint16_t temp[TEMP_COUNT];
-	uint16_t fet;
-	uint16_t pack_voltage;
-	int16_t pack_current;
-	uint16_t faults;
-	uint16_t loop_time;
-} controller_data_S;
+	controller_action_F entry;
+	controller_action_F exit;
+} controller_stateActions_S;
+
+extern UART_HandleTypeDef hlpuart1;
 
 static controller_data_S controller_data;
 
 static controller_state_E controller_state;
-static uint32_t precharge_start_time;
-static uint32_t idle_start_time;
+static uint8_t loop_request;
+static controller_logEntry_S transition_log[CONTROLLER_LOG_LEN];
+static uint32_t transition_count;
 static uint32_t off_start_time;
+static uint32_t wake_time;
+static uint16_t wake_dsg_ms;
 static uint32_t last_balance_group_change;
 static uint32_t active_balance_group;
 static uint32_t last_controller_run;
 static uint32_t capacity_remaining;
 static uint8_t display_soc;
-
-static uint32_t soc_table_voltage[SOC_TABLE_SIZE] =
-{
-	2500,
-	3000,
-	3300,
-	3500,
-	3600,
-	3700,
-	3800,
-	3900,
-	4000,
-	4050,
-	4100,
-	4200,
-};
-
-static uint32_t soc_table_capacity[SOC_TABLE_SIZE] =
-{
-	3000 - 3000,
-	3000 - 2880,
-	3000 - 2560,
-	3000 - 2240,
-	3000 - 1920,
-	3000 - 1600,
-	3000 - 1280,
-	3000 - 960,
-	3000 - 640,
-	3000 - 320,
-	3000 - 150,
-	3000 - 0,
-};
+static uint32_t usable_min_nominal; // the soc limits, read once at OCV_TEMP_REF
+static uint32_t usable_max_nominal;
+static uint8_t rx_byte;
+static uint8_t rx_frame[CONTROLLER_CMD_LEN_MAX];
+static uint8_t rx_len;
+static uint32_t rx_tick;
+static volatile uint8_t rx_ready;
+static uint8_t cal_status;
 
 static int64_t interpolate(int64_t x, int64_t x1, int64_t x2, int64_t y1, int64_t y2)
 {
 	return (((y2 - y1) * (x - x1)) / (x2 - x1)) + y1;
 }
 
-static uint32_t voltage2capacity(uint16_t v)
+// mAs of a new pack at this open circuit voltage and cell temperature
+static uint32_t voltage2nominal(uint16_t v, uint8_t temp)
 {
-	uint32_t i = 1;
-	while (i < SOC_TABLE_SIZE)
-	{
-		if (v < soc_table_voltage[i])
-		{
-			break;
-		}
-		i++;
-	}
+	return ((uint64_t)ocv_getSoc(v, temp) * SOH_NOMINAL_MAH * 3600) / OCV_SOC_FULL;
+}
 
-	return interpolate(v, soc_table_voltage[i - 1], soc_table_voltage[i], 4 * 3600 * soc_table_capacity[i - 1], 4 * 3600 * soc_table_capacity[i]);
+// the table shrinks with the learned capacity so soc still spans the cells that are left
+static uint32_t nominal2capacity(uint32_t nominal)
+{
+	return ((uint64_t)nominal * soh_getCapacity()) / SOH_NOMINAL_MAH;
+}
+
+static uint32_t voltage2capacity(uint16_t v)
+{
+	return nominal2capacity(voltage2nominal(v, batt_getTemp(TEMP_AVG)));
 }
 
 static uint8_t capacity2soc(uint32_t capacity)
 {
-	uint32_t max_usable_capacity = voltage2capacity(CHARGE_LIMIT_MV);
-	uint32_t min_usable_capacity = voltage2capacity(DISCHARGE_LIMIT_MV);
+	uint32_t max_usable_capacity = nominal2capacity(usable_max_nominal);
+	uint32_t min_usable_capacity = nominal2capacity(usable_min_nominal);
 
 	int32_t soc = interpolate(capacity, min_usable_capacity, max_usable_capacity, 0, 100);
 
@@ -127,6 +133,14 @@ static uint8_t capacity2soc(uint32_t capacity)
 	return soc;
 }
 
+static void controller_updateEnergy(void)
+{
+	uint32_t empty = nominal2capacity(usable_min_nominal);
+	uint32_t full = nominal2capacity(usable_max_nominal);
+
+	energy_update((capacity_remaining > empty) ? (capacity_remaining - empty) : 0, (full > capacity_remaining) ? (full - capacity_remaining) : 0);
+}
+
 const char *state2str(controller_state_E state)
 {
 	switch (state)
@@ -143,7 +157,7 @@ const char *state2str(controller_state_E state)
 	}
 }
 
-static uint32_t controller_updateCapacityRemaining(controller_state_E state, uint32_t cap)
+static uint32_t controller_updateCapacityRemaining(controller_state_E state, uint32_t cap, int32_t charge)
 {
 	switch (state)
 	{
@@ -155,7 +169,7 @@ static uint32_t controller_updateCapacityRemaining(controller_state_E state, uin
 	case STATE_PRECHARGE:
 	case STATE_DISCHARGE:
 	case STATE_CHARGE:
-		return cap + ((-1 * batt_getPackCurrent() * LOOP_PERIOD_MS) / 1000);
+		return cap - charge;
 
 	case STATE_FAULT:
 	case STATE_SHUTDOWN:
@@ -164,157 +178,185 @@ static uint32_t controller_updateCapacityRemaining(controller_state_E state, uin
 	}
 }
 
-static controller_state_E controller_getNextState(controller_state_E state)
+static uint8_t controller_guardFault(void)
 {
-	switch (state)
-	{
-	case STATE_OFF:
-		if ((HAL_GetTick() - off_start_time) >= 1000)
-		{
-			return STATE_PRECHARGE;
-		}
-		else
-		{
-			return STATE_OFF;
-		}
+	return batt_getFaultMask() != 0;
+}
 
-	case STATE_PRECHARGE:
-		if (batt_getFaultMask())
-		{
-			return STATE_FAULT;
-		}
-		else if ((batt_getCellVoltage(CELL_SUM) - batt_getPackVoltage()) < PRECHARGE_THRESHOLD_MV)
-		{
-			return STATE_IDLE;
-		}
-		else if ((HAL_GetTick() - precharge_start_time) >= PRECHARGE_TIMEOUT_MS)
-		{
-			return STATE_IDLE; // TODO
-		}
-		else
-		{
-			return STATE_PRECHARGE;
-		}
+static uint8_t controller_guardFaultCleared(void)
+{
+	return batt_getFaultMask() == 0;
+}
 
-	case STATE_IDLE:
-		if (batt_getFaultMask())
-		{
-			return STATE_FAULT;
-		}
-		else if (display_getButtonLongPress())
-		{
-			return STATE_SHUTDOWN;
-		}
-		else if (batt_getPackCurrent() > IDLE_CURRENT_HYST_MA)
-		{
-			return STATE_DISCHARGE;
-		}
-		else if (batt_getPackCurrent() < -IDLE_CURRENT_HYST_MA)
-		{
-			return STATE_CHARGE;
-		}
-//		else if ((HAL_GetTick() - idle_start_time) >= IDLE_TIMEOUT_MS)
-//		{
-//			return STATE_SHUTDOWN;
-//		}
-		else
-		{
-			return STATE_IDLE;
-		}
+static uint8_t controller_guardAfeReady(void)
+{
+	return batt_isReady();
+}
 
-	case STATE_DISCHARGE:
-		if (batt_getFaultMask())
-		{
-			return STATE_FAULT;
-		}
-		else if (batt_getPackCurrent() < IDLE_CURRENT_HYST_MA)
-		{
-			return STATE_IDLE;
-		}
-		else
-		{
-			return STATE_DISCHARGE;
-		}
+static uint8_t controller_guardAfeTimeout(void)
+{
+	return (HAL_GetTick() - off_start_time) >= OFF_READY_TIMEOUT_MS;
+}
 
-	case STATE_CHARGE:
-		if (batt_getFaultMask())
-		{
-			return STATE_FAULT;
-		}
-		else if (batt_getCellVoltage(CELL_MAX) >= CHARGE_LIMIT_MV)
-		{
-			if ((batt_getCellVoltage(CELL_MAX) - batt_getCellVoltage(CELL_MIN)) > BALANCE_HYST_MV)
-			{
-				return STATE_BALANCE;
-			}
-			else
-			{
-				return STATE_SHUTDOWN;
-			}
-		}
-		else if (batt_getPackCurrent() > -IDLE_CURRENT_HYST_MA)
-		{
-			return STATE_IDLE;
-		}
-		else
-		{
-			return STATE_CHARGE;
-		}
+static uint8_t controller_guardPrechargeDone(void)
+{
+	return precharge_update() == PRECHARGE_DONE;
+}
 
-	case STATE_BALANCE:
-		if (batt_getFaultMask())
-		{
-			return STATE_FAULT;
-		}
-		else if ((batt_getCellVoltage(CELL_MAX) - batt_getCellVoltage(CELL_MIN)) < BALANCE_COMPLETE_HYST_MV)
+static uint8_t controller_guardLongPress(void)
+{
+	return display_getButtonLongPress();
+}
+
+static uint8_t controller_guardDischarging(void)
+{
+	return batt_getPackCurrent() > IDLE_CURRENT_HYST_MA;
+}
+
+static uint8_t controller_guardNotDischarging(void)
+{
+	return batt_getPackCurrent() < IDLE_CURRENT_HYST_MA;
+}
+
+static uint8_t controller_guardCharging(void)
+{
+	return batt_getPackCurrent() < -IDLE_CURRENT_HYST_MA;
+}
+
+static uint8_t controller_guardNotCharging(void)
+{
+	return batt_getPackCurrent() > -IDLE_CURRENT_HYST_MA;
+}
+
+static uint8_t controller_guardChargeLimitUnbalanced(void)
+{
+	return (batt_getCellVoltage(CELL_MAX) >= CHARGE_LIMIT_MV) && ((batt_getCellVoltage(CELL_MAX) - batt_getCellVoltage(CELL_MIN)) > BALANCE_HYST_MV);
+}
+
+static uint8_t controller_guardChargeLimit(void)
+{
+	return batt_getCellVoltage(CELL_MAX) >= CHARGE_LIMIT_MV;
+}
+
+static uint8_t controller_guardBalanced(void)
+{
+	return (batt_getCellVoltage(CELL_MAX) - batt_getCellVoltage(CELL_MIN)) < BALANCE_COMPLETE_HYST_MV;
+}
+
+static void controller_enterOff(void)
+{
+	batt_init();
+	off_start_time = HAL_GetTick();
+}
+
+static void controller_enterPrecharge(void)
+{
+	precharge_start();
+}
+
+// rows of a state are tried in order, the first guard held for hold_ms wins
+static const controller_transition_S transition_table[] =
+{
+	{ STATE_OFF, controller_guardAfeReady, STATE_PRECHARGE, CAUSE_AFE_READY, 0 },
+	{ STATE_OFF, controller_guardAfeTimeout, STATE_PRECHARGE, CAUSE_AFE_TIMEOUT, 0 },
+
+	{ STATE_PRECHARGE, controller_guardFault, STATE_FAULT, CAUSE_FAULT, 0 },
+	{ STATE_PRECHARGE, controller_guardPrechargeDone, STATE_IDLE, CAUSE_PRECHARGE_DONE, 0 },
+
+	{ STATE_IDLE, controller_guardFault, STATE_FAULT, CAUSE_FAULT, 0 },
+	{ STATE_IDLE, controller_guardLongPress, STATE_SHUTDOWN, CAUSE_BUTTON, 0 },
+	{ STATE_IDLE, controller_guardDischarging, STATE_DISCHARGE, CAUSE_CURRENT, ACTIVE_ENTER_MS },
+	{ STATE_IDLE, controller_guardCharging, STATE_CHARGE, CAUSE_CURRENT, ACTIVE_ENTER_MS },
+
+	{ STATE_DISCHARGE, controller_guardFault, STATE_FAULT, CAUSE_FAULT, 0 },
+	{ STATE_DISCHARGE, controller_guardNotDischarging, STATE_IDLE, CAUSE_CURRENT, ACTIVE_EXIT_MS },
+
+	{ STATE_CHARGE, controller_guardFault, STATE_FAULT, CAUSE_FAULT, 0 },
+	{ STATE_CHARGE, controller_guardChargeLimitUnbalanced, STATE_BALANCE, CAUSE_CHARGE_LIMIT, 0 },
+	{ STATE_CHARGE, controller_guardChargeLimit, STATE_SHUTDOWN, CAUSE_CHARGE_LIMIT, 0 },
+	{ STATE_CHARGE, controller_guardNotCharging, STATE_IDLE, CAUSE_CURRENT, ACTIVE_EXIT_MS },
+
+	{ STATE_BALANCE, controller_guardFault, STATE_FAULT, CAUSE_FAULT, 0 },
+	{ STATE_BALANCE, controller_guardBalanced, STATE_SHUTDOWN, CAUSE_BALANCED, 0 },
+
+	{ STATE_FAULT, controller_guardLongPress, STATE_OFF, CAUSE_BUTTON, 0 },
+	{ STATE_FAULT, controller_guardFaultCleared, STATE_OFF, CAUSE_RECOVERED, 0 }, // only non-latching faults ever clear
+};
+
+#define TRANSITION_COUNT (sizeof(transition_table) / sizeof(transition_table[0]))
+
+static uint32_t guard_held; // one bit per row, the table stays under 32 rows
+static uint32_t guard_since[TRANSITION_COUNT];
+
+static const controller_stateActions_S state_actions[] =
+{
+	[STATE_OFF] = { controller_enterOff, NULL },
+	[STATE_PRECHARGE] = { controller_enterPrecharge, NULL },
+	[STATE_IDLE] = { NULL, NULL },
+	[STATE_DISCHARGE] = { NULL, NULL },
+	[STATE_CHARGE] = { NULL, NULL },
+	[STATE_BALANCE] = { NULL, NULL },
+	[STATE_FAULT] = { NULL, NULL },
+	[STATE_SHUTDOWN] = { NULL, NULL },
+};
+
+static const controller_transition_S *controller_getTransition(controller_state_E state)
+{
+	uint32_t now = HAL_GetTick();
+
+	for (uint32_t i = 0; i < TRANSITION_COUNT; i++)
+	{
+		const controller_transition_S *transition = &transition_table[i];
+
+		if (transition->from != state)
 		{
-			return STATE_SHUTDOWN;
+			continue;
 		}
-		else
+
+		if (!transition->guard())
 		{
-			return STATE_BALANCE;
+			guard_held &= ~(1UL << i);
+			continue;
 		}
 
-	case STATE_FAULT:
-		if (display_getButtonLongPress())
+		if (!(guard_held & (1UL << i)))
 		{
-			return STATE_OFF;
+			guard_held |= (1UL << i);
+			guard_since[i] = now;
 		}
-		else
+
+		if ((now - guard_since[i]) >= transition->hold_ms)
 		{
-			return STATE_FAULT;
+			return transition;
 		}
-
-	case STATE_SHUTDOWN:
-	default:
-		return STATE_SHUTDOWN;
 	}
+
+	return NULL;
 }
 
-static void controller_entryAction(controller_state_E state)
+static void controller_transition(const controller_transition_S *transition)
 {
-	switch (state)
+	if (state_actions[transition->from].exit != NULL)
 	{
-	case STATE_OFF:
-		batt_init();
-		off_start_time = HAL_GetTick();
-		break;
+		state_actions[transition->from].exit();
+	}
 
-	case STATE_PRECHARGE:
-		precharge_start_time = HAL_GetTick();
-		break;
+	controller_logEntry_S *entry = &transition_log[transition_count % CONTROLLER_LOG_LEN];
 
-	case STATE_IDLE:
-		idle_start_time = HAL_GetTick();
-		break;
+	entry->tick = HAL_GetTick();
+	entry->from = transition->from;
+	entry->to = transition->to;
+	entry->cause = transition->cause;
+	entry->faults = batt_getFaultMask();
 
-	case STATE_DISCHARGE:
-	case STATE_CHARGE:
-	case STATE_BALANCE:
-	case STATE_FAULT:
-	case STATE_SHUTDOWN:
-	default:
-		break;
+	transition_count++;
+
+	controller_state = transition->to;
+	guard_held = 0;
+
+	if (state_actions[transition->to].entry != NULL)
+	{
+		state_actions[transition->to].entry();
 	}
 }
 
@@ -380,9 +422,65 @@ static void controller_setBalanceState(controller_state_E state)
 	}
 }
 
+static uint8_t controller_commandLength(uint8_t command)
+{
+	switch (command)
+	{
+	case CONTROLLER_CMD_CAL_OFFSET:
+		return 2;
+
+	case CONTROLLER_CMD_CAL_GAIN:
+		return 6;
+
+	default:
+		return 1;
+	}
+}
+
+static void controller_serviceCommand(void)
+{
+	if (!rx_ready)
+	{
+		return;
+	}
+
+	uint8_t sense = rx_frame[1];
+	int32_t reference = (int32_t)(rx_frame[2] | (rx_frame[3] << 8) | (rx_frame[4] << 16) | ((uint32_t)rx_frame[5] << 24));
+
+	switch (rx_frame[0])
+	{
+	case DATALOG_CMD_DUMP:
+		datalog_requestDump();
+		break;
+
+	case CONTROLLER_CMD_CAL_OFFSET:
+	case CONTROLLER_CMD_CAL_GAIN:
+		if (sense >= SENSE_COUNT)
+		{
+			cal_status = HAL_ERROR;
+			break;
+		}
+
+		cal_status = (rx_frame[0] == CONTROLLER_CMD_CAL_OFFSET) ? batt_calibrateOffset(sense) : batt_calibrateGain(sense, reference);
+
+		// the capture holds the loop for ~250 ms, well past the sampling deadline
+		watchdog_restartDeadlines();
+		break;
+
+	case CONTROLLER_CMD_CAL_SAVE:
+		cal_status = batt_saveCalibration();
+		break;
+
+	default:
+		break;
+	}
+
+	rx_ready = 0;
+}
+
 static void controller_packData(void)
 {
-	controller_data.code = 0xDEADBEEF;
+	controller_data.code = CONTROLLER_DATA_CODE;
 	controller_data.capacity = capacity_remaining;
 	controller_data.soc = display_soc;
 	controller_data.state = controller_state;
@@ -406,47 +504,168 @@ static void controller_packData(void)
 	controller_data.pack_current = batt_getPackCurrent();
 	controller_data.faults = batt_getFaultMask();
 	controller_data.loop_time = HAL_GetTick() - last_controller_run;
+	controller_data.charger_voltage = batt_getChargerVoltage();
+	controller_data.iq_ua = batt_getQuiescentCurrent();
+	controller_data.wake_dsg_ms = wake_dsg_ms;
+	controller_data.transitions = transition_count;
+	controller_data.last_cause = transition_count ? transition_log[(transition_count - 1) % CONTROLLER_LOG_LEN].cause : CAUSE_NONE;
+	controller_data.cal_status = cal_status;
+	stack_mon_update();
+	controller_data.stack_used = stack_mon_getUsed();
+	controller_data.ram_free = stack_mon_getFree();
+	controller_data.reset_flags = watchdog_getResetFlags();
+	controller_data.reset_task = watchdog_getResetTask();
+	for (uint32_t i = 0; i < SOP_WINDOW_COUNT; i++)
+	{
+		controller_data.sop_dsg[i] = sop_getDischarge(i);
+		controller_data.sop_chg[i] = sop_getCharge(i);
+	}
+	for (uint32_t i = 0; i < ENERGY_WINDOW_COUNT; i++)
+	{
+		controller_data.power[i] = energy_getPower(i) / 1000;
+	}
+	controller_data.tte = energy_getTimeToEmpty();
+	controller_data.ttf = energy_getTimeToFull();
+	controller_data.energy_out = energy_getDischarged();
+	controller_data.energy_in = energy_getCharged();
+	controller_data.t_core = thermal_getCore();
+	controller_data.t_predicted = thermal_getPredicted();
+#if PROFILE_ENABLE
+	profile_export(&controller_data.profile);
+#endif
+}
+
+static void controller_enterStandby(void)
+{
+	watchdog_prepareStandby();
+
+	__HAL_PWR_CLEAR_FLAG(PWR_FLAG_SB);
+	__HAL_PWR_CLEAR_FLAG(PWR_FLAG_WU);
+	HAL_PWR_EnableWakeUpPin(PWR_WAKEUP_PIN1);
+	HAL_PWR_EnterSTANDBYMode();
 }
 
 void controller_init(void)
 {
+	wake_time = HAL_GetTick();
+	wake_dsg_ms = CONTROLLER_WAKE_PENDING;
+
+	watchdog_init();
+
+	// the iwdg woke us from standby, not the button
+	if (watchdog_isStandbyTimeout())
+	{
+		controller_enterStandby();
+	}
+
 	off_start_time = HAL_GetTick();
 	last_balance_group_change = HAL_GetTick();
 	active_balance_group = BALANCE_GROUP_A;
 	controller_state = STATE_OFF;
 
 	last_controller_run = 0;
-
+	loop_request = 0;
+	guard_held = 0;
+	transition_count = 0;
+
+	stack_mon_init();
+	i2c_trace_init();
+	blackbox_init();
+	datalog_init();
+	usage_init();
+	resistance_init();
+	soh_init();
+	energy_init();
+	thermal_init();
+	usable_min_nominal = voltage2nominal(DISCHARGE_LIMIT_MV, OCV_TEMP_REF);
+	usable_max_nominal = voltage2nominal(CHARGE_LIMIT_MV, OCV_TEMP_REF);
+	sop_init();
+#if PROFILE_ENABLE
+	profile_init();
+#endif
+	watchdog_start();
 	display_init();
 	batt_init();
+
+	rx_len = 0;
+	rx_ready = 0;
+	cal_status = CONTROLLER_CAL_NONE;
+	(void)HAL_UART_Receive_IT(&hlpuart1, &rx_byte, 1);
 }
 
 void controller_run(void)
 {
-	if ((HAL_GetTick() - last_controller_run) >= LOOP_PERIOD_MS)
+	batt_sample();
+
+	watchdog_checkIn(WATCHDOG_TASK_SAMPLE);
+
+	// follow the bus at the pack sample rate and act on the outcome without waiting for the loop
+	if (controller_state == STATE_PRECHARGE)
+	{
+		precharge_result_E precharge = precharge_update();
+
+		if (precharge == PRECHARGE_FAIL)
+		{
+			batt_latchFault(FAULT_PRECHARGE);
+		}
+
+		loop_request = (precharge != PRECHARGE_RUNNING);
+	}
+
+	if (((HAL_GetTick() - last_controller_run) >= LOOP_PERIOD_MS) || loop_request)
 	{
 		last_controller_run = HAL_GetTick();
+		loop_request = 0;
+
+		PROFILE_START(PROFILE_STAGE_LOOP);
 
 		batt_update();
+		blackbox_update();
+		resistance_update();
+		thermal_update();
+
+		watchdog_checkIn(WATCHDOG_TASK_UPDATE);
 
-		controller_state_E desired_state = controller_getNextState(controller_state);
+		PROFILE_START(PROFILE_STAGE_STATE);
 
-		if (controller_state != desired_state)
+		const controller_transition_S *transition = controller_getTransition(controller_state);
+
+		if (transition != NULL)
 		{
-			controller_state = desired_state;
-			controller_entryAction(controller_state);
+			controller_transition(transition);
 		}
 
-		capacity_remaining = controller_updateCapacityRemaining(controller_state, capacity_remaining);
+		int32_t charge = batt_takeCharge();
+
+		capacity_remaining = controller_updateCapacityRemaining(controller_state, capacity_remaining, charge);
+		soh_update(charge, voltage2nominal(batt_getCellVoltage(CELL_AVG), batt_getTemp(TEMP_AVG)));
 		display_soc = capacity2soc(capacity_remaining);
+		controller_updateEnergy();
 
 		controller_setFetState(controller_state);
+
+		if ((wake_dsg_ms == CONTROLLER_WAKE_PENDING) && (batt_getFetOutput(FET_DSG) == FET_ON))
+		{
+			uint32_t elapsed = HAL_GetTick() - wake_time;
+
+			wake_dsg_ms = (elapsed < CONTROLLER_WAKE_PENDING) ? elapsed : (CONTROLLER_WAKE_PENDING - 1);
+		}
+
+		batt_setLowPower(controller_state == STATE_IDLE);
 		controller_setBalanceState(controller_state);
 
+		watchdog_checkIn(WATCHDOG_TASK_CONTROL);
+
+		PROFILE_STOP(PROFILE_STAGE_STATE);
+		PROFILE_START(PROFILE_STAGE_DISPLAY);
+
 		display_setFault(batt_getFaultMask());
 		display_setSOC(display_soc);
 		display_update(controller_state);
 
+		PROFILE_STOP(PROFILE_STAGE_DISPLAY);
+		PROFILE_START(PROFILE_STAGE_TELEMETRY);
+
 		HAL_UART_Transmit_IT(&hlpuart1, (uint8_t*)&controller_data, sizeof(controller_data_S));
 
 //		printf("Hello World\n");
@@ -454,12 +673,98 @@ void controller_run(void)
 		if (controller_state == STATE_SHUTDOWN)
 		{
 			batt_shutdown();
-			__HAL_PWR_CLEAR_FLAG(PWR_FLAG_SB);
-			__HAL_PWR_CLEAR_FLAG(PWR_FLAG_WU);
-			HAL_PWR_EnableWakeUpPin(PWR_WAKEUP_PIN1);
-			HAL_PWR_EnterSTANDBYMode();
+			(void)usage_checkpoint();
+			(void)resistance_save();
+			(void)soh_save();
+			controller_enterStandby();
 		}
 
+		datalog_update(controller_state, display_soc);
+		usage_update(display_soc);
+		sop_update(display_soc);
+
+		controller_serviceCommand();
+
 		controller_packData();
+
+		watchdog_checkIn(WATCHDOG_TASK_TELEMETRY);
+
+		PROFILE_STOP(PROFILE_STAGE_TELEMETRY);
+		PROFILE_STOP(PROFILE_STAGE_LOOP);
 	}
+
+	if ((HAL_GetTick() - last_controller_run) < (LOOP_PERIOD_MS - TRACE_DRAIN_GUARD_MS))
+	{
+		// a fault capture goes out ahead of the trace, it is only ever a few chunks
+		if (blackbox_isDumping())
+		{
+			(void)blackbox_drain(&hlpuart1);
+		}
+		else if (datalog_isDumping())
+		{
+			(void)datalog_drain(&hlpuart1);
+		}
+		else
+		{
+			(void)i2c_trace_drain(&hlpuart1);
+		}
+
+		// flash and eeprom writes stall the core, keep them out of the loop itself and
+		// take at most one per pass
+		if (!datalog_service())
+		{
+			(void)usage_service();
+		}
+	}
+
+	watchdog_kick();
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	uint32_t now = HAL_GetTick();
+
+	if ((now - rx_tick) > CMD_GAP_MS)
+	{
+		rx_len = 0;
+	}
+
+	rx_tick = now;
+
+	// bytes that land while the loop still owes a command are dropped
+	if (!rx_ready)
+	{
+		rx_frame[rx_len++] = rx_byte;
+
+		if (rx_len >= controller_commandLength(rx_frame[0]))
+		{
+			rx_len = 0;
+			rx_ready = 1;
+		}
+	}
+
+	(void)HAL_UART_Receive_IT(huart, &rx_byte, 1);
+}
+
+controller_state_E controller_getState(void)
+{
+	return controller_state;
+}
+
+uint32_t controller_getTransitionCount(void)
+{
+	return transition_count;
+}
+
+// age 0 is the latest transition
+HAL_StatusTypeDef controller_getLogEntry(uint32_t age, controller_logEntry_S *entry)
+{
+	if ((age >= transition_count) || (age >= CONTROLLER_LOG_LEN))
+	{
+		return HAL_ERROR;
+	}
+
+	*entry = transition_log[(transition_count - 1 - age) % CONTROLLER_LOG_LEN];
+
+	return HAL_OK;
 }
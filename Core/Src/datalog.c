@@ -0,0 +1,410 @@
+#include "datalog.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "battery.h"
+
+#define DATALOG_STAGE_WORDS ((sizeof(datalog_pageHeader_S) + sizeof(datalog_record_S)) / 4)
+
+static uint16_t boot;
+static uint32_t seq; // of the newest page
+static uint8_t page;
+static uint8_t page_open;
+static uint8_t slot;
+static uint8_t next_page;
+static uint8_t next_erased;
+static uint8_t erase_due;
+
+// a record and possibly the page header, programmed one word per service call
+static uint32_t stage[DATALOG_STAGE_WORDS];
+static uint32_t stage_addr;
+static uint8_t stage_len;
+static uint8_t stage_pos;
+
+static uint32_t period_start;
+static int32_t i_sum;
+static uint16_t i_count;
+static int32_t i_min;
+static int32_t i_max;
+static uint16_t v_min;
+static uint16_t v_max;
+static uint8_t t_max;
+static uint8_t faults;
+
+static uint8_t dump_page; // oldest page, the stream starts there
+static uint16_t dump_pos;
+static uint16_t dump_left;
+static uint8_t dump_seq;
+static uint8_t dump_tx[DATALOG_CHUNK_HEADER + DATALOG_CHUNK_SIZE];
+
+static uint16_t datalog_crc(const void *data, uint32_t len)
+{
+	const uint8_t *bytes = data;
+	uint16_t crc = 0xFFFF;
+
+	for (uint32_t i = 0; i < len; i++)
+	{
+		crc ^= bytes[i] << 8;
+
+		for (uint32_t j = 0; j < 8; j++)
+		{
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+static uintptr_t datalog_pageAddr(uint8_t p)
+{
+	return DATALOG_BASE + (p * FLASH_PAGE_SIZE);
+}
+
+static uint8_t datalog_readHeader(uint8_t p, datalog_pageHeader_S *header)
+{
+	memcpy(header, (const void *)datalog_pageAddr(p), sizeof(*header));
+
+	return header->crc == datalog_crc(header, offsetof(datalog_pageHeader_S, crc));
+}
+
+static uint8_t datalog_readRecord(uint8_t p, uint8_t s, datalog_record_S *record)
+{
+	memcpy(record, (const void *)(datalog_pageAddr(p) + sizeof(datalog_pageHeader_S) + (s * sizeof(datalog_record_S))), sizeof(*record));
+
+	return record->crc == datalog_crc(record, offsetof(datalog_record_S, crc));
+}
+
+static uint8_t datalog_isErased(uint8_t p)
+{
+	const uint32_t *words = (const uint32_t *)datalog_pageAddr(p);
+
+	for (uint32_t i = 0; i < (FLASH_PAGE_SIZE / 4); i++)
+	{
+		if (words[i] != 0)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static HAL_StatusTypeDef datalog_erase(uint8_t p)
+{
+	FLASH_EraseInitTypeDef erase =
+	{
+		.TypeErase = FLASH_TYPEERASE_PAGES,
+		.PageAddress = datalog_pageAddr(p),
+		.NbPages = 1,
+	};
+	uint32_t page_error;
+
+	HAL_StatusTypeDef status = HAL_FLASH_Unlock();
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	status = HAL_FLASHEx_Erase(&erase, &page_error);
+
+	(void)HAL_FLASH_Lock();
+
+	return status;
+}
+
+static HAL_StatusTypeDef datalog_program(uint32_t addr, uint32_t word)
+{
+	HAL_StatusTypeDef status = HAL_FLASH_Unlock();
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr, word);
+
+	(void)HAL_FLASH_Lock();
+
+	return status;
+}
+
+static void datalog_resetPeriod(void)
+{
+	period_start = HAL_GetTick();
+	i_sum = 0;
+	i_count = 0;
+	i_min = INT32_MAX;
+	i_max = INT32_MIN;
+	v_min = UINT16_MAX;
+	v_max = 0;
+	t_max = 0;
+	faults = 0;
+}
+
+static void datalog_stage(const datalog_record_S *record)
+{
+	// the flash has not caught up with the last record, thirty seconds should never be short
+	if (stage_pos < stage_len)
+	{
+		return;
+	}
+
+	stage_len = 0;
+	stage_pos = 0;
+
+	if (!page_open || (slot >= DATALOG_RECORDS_PER_PAGE))
+	{
+		datalog_pageHeader_S header = { .seq = seq + 1, .boot = boot };
+
+		header.crc = datalog_crc(&header, offsetof(datalog_pageHeader_S, crc));
+
+		page = next_page;
+		page_open = 1;
+		seq = header.seq;
+		slot = 0;
+		erase_due = !next_erased;
+		next_page = (page + 1) % DATALOG_PAGES;
+		next_erased = 0;
+
+		memcpy(stage, &header, sizeof(header));
+		stage_len = sizeof(header) / 4;
+		stage_addr = datalog_pageAddr(page);
+	}
+	else
+	{
+		stage_addr = datalog_pageAddr(page) + sizeof(datalog_pageHeader_S) + (slot * sizeof(datalog_record_S));
+	}
+
+	memcpy(&stage[stage_len], record, sizeof(*record));
+	stage_len += sizeof(*record) / 4;
+	slot++;
+}
+
+// newest first, count is the number of valid records walked
+static HAL_StatusTypeDef datalog_find(uint32_t age, datalog_record_S *record, uint32_t *count)
+{
+	datalog_pageHeader_S header;
+	uint32_t expected = 0;
+
+	*count = 0;
+
+	for (uint32_t k = 0; k < DATALOG_PAGES; k++)
+	{
+		uint8_t p = (next_page + DATALOG_PAGES - 1 - k) % DATALOG_PAGES;
+
+		// stop at the wrap, older pages belong to a previous lap of the ring
+		if (!datalog_readHeader(p, &header) || (k && (header.seq != expected)))
+		{
+			break;
+		}
+
+		expected = header.seq - 1;
+
+		for (int32_t s = DATALOG_RECORDS_PER_PAGE - 1; s >= 0; s--)
+		{
+			if (!datalog_readRecord(p, s, record))
+			{
+				continue;
+			}
+
+			if ((*count)++ == age)
+			{
+				return HAL_OK;
+			}
+		}
+	}
+
+	return HAL_ERROR;
+}
+
+void datalog_init(void)
+{
+	datalog_pageHeader_S header;
+	uint8_t found = 0;
+	uint16_t last_boot = 0;
+
+	seq = 0;
+
+	for (uint32_t p = 0; p < DATALOG_PAGES; p++)
+	{
+		if (datalog_readHeader(p, &header) && (!found || ((int32_t)(header.seq - seq) > 0)))
+		{
+			found = 1;
+			seq = header.seq;
+			last_boot = header.boot;
+			page = p;
+		}
+	}
+
+	// every boot starts a fresh page, a torn record can only be at the tail of the last one
+	boot = found ? (last_boot + 1) : 0;
+	next_page = found ? ((page + 1) % DATALOG_PAGES) : 0;
+	next_erased = 0;
+	page_open = 0;
+	erase_due = 0;
+	stage_len = 0;
+	stage_pos = 0;
+	dump_left = 0;
+
+	datalog_resetPeriod();
+}
+
+void datalog_update(uint8_t state, uint8_t soc)
+{
+	int32_t current = batt_getPackCurrent();
+	uint16_t cell_min = batt_getCellVoltage(CELL_MIN);
+	uint16_t cell_max = batt_getCellVoltage(CELL_MAX);
+	uint8_t temp = batt_getTemp(TEMP_MAX);
+
+	i_sum += current;
+	i_count++;
+	i_min = (current < i_min) ? current : i_min;
+	i_max = (current > i_max) ? current : i_max;
+	v_min = (cell_min < v_min) ? cell_min : v_min;
+	v_max = (cell_max > v_max) ? cell_max : v_max;
+	t_max = (temp > t_max) ? temp : t_max;
+	faults |= batt_getFaultMask();
+
+	if ((HAL_GetTick() - period_start) < DATALOG_PERIOD_MS)
+	{
+		return;
+	}
+
+	datalog_record_S record =
+	{
+		.time_s = HAL_GetTick() / 1000,
+		.soc = soc,
+		.state = state,
+		.faults = faults,
+		.t_max = t_max,
+		.v_min = v_min,
+		.v_max = v_max,
+		.i_mean = (i_sum / i_count) / 10,
+		.i_min = i_min / 10,
+		.i_max = i_max / 10,
+	};
+
+	record.crc = datalog_crc(&record, offsetof(datalog_record_S, crc));
+
+	datalog_stage(&record);
+	datalog_resetPeriod();
+}
+
+// one erase or one word per call, either stalls the core on the flash for ~3 ms.
+// returns 1 when it took the flash
+uint8_t datalog_service(void)
+{
+	// pages go out straight from flash
+	if (dump_left)
+	{
+		return 0;
+	}
+
+	if (erase_due)
+	{
+		erase_due = 0;
+
+		if (!datalog_isErased(page))
+		{
+			(void)datalog_erase(page);
+			return 1;
+		}
+	}
+
+	if (stage_pos < stage_len)
+	{
+		if (datalog_program(stage_addr + (stage_pos * 4), stage[stage_pos]) != HAL_OK)
+		{
+			// leave the rest, the next record starts on a fresh page
+			stage_pos = stage_len;
+			page_open = 0;
+			return 1;
+		}
+
+		stage_pos++;
+		return 1;
+	}
+
+	// keep the page after the open one erased so a record never waits on an erase
+	if (!next_erased)
+	{
+		next_erased = 1;
+
+		if (!datalog_isErased(next_page))
+		{
+			(void)datalog_erase(next_page);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void datalog_requestDump(void)
+{
+	dump_page = next_page;
+	dump_pos = 0;
+	dump_left = DATALOG_DUMP_SIZE;
+	dump_seq = 0;
+}
+
+uint8_t datalog_isDumping(void)
+{
+	return dump_left != 0;
+}
+
+HAL_StatusTypeDef datalog_drain(UART_HandleTypeDef *huart)
+{
+	if ((dump_left == 0) || (huart->gState != HAL_UART_STATE_READY))
+	{
+		return HAL_OK;
+	}
+
+	// a whole page would outlast the guard ahead of the telemetry frame
+	uint16_t offset = dump_pos % FLASH_PAGE_SIZE;
+	uint16_t len = FLASH_PAGE_SIZE - offset;
+
+	if (len > DATALOG_CHUNK_SIZE)
+	{
+		len = DATALOG_CHUNK_SIZE;
+	}
+
+	dump_tx[0] = DATALOG_SYNC_0;
+	dump_tx[1] = DATALOG_SYNC_1;
+	dump_tx[2] = len;
+	dump_tx[3] = dump_seq++;
+
+	uint8_t page_index = (dump_page + (dump_pos / FLASH_PAGE_SIZE)) % DATALOG_PAGES;
+
+	memcpy(&dump_tx[DATALOG_CHUNK_HEADER], (const void *)(datalog_pageAddr(page_index) + offset), len);
+
+	dump_pos += len;
+	dump_left -= len;
+
+	return HAL_UART_Transmit_IT(huart, dump_tx, DATALOG_CHUNK_HEADER + len);
+}
+
+uint16_t datalog_getBoot(void)
+{
+	return boot;
+}
+
+uint32_t datalog_getRecordCount(void)
+{
+	datalog_record_S record;
+	uint32_t count;
+
+	(void)datalog_find(UINT32_MAX, &record, &count);
+
+	return count;
+}
+
+// age 0 is the latest record
+HAL_StatusTypeDef datalog_getRecord(uint32_t age, datalog_record_S *record)
+{
+	uint32_t count;
+
+	return datalog_find(age, record, &count);
+}
@@ -0,0 +1,120 @@
+#include "eeprom.h"
+
+#include <string.h>
+
+#define EEPROM_RECORD_MAGIC 0xB5A10000
+
+static uint16_t eeprom_checksum(const uint8_t *data, uint32_t len)
+{
+	uint16_t sum1 = 0;
+	uint16_t sum2 = 0;
+
+	for (uint32_t i = 0; i < len; i++)
+	{
+		sum1 = (sum1 + data[i]) % 255;
+		sum2 = (sum2 + sum1) % 255;
+	}
+
+	return (sum2 << 8) | sum1;
+}
+
+HAL_StatusTypeDef eeprom_read(uint32_t addr, void *data, uint32_t len)
+{
+	if ((addr + len) > EEPROM_SIZE)
+	{
+		return HAL_ERROR;
+	}
+
+	memcpy(data, (const void *)(DATA_EEPROM_BASE + addr), len);
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef eeprom_write(uint32_t addr, const void *data, uint32_t len)
+{
+	if (((addr + len) > EEPROM_SIZE) || (addr & 3) || (len & 3))
+	{
+		return HAL_ERROR;
+	}
+
+	HAL_StatusTypeDef status = HAL_FLASHEx_DATAEEPROM_Unlock();
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	const uint8_t *bytes = data;
+
+	for (uint32_t i = 0; i < len; i += 4)
+	{
+		uint32_t word;
+		uint32_t stored;
+
+		memcpy(&word, &bytes[i], sizeof(word));
+		memcpy(&stored, (const void *)(DATA_EEPROM_BASE + addr + i), sizeof(stored));
+
+		// skip unchanged words, each program cycle costs endurance and ~3 ms
+		if (word == stored)
+		{
+			continue;
+		}
+
+		status = HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_WORD, DATA_EEPROM_BASE + addr + i, word);
+
+		if (status != HAL_OK)
+		{
+			break;
+		}
+	}
+
+	(void)HAL_FLASHEx_DATAEEPROM_Lock();
+
+	return status;
+}
+
+HAL_StatusTypeDef eeprom_readRecord(uint32_t addr, void *data, uint32_t len)
+{
+	uint32_t trailer;
+
+	HAL_StatusTypeDef status = eeprom_read(addr + len, &trailer, sizeof(trailer));
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	status = eeprom_read(addr, data, len);
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	if (trailer != (EEPROM_RECORD_MAGIC | eeprom_checksum(data, len)))
+	{
+		return HAL_ERROR;
+	}
+
+	return HAL_OK;
+}
+
+// the word stored after a record, for callers that program it a word at a time
+uint32_t eeprom_recordTrailer(const void *data, uint32_t len)
+{
+	return EEPROM_RECORD_MAGIC | eeprom_checksum(data, len);
+}
+
+HAL_StatusTypeDef eeprom_writeRecord(uint32_t addr, const void *data, uint32_t len)
+{
+	uint32_t trailer = eeprom_recordTrailer(data, len);
+
+	HAL_StatusTypeDef status = eeprom_write(addr, data, len);
+
+	if (status != HAL_OK)
+	{
+		return status;
+	}
+
+	return eeprom_write(addr + len, &trailer, sizeof(trailer));
+}
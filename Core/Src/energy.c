@@ -0,0 +1,116 @@
+#include "energy.h"
+
+#include "battery.h"
+
+#define ENERGY_MWMS_PER_MWH 3600000
+#define ENERGY_POWER_SHIFT 4 // filtered power keeps a few fractional bits so slow windows still move
+#define ENERGY_MIN_POWER_MW 5000 // below this the estimate is mostly noise and parasitic load
+#define ENERGY_ESTIMATE_WINDOW ENERGY_WINDOW_60S
+#define ENERGY_TIME_MAX_MIN (ENERGY_TIME_UNKNOWN - 1)
+
+static const uint32_t window_ms[ENERGY_WINDOW_COUNT] = { 10000, 60000, 300000 };
+
+static int32_t power[ENERGY_WINDOW_COUNT]; // mW << ENERGY_POWER_SHIFT, discharge positive
+static uint32_t discharged_mwh;
+static uint32_t charged_mwh;
+static uint32_t discharged_mwms; // under a mWh
+static uint32_t charged_mwms;
+static uint16_t tte_min;
+static uint16_t ttf_min;
+static uint32_t last_tick;
+
+// mAs at the present pack voltage over the filtered power, in minutes
+static uint16_t energy_minutes(uint32_t mas, uint32_t pack_mv, int32_t power_mw)
+{
+	uint64_t mwh = ((uint64_t)mas * pack_mv) / ENERGY_MWMS_PER_MWH;
+	uint64_t minutes = (mwh * 60) / power_mw;
+
+	return (minutes > ENERGY_TIME_MAX_MIN) ? ENERGY_TIME_MAX_MIN : minutes;
+}
+
+void energy_init(void)
+{
+	for (uint32_t i = 0; i < ENERGY_WINDOW_COUNT; i++)
+	{
+		power[i] = 0;
+	}
+
+	discharged_mwh = 0;
+	charged_mwh = 0;
+	discharged_mwms = 0;
+	charged_mwms = 0;
+	tte_min = ENERGY_TIME_UNKNOWN;
+	ttf_min = ENERGY_TIME_UNKNOWN;
+	last_tick = HAL_GetTick();
+}
+
+// to_empty and to_full are the usable mAs left either way
+void energy_update(uint32_t to_empty, uint32_t to_full)
+{
+	uint32_t now = HAL_GetTick();
+	uint32_t dt = now - last_tick;
+
+	last_tick = now;
+
+	if (!batt_isReady() || (dt == 0))
+	{
+		return;
+	}
+
+	uint32_t pack_mv = batt_getCellVoltage(CELL_SUM);
+	int32_t power_mw = ((int64_t)pack_mv * batt_getPackCurrent()) / 1000;
+
+	if (power_mw >= 0)
+	{
+		discharged_mwms += power_mw * dt;
+		discharged_mwh += discharged_mwms / ENERGY_MWMS_PER_MWH;
+		discharged_mwms %= ENERGY_MWMS_PER_MWH;
+	}
+	else
+	{
+		charged_mwms += -power_mw * dt;
+		charged_mwh += charged_mwms / ENERGY_MWMS_PER_MWH;
+		charged_mwms %= ENERGY_MWMS_PER_MWH;
+	}
+
+	// first order filters, dt over the window is the weight of this sample
+	for (uint32_t i = 0; i < ENERGY_WINDOW_COUNT; i++)
+	{
+		uint32_t weight = (dt < window_ms[i]) ? dt : window_ms[i];
+
+		power[i] += ((((int64_t)power_mw * (1 << ENERGY_POWER_SHIFT)) - power[i]) * weight) / (int32_t)window_ms[i];
+	}
+
+	int32_t estimate = power[ENERGY_ESTIMATE_WINDOW] >> ENERGY_POWER_SHIFT;
+
+	tte_min = (estimate > ENERGY_MIN_POWER_MW) ? energy_minutes(to_empty, pack_mv, estimate) : ENERGY_TIME_UNKNOWN;
+	ttf_min = (estimate < -ENERGY_MIN_POWER_MW) ? energy_minutes(to_full, pack_mv, -estimate) : ENERGY_TIME_UNKNOWN;
+}
+
+// mW, discharge positive
+int32_t energy_getPower(energy_window_E window)
+{
+	return (window < ENERGY_WINDOW_COUNT) ? (power[window] >> ENERGY_POWER_SHIFT) : 0;
+}
+
+// mWh since power up
+uint32_t energy_getDischarged(void)
+{
+	return discharged_mwh;
+}
+
+uint32_t energy_getCharged(void)
+{
+	return charged_mwh;
+}
+
+// minutes at the 60 s average power
+uint16_t energy_getTimeToEmpty(void)
+{
+	return tte_min;
+}
+
+uint16_t energy_getTimeToFull(void)
+{
+	return ttf_min;
+}
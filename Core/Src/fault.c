@@ -0,0 +1,124 @@
+#include "fault.h"
+
+#include "blackbox.h"
+
+// worst-case trip time is set_ms plus one update period (LOOP_PERIOD_MS, 100 ms)
+static const fault_policy_S fault_policy[FAULT_COUNT] =
+{
+	// qualified by the adc121 alert path and the bq ocd/scd delays, the fets are already open
+	[FAULT_OC] = { .set_thresh = 1, .clear_thresh = 0, .set_ms = 0, .clear_ms = 0, .latch = 1 },
+	[FAULT_SC] = { .set_thresh = 1, .clear_thresh = 0, .set_ms = 0, .clear_ms = 0, .latch = 1 },
+	// the bq qualifies these with its own ov/uv delay and holds them in sys_stat
+	[FAULT_OV] = { .set_thresh = 1, .clear_thresh = 0, .set_ms = 0, .clear_ms = 0, .latch = 1 },
+	[FAULT_UV] = { .set_thresh = 1, .clear_thresh = 0, .set_ms = 0, .clear_ms = 0, .latch = 1 },
+	[FAULT_BQ] = { .set_thresh = 1, .clear_thresh = 0, .set_ms = 0, .clear_ms = 0, .latch = 1 },
+	// cell temperature in C, trips within 2.1 s above 60 C and recovers after 10 s at 50 C
+	[FAULT_OT] = { .set_thresh = 61, .clear_thresh = 50, .set_ms = 2000, .clear_ms = 10000, .latch = 0 },
+	// three failed updates in a row, trips within 400 ms
+	[FAULT_COMMS] = { .set_thresh = 1, .clear_thresh = 0, .set_ms = 300, .clear_ms = 1000, .latch = 0 },
+	[FAULT_PRECHARGE] = { .set_thresh = 1, .clear_thresh = 0, .set_ms = 0, .clear_ms = 0, .latch = 1 },
+};
+
+typedef struct
+{
+	uint8_t active;
+	uint8_t pending;
+	uint32_t since;
+} fault_state_S;
+
+static fault_state_S fault_state[FAULT_COUNT];
+static uint16_t fault_count[FAULT_COUNT]; // since power up, batt_init keeps them
+
+void fault_reset(void)
+{
+	for (uint32_t i = 0; i < FAULT_COUNT; i++)
+	{
+		fault_state[i].active = 0;
+		fault_state[i].pending = 0;
+	}
+}
+
+static uint8_t fault_qualify(fault_state_S *state, uint8_t condition, uint16_t hold_ms, uint32_t now)
+{
+	if (!condition)
+	{
+		state->pending = 0;
+		return 0;
+	}
+
+	if (!state->pending)
+	{
+		state->pending = 1;
+		state->since = now;
+	}
+
+	if ((now - state->since) < hold_ms)
+	{
+		return 0;
+	}
+
+	state->pending = 0;
+
+	return 1;
+}
+
+void fault_update(batt_fault_E fault, int32_t value, uint32_t now)
+{
+	const fault_policy_S *policy = &fault_policy[fault];
+	fault_state_S *state = &fault_state[fault];
+
+	uint8_t rising = policy->set_thresh >= policy->clear_thresh;
+	uint8_t beyond_set = rising ? (value >= policy->set_thresh) : (value <= policy->set_thresh);
+	uint8_t within_clear = rising ? (value <= policy->clear_thresh) : (value >= policy->clear_thresh);
+
+	if (!state->active)
+	{
+		if (fault_qualify(state, beyond_set, policy->set_ms, now))
+		{
+			state->active = 1;
+			fault_count[fault]++;
+
+			blackbox_trigger(fault);
+		}
+	}
+	else if (!policy->latch)
+	{
+		if (fault_qualify(state, within_clear, policy->clear_ms, now))
+		{
+			state->active = 0;
+		}
+	}
+}
+
+void fault_latch(batt_fault_E fault)
+{
+	if (!fault_state[fault].active)
+	{
+		fault_state[fault].active = 1;
+		fault_count[fault]++;
+
+		blackbox_trigger(fault);
+	}
+}
+
+uint8_t fault_isActive(batt_fault_E fault)
+{
+	return fault_state[fault].active;
+}
+
+uint8_t fault_getMask(void)
+{
+	uint8_t mask = 0;
+
+	for (uint32_t i = 0; i < FAULT_COUNT; i++)
+	{
+		mask |= fault_state[i].active << i;
+	}
+
+	return mask;
+}
+
+uint16_t fault_getCount(batt_fault_E fault)
+{
+	return fault_count[fault];
+}
@@ -0,0 +1,90 @@
+#include "fuse.h"
+
+// heat per ms, the inverse of the trip time interpolated along the curve.
+// the rated current is the zero point so the curve starts flat
+static int32_t fuse_rate(const fuse_curve_S *curve, int32_t current)
+{
+	int32_t i0 = curve->rated_ma;
+	int32_t r0 = 0;
+
+	for (uint32_t i = 0; i < curve->count; i++)
+	{
+		int32_t i1 = curve->points[i].current_ma;
+		int32_t r1 = FUSE_HEAT_TRIP / curve->points[i].trip_ms;
+
+		if (current < i1)
+		{
+			return r0 + (((r1 - r0) * (current - i0)) / (i1 - i0));
+		}
+
+		i0 = i1;
+		r0 = r1;
+	}
+
+	// past the last point the hardware trips take over, hold its trip time
+	return r0;
+}
+
+void fuse_init(fuse_S *fuse, const fuse_curve_S *curve)
+{
+	fuse->curve = curve;
+	fuse->heat = 0;
+}
+
+// returns 1 once the accumulated heat reaches the trip point
+uint8_t fuse_update(fuse_S *fuse, int32_t current, uint32_t dt_ms)
+{
+	if (current <= fuse->curve->rated_ma)
+	{
+		uint32_t cool = (FUSE_HEAT_TRIP / fuse->curve->cool_ms) * dt_ms;
+
+		fuse->heat = (fuse->heat > cool) ? (fuse->heat - cool) : 0;
+
+		return 0;
+	}
+
+	fuse->heat += fuse_rate(fuse->curve, current) * dt_ms;
+
+	if (fuse->heat >= FUSE_HEAT_TRIP)
+	{
+		fuse->heat = FUSE_HEAT_TRIP;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+// highest current that can be held for window_ms from the present heat without a trip,
+// a sixteenth of the budget is kept back for rounding and the sample spacing
+int32_t fuse_getLimit(const fuse_S *fuse, uint32_t window_ms)
+{
+	const fuse_curve_S *curve = fuse->curve;
+	uint32_t budget = FUSE_HEAT_TRIP - fuse->heat;
+	int32_t rate = (budget - (budget / 16)) / window_ms;
+	int32_t i0 = curve->rated_ma;
+	int32_t r0 = 0;
+
+	for (uint32_t i = 0; i < curve->count; i++)
+	{
+		int32_t i1 = curve->points[i].current_ma;
+		int32_t r1 = FUSE_HEAT_TRIP / curve->points[i].trip_ms;
+
+		if (rate < r1)
+		{
+			return i0 + (((int64_t)(rate - r0) * (i1 - i0)) / (r1 - r0));
+		}
+
+		i0 = i1;
+		r0 = r1;
+	}
+
+	// the rate is flat past the last point, there the hardware trips are the limit
+	return INT32_MAX;
+}
+
+// percent of the way to a trip
+uint8_t fuse_getHeat(const fuse_S *fuse)
+{
+	return ((uint64_t)fuse->heat * 100) / FUSE_HEAT_TRIP;
+}
@@ -0,0 +1,214 @@
+#include "i2c_trace.h"
+
+#include <string.h>
+
+#include "adc121.h"
+#include "bq76930.h"
+#include "tca9534.h"
+
+#define I2C_TRACE_VARINT_MAX 5
+#define I2C_TRACE_RECORD_MAX (1 + I2C_TRACE_VARINT_MAX + 1 + I2C_TRACE_LEN_MASK)
+
+static uint8_t trace_buf[I2C_TRACE_BUF_SIZE];
+static uint8_t trace_tx[I2C_TRACE_CHUNK_HEADER + I2C_TRACE_CHUNK_SIZE];
+static uint16_t trace_head;
+static uint16_t trace_tail;
+static uint32_t trace_last_tick;
+static uint32_t trace_dropped;
+static uint32_t trace_dropped_total;
+static uint8_t trace_seq;
+static uint8_t trace_enabled;
+
+static uint16_t i2c_trace_used(void)
+{
+	return (trace_head - trace_tail + I2C_TRACE_BUF_SIZE) % I2C_TRACE_BUF_SIZE;
+}
+
+static uint16_t i2c_trace_free(void)
+{
+	return I2C_TRACE_BUF_SIZE - 1 - i2c_trace_used();
+}
+
+static void i2c_trace_put(const uint8_t *data, uint16_t len)
+{
+	for (uint16_t i = 0; i < len; i++)
+	{
+		trace_buf[trace_head] = data[i];
+		trace_head = (trace_head + 1) % I2C_TRACE_BUF_SIZE;
+	}
+}
+
+static uint8_t i2c_trace_varint(uint8_t *out, uint32_t value)
+{
+	uint8_t len = 0;
+
+	do
+	{
+		out[len] = (value & 0x7F) | ((value > 0x7F) ? 0x80 : 0);
+		value >>= 7;
+		len++;
+	} while (value);
+
+	return len;
+}
+
+static uint8_t i2c_trace_device(uint16_t dev_addr)
+{
+	switch (dev_addr >> 1)
+	{
+	case BQ76930_I2C_ADDR: return I2C_TRACE_DEV_BQ;
+	case TCA9534_I2C_ADDR: return I2C_TRACE_DEV_TCA;
+	case ADC121_I2C_ADDR: return I2C_TRACE_DEV_ADC;
+	default: return I2C_TRACE_DEV_MARK;
+	}
+}
+
+static void i2c_trace_putMark(i2c_trace_mark_E type, const void *data, uint8_t len)
+{
+	uint8_t header[2 + I2C_TRACE_VARINT_MAX];
+	uint32_t now = HAL_GetTick();
+	uint8_t n = 0;
+
+	header[n++] = (I2C_TRACE_DEV_MARK << 6) | (type & 0x3F);
+	n += i2c_trace_varint(&header[n], now - trace_last_tick);
+	header[n++] = len;
+
+	trace_last_tick = now;
+
+	i2c_trace_put(header, n);
+	i2c_trace_put(data, len);
+}
+
+static void i2c_trace_record(uint16_t dev_addr, uint8_t write, uint16_t reg, const uint8_t *data, uint16_t size, HAL_StatusTypeDef status)
+{
+	uint8_t device = i2c_trace_device(dev_addr);
+
+	if (!trace_enabled || (device == I2C_TRACE_DEV_MARK))
+	{
+		return;
+	}
+
+	uint8_t len = (size > I2C_TRACE_LEN_MASK) ? I2C_TRACE_LEN_MASK : size;
+	uint8_t payload = ((status != HAL_OK) && !write) ? 0 : len;
+
+	// a drop marker has to fit ahead of the first record after a gap
+	uint16_t needed = I2C_TRACE_RECORD_MAX + (trace_dropped ? (2 + I2C_TRACE_VARINT_MAX + sizeof(trace_dropped)) : 0);
+
+	if (i2c_trace_free() < needed)
+	{
+		trace_dropped++;
+		trace_dropped_total++;
+		return;
+	}
+
+	if (trace_dropped)
+	{
+		i2c_trace_putMark(I2C_TRACE_MARK_DROP, &trace_dropped, sizeof(trace_dropped));
+		trace_dropped = 0;
+	}
+
+	uint8_t header[2 + I2C_TRACE_VARINT_MAX];
+	uint32_t now = HAL_GetTick();
+	uint8_t n = 0;
+
+	header[n++] = (device << 6) | (write ? I2C_TRACE_FLAG_WRITE : 0) | ((status != HAL_OK) ? I2C_TRACE_FLAG_ERROR : 0) | len;
+	n += i2c_trace_varint(&header[n], now - trace_last_tick);
+	header[n++] = reg;
+
+	trace_last_tick = now;
+
+	i2c_trace_put(header, n);
+	i2c_trace_put(data, payload);
+}
+
+void i2c_trace_init(void)
+{
+	uint32_t now = HAL_GetTick();
+
+	trace_head = 0;
+	trace_tail = 0;
+	trace_dropped = 0;
+	trace_dropped_total = 0;
+	trace_seq = 0;
+	trace_last_tick = now;
+	trace_enabled = I2C_TRACE_ENABLE;
+
+	if (trace_enabled)
+	{
+		i2c_trace_putMark(I2C_TRACE_MARK_START, &now, sizeof(now));
+	}
+}
+
+void i2c_trace_enable(uint8_t enable)
+{
+	trace_enabled = enable;
+}
+
+void i2c_trace_mark(i2c_trace_mark_E type, const void *data, uint8_t len)
+{
+	if (!trace_enabled)
+	{
+		return;
+	}
+
+	if (i2c_trace_free() < (2 + I2C_TRACE_VARINT_MAX + len))
+	{
+		trace_dropped++;
+		trace_dropped_total++;
+		return;
+	}
+
+	i2c_trace_putMark(type, data, len);
+}
+
+HAL_StatusTypeDef i2c_trace_drain(UART_HandleTypeDef *huart)
+{
+	uint16_t len = i2c_trace_used();
+
+	// the tx buffer is only free again once the last chunk has gone out
+	if ((len == 0) || (huart->gState != HAL_UART_STATE_READY))
+	{
+		return HAL_OK;
+	}
+
+	if (len > I2C_TRACE_CHUNK_SIZE)
+	{
+		len = I2C_TRACE_CHUNK_SIZE;
+	}
+
+	trace_tx[0] = I2C_TRACE_SYNC_0;
+	trace_tx[1] = I2C_TRACE_SYNC_1;
+	trace_tx[2] = len;
+	trace_tx[3] = trace_seq++;
+
+	for (uint16_t i = 0; i < len; i++)
+	{
+		trace_tx[I2C_TRACE_CHUNK_HEADER + i] = trace_buf[trace_tail];
+		trace_tail = (trace_tail + 1) % I2C_TRACE_BUF_SIZE;
+	}
+
+	return HAL_UART_Transmit_IT(huart, trace_tx, I2C_TRACE_CHUNK_HEADER + len);
+}
+
+uint32_t i2c_trace_getDropped(void)
+{
+	return trace_dropped_total;
+}
+
+HAL_StatusTypeDef i2c_trace_memRead(I2C_HandleTypeDef *hi2c, uint16_t dev_addr, uint16_t reg, uint16_t reg_size, uint8_t *data, uint16_t size, uint32_t timeout)
+{
+	HAL_StatusTypeDef status = HAL_I2C_Mem_Read(hi2c, dev_addr, reg, reg_size, data, size, timeout);
+
+	i2c_trace_record(dev_addr, 0, reg, data, size, status);
+
+	return status;
+}
+
+HAL_StatusTypeDef i2c_trace_memWrite(I2C_HandleTypeDef *hi2c, uint16_t dev_addr, uint16_t reg, uint16_t reg_size, uint8_t *data, uint16_t size, uint32_t timeout)
+{
+	HAL_StatusTypeDef status = HAL_I2C_Mem_Write(hi2c, dev_addr, reg, reg_size, data, size, timeout);
+
+	i2c_trace_record(dev_addr, 1, reg, data, size, status);
+
+	return status;
+}
@@ -0,0 +1,95 @@
+#include "ocv.h"
+
+#define OCV_SOC_LEN 12
+#define OCV_TEMP_LEN 4
+
+#define OCV_Q8 256
+
+// rested cell voltage against soc, one row per temperature. 25 C is the
+// original single temperature table, cold cells sit lower through the middle
+static const uint16_t soc_grid[OCV_SOC_LEN] = { 0, 40, 147, 253, 360, 467, 573, 680, 787, 893, 950, 1000 }; // permille
+static const uint8_t temp_grid[OCV_TEMP_LEN] = { 0, 10, 25, 45 }; // C
+
+static const uint16_t ocv_table[OCV_TEMP_LEN][OCV_SOC_LEN] =
+{
+	{ 2450, 2920, 3230, 3440, 3545, 3650, 3755, 3860, 3965, 4020, 4075, 4180 },
+	{ 2480, 2965, 3270, 3475, 3578, 3680, 3782, 3884, 3986, 4038, 4090, 4192 },
+	{ 2500, 3000, 3300, 3500, 3600, 3700, 3800, 3900, 4000, 4050, 4100, 4200 },
+	{ 2510, 3015, 3312, 3508, 3606, 3705, 3804, 3903, 4002, 4052, 4101, 4200 },
+};
+
+// the row for the last temperature seen, the sensors only move in whole degrees
+// so both lookups search a single precomputed row most of the time
+static uint16_t column[OCV_SOC_LEN];
+static int16_t column_temp = -1;
+
+static void ocv_select(uint8_t temp)
+{
+	if (temp == column_temp)
+	{
+		return;
+	}
+
+	uint32_t row = 0;
+
+	while ((row < (OCV_TEMP_LEN - 2)) && (temp >= temp_grid[row + 1]))
+	{
+		row++;
+	}
+
+	int32_t clamped = (temp < temp_grid[0]) ? temp_grid[0] : ((temp > temp_grid[OCV_TEMP_LEN - 1]) ? temp_grid[OCV_TEMP_LEN - 1] : temp);
+	int32_t frac = ((clamped - temp_grid[row]) * OCV_Q8) / (temp_grid[row + 1] - temp_grid[row]);
+
+	for (uint32_t i = 0; i < OCV_SOC_LEN; i++)
+	{
+		int32_t v0 = ocv_table[row][i];
+		int32_t v1 = ocv_table[row + 1][i];
+
+		column[i] = v0 + (((v1 - v0) * frac) / OCV_Q8);
+	}
+
+	column_temp = temp;
+}
+
+uint16_t ocv_getVoltage(uint16_t soc, uint8_t temp)
+{
+	ocv_select(temp);
+
+	if (soc >= OCV_SOC_FULL)
+	{
+		return column[OCV_SOC_LEN - 1];
+	}
+
+	uint32_t i = 1;
+
+	while (soc >= soc_grid[i])
+	{
+		i++;
+	}
+
+	return column[i - 1] + (((int32_t)(column[i] - column[i - 1]) * (soc - soc_grid[i - 1])) / (soc_grid[i] - soc_grid[i - 1]));
+}
+
+uint16_t ocv_getSoc(uint16_t mv, uint8_t temp)
+{
+	ocv_select(temp);
+
+	if (mv <= column[0])
+	{
+		return 0;
+	}
+
+	if (mv >= column[OCV_SOC_LEN - 1])
+	{
+		return OCV_SOC_FULL;
+	}
+
+	uint32_t i = 1;
+
+	while (mv >= column[i])
+	{
+		i++;
+	}
+
+	return soc_grid[i - 1] + (((int32_t)(soc_grid[i] - soc_grid[i - 1]) * (mv - column[i - 1])) / (column[i] - column[i - 1]));
+}
@@ -0,0 +1,113 @@
+#include "precharge.h"
+
+#include "stm32l0xx_hal.h"
+
+#include "battery.h"
+
+#define PRECHARGE_THRESHOLD_MV 8000
+#define PRECHARGE_TIMEOUT_MS 5000
+#define PRECHARGE_MIN_MS 60 // a few pack samples before the slope is trusted
+#define PRECHARGE_FAIL_COUNT 3 // consecutive samples that will not make the timeout
+
+#define PRECHARGE_ETA_STEPS 8 // steps per time constant
+#define PRECHARGE_ETA_DECAY 226 // exp(-1/8) in q8
+#define PRECHARGE_ETA_MAX_STEPS 64
+
+static uint32_t start_time;
+static uint32_t sample_tick;
+static int32_t residual_mv;
+static uint32_t eta_ms;
+static uint8_t fail_count;
+static precharge_result_E result;
+
+// steps the exponential the bus is charging along down to the threshold
+static uint32_t precharge_predict(int32_t residual, uint32_t tau_ms)
+{
+	for (uint32_t n = 0; n < PRECHARGE_ETA_MAX_STEPS; n++)
+	{
+		if (residual <= PRECHARGE_THRESHOLD_MV)
+		{
+			return (n * tau_ms) / PRECHARGE_ETA_STEPS;
+		}
+
+		residual = (residual * PRECHARGE_ETA_DECAY) >> 8;
+	}
+
+	return UINT32_MAX;
+}
+
+void precharge_start(void)
+{
+	start_time = HAL_GetTick();
+	sample_tick = start_time;
+	residual_mv = -1;
+	eta_ms = UINT32_MAX;
+	fail_count = 0;
+	result = PRECHARGE_RUNNING;
+}
+
+precharge_result_E precharge_update(void)
+{
+	if (result != PRECHARGE_RUNNING)
+	{
+		return result;
+	}
+
+	uint32_t elapsed = HAL_GetTick() - start_time;
+
+	if (elapsed >= PRECHARGE_TIMEOUT_MS)
+	{
+		result = PRECHARGE_FAIL;
+		return result;
+	}
+
+	batt_senseResult_S pack;
+
+	batt_getSense(SENSE_PACK, &pack);
+
+	// only windows taken with the precharge fet already on
+	if ((int32_t)(pack.tick - sample_tick) <= 0)
+	{
+		return result;
+	}
+
+	int32_t residual = (int32_t)batt_getCellVoltage(CELL_SUM) - (int32_t)pack.value;
+	uint32_t dt = pack.tick - sample_tick;
+
+	if (residual < PRECHARGE_THRESHOLD_MV)
+	{
+		eta_ms = 0;
+		result = PRECHARGE_DONE;
+	}
+	else if (residual_mv >= 0)
+	{
+		int32_t dr = residual_mv - residual;
+
+		// the residual decays with the bus time constant, a short or a heavy load flattens it
+		eta_ms = (dr > 0) ? precharge_predict(residual, ((uint32_t)residual_mv * dt) / dr) : UINT32_MAX;
+
+		if ((elapsed >= PRECHARGE_MIN_MS) && ((eta_ms == UINT32_MAX) || ((elapsed + eta_ms) > PRECHARGE_TIMEOUT_MS)))
+		{
+			fail_count++;
+		}
+		else
+		{
+			fail_count = 0;
+		}
+
+		if (fail_count >= PRECHARGE_FAIL_COUNT)
+		{
+			result = PRECHARGE_FAIL;
+		}
+	}
+
+	residual_mv = residual;
+	sample_tick = pack.tick;
+
+	return result;
+}
+
+uint32_t precharge_getEta(void)
+{
+	return eta_ms;
+}
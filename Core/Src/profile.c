@@ -0,0 +1,117 @@
+#include "profile.h"
+
+#if PROFILE_ENABLE
+
+#include <string.h>
+
+#define PROFILE_HIST_BASE_US 16
+#define PROFILE_HIST_SHIFT 2
+
+typedef struct
+{
+	uint16_t count;
+	uint16_t min_us;
+	uint16_t max_us;
+	uint32_t sum_us;
+	uint16_t hist[PROFILE_HIST_BINS];
+} profile_window_S;
+
+static profile_window_S profile_window[PROFILE_STAGE_COUNT];
+static uint32_t profile_start_time[PROFILE_STAGE_COUNT];
+static uint8_t profile_export_stage;
+
+static void profile_reset(profile_stage_E stage)
+{
+	memset(&profile_window[stage], 0, sizeof(profile_window_S));
+
+	profile_window[stage].min_us = UINT16_MAX;
+}
+
+void profile_init(void)
+{
+	for (uint32_t i = 0; i < PROFILE_STAGE_COUNT; i++)
+	{
+		profile_reset(i);
+	}
+
+	profile_export_stage = 0;
+}
+
+uint32_t profile_now(void)
+{
+	uint32_t tick;
+	uint32_t val;
+
+	// retry if the systick interrupt lands between the two reads
+	do
+	{
+		tick = HAL_GetTick();
+		val = SysTick->VAL;
+	} while (tick != HAL_GetTick());
+
+	return (tick * (SysTick->LOAD + 1)) + (SysTick->LOAD - val);
+}
+
+void profile_start(profile_stage_E stage)
+{
+	profile_start_time[stage] = profile_now();
+}
+
+void profile_stop(profile_stage_E stage)
+{
+	uint32_t us = (profile_now() - profile_start_time[stage]) / (SystemCoreClock / 1000000);
+	profile_window_S *window = &profile_window[stage];
+
+	if (us > UINT16_MAX)
+	{
+		us = UINT16_MAX;
+	}
+
+	uint32_t bin = 0;
+	uint32_t limit = PROFILE_HIST_BASE_US;
+
+	while ((bin < (PROFILE_HIST_BINS - 1)) && (us >= limit))
+	{
+		bin++;
+		limit <<= PROFILE_HIST_SHIFT;
+	}
+
+	if (window->count == UINT16_MAX)
+	{
+		return;
+	}
+
+	window->count++;
+	window->sum_us += us;
+	window->hist[bin]++;
+
+	if (us < window->min_us)
+	{
+		window->min_us = us;
+	}
+
+	if (us > window->max_us)
+	{
+		window->max_us = us;
+	}
+}
+
+void profile_export(profile_stats_S *stats)
+{
+	memset(stats, 0, sizeof(profile_stats_S));
+
+	profile_window_S *window = &profile_window[profile_export_stage];
+
+	stats->stage = profile_export_stage;
+	stats->count = window->count;
+	stats->min_us = window->count ? window->min_us : 0;
+	stats->max_us = window->max_us;
+	stats->mean_us = window->count ? (window->sum_us / window->count) : 0;
+	memcpy(stats->hist, window->hist, sizeof(stats->hist));
+
+	profile_reset(profile_export_stage);
+
+	profile_export_stage = (profile_export_stage + 1) % PROFILE_STAGE_COUNT;
+}
+
+#endif // PROFILE_ENABLE
@@ -0,0 +1,247 @@
+#include "resistance.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "eeprom.h"
+
+#define RESISTANCE_STEADY_MA 500 // ripple allowed inside a plateau
+#define RESISTANCE_SETTLE_MS 300 // longer than a bq adc cycle, so the cell reading belongs to the plateau
+#define RESISTANCE_PAIR_MS 10 // the cell read has to close with the current window
+#define RESISTANCE_GAP_MS 1000 // points further apart let the rc part of the cell creep into the estimate
+#define RESISTANCE_MAX_UOHM 60000
+#define RESISTANCE_FILTER 8
+#define RESISTANCE_SAVE_COUNT 16 // estimates between eeprom checkpoints
+#define RESISTANCE_LSB_UOHM 250 // eeprom resolution, one byte per cell
+#define RESISTANCE_TEMP_LEN 5
+
+typedef struct
+{
+	uint32_t tick;
+	int32_t current;
+	uint16_t volt[CELL_COUNT];
+} resistance_point_S;
+
+// r(t) / r(25 C) in q8, roughly doubling from 25 C down to 0 C
+static const int32_t temp_table_c[RESISTANCE_TEMP_LEN] = { 0, 10, 25, 40, 60 };
+static const int32_t temp_table_q8[RESISTANCE_TEMP_LEN] = { 512, 384, 256, 205, 166 };
+
+static uint32_t r0_nominal[CELL_COUNT]; // normalised to 25 C
+static uint16_t r0_seeded;
+static uint32_t estimate_count;
+static uint32_t saved_count;
+static resistance_point_S ref;
+static uint8_t ref_valid;
+static resistance_point_S pending;
+static uint8_t pending_valid;
+static uint32_t plateau_start;
+static int32_t plateau_ma;
+static uint32_t last_window_end;
+
+static int32_t resistance_tempFactor(void)
+{
+	int32_t temp = batt_getTemp(TEMP_AVG);
+
+	if (temp <= temp_table_c[0])
+	{
+		return temp_table_q8[0];
+	}
+
+	for (uint32_t i = 1; i < RESISTANCE_TEMP_LEN; i++)
+	{
+		if (temp < temp_table_c[i])
+		{
+			return temp_table_q8[i - 1] + (((temp_table_q8[i] - temp_table_q8[i - 1]) * (temp - temp_table_c[i - 1])) / (temp_table_c[i] - temp_table_c[i - 1]));
+		}
+	}
+
+	return temp_table_q8[RESISTANCE_TEMP_LEN - 1];
+}
+
+static void resistance_estimate(const resistance_point_S *before, const resistance_point_S *after)
+{
+	int32_t di = after->current - before->current;
+	int32_t factor = resistance_tempFactor();
+
+	for (uint32_t i = 0; i < CELL_COUNT; i++)
+	{
+		// discharge is positive, the cell sags as the current rises
+		int32_t r = ((int64_t)((int32_t)before->volt[i] - after->volt[i]) * 1000000) / di;
+
+		// a balancing cell or a bq glitch moves on its own, drop it
+		if ((r <= 0) || (r > RESISTANCE_MAX_UOHM))
+		{
+			continue;
+		}
+
+		r = (r << 8) / factor;
+
+		if (r0_seeded & (1 << i))
+		{
+			r0_nominal[i] += (r - (int32_t)r0_nominal[i]) / RESISTANCE_FILTER;
+		}
+		else
+		{
+			r0_nominal[i] = r;
+			r0_seeded |= (1 << i);
+		}
+	}
+
+	estimate_count++;
+
+	if ((estimate_count - saved_count) >= RESISTANCE_SAVE_COUNT)
+	{
+		(void)resistance_save();
+	}
+}
+
+void resistance_init(void)
+{
+	uint8_t record[EEPROM_SIZE_R0];
+
+	r0_seeded = 0;
+
+	if (eeprom_readRecord(EEPROM_ADDR_R0, record, sizeof(record)) == HAL_OK)
+	{
+		r0_seeded = record[CELL_COUNT] | (record[CELL_COUNT + 1] << 8);
+	}
+
+	for (uint32_t i = 0; i < CELL_COUNT; i++)
+	{
+		r0_nominal[i] = (r0_seeded & (1 << i)) ? (record[i] * RESISTANCE_LSB_UOHM) : RESISTANCE_DEFAULT_UOHM;
+	}
+
+	estimate_count = 0;
+	saved_count = 0;
+	ref_valid = 0;
+	pending_valid = 0;
+	plateau_start = HAL_GetTick();
+	plateau_ma = 0;
+	last_window_end = 0;
+}
+
+// pairs each cell read with the current window it closed with, and takes dV/dI
+// across a step between two settled plateaus. a point only counts once the
+// next window stayed on its plateau, with the fets open the current is sampled
+// sparsely and the cells can see a step before the window does
+void resistance_update(void)
+{
+	batt_currentWindow_S window;
+
+	batt_getCurrentWindow(&window);
+
+	if (window.end == last_window_end)
+	{
+		return;
+	}
+
+	last_window_end = window.end;
+
+	if ((window.max - window.min) > RESISTANCE_STEADY_MA)
+	{
+		pending_valid = 0;
+		plateau_start = window.end;
+		plateau_ma = window.mean;
+		return;
+	}
+
+	if (abs(window.mean - plateau_ma) > RESISTANCE_STEADY_MA)
+	{
+		pending_valid = 0;
+		plateau_start = window.start;
+		plateau_ma = window.mean;
+		return;
+	}
+
+	uint32_t cell_tick = batt_getCellTick();
+
+	if (((window.end - plateau_start) < RESISTANCE_SETTLE_MS) || (abs((int32_t)(cell_tick - window.end)) > RESISTANCE_PAIR_MS))
+	{
+		return;
+	}
+
+	resistance_point_S point;
+
+	point.tick = window.end;
+	point.current = window.mean;
+
+	for (uint32_t i = 0; i < CELL_COUNT; i++)
+	{
+		point.volt[i] = batt_getCellVoltage(i);
+	}
+
+	if (pending_valid)
+	{
+		if (ref_valid && (abs(pending.current - ref.current) >= RESISTANCE_STEP_MA) && ((pending.tick - ref.tick) <= RESISTANCE_GAP_MS))
+		{
+			resistance_estimate(&ref, &pending);
+		}
+
+		ref = pending;
+		ref_valid = 1;
+	}
+
+	pending = point;
+	pending_valid = 1;
+}
+
+HAL_StatusTypeDef resistance_save(void)
+{
+	uint8_t record[EEPROM_SIZE_R0] = { 0 };
+
+	if (estimate_count == saved_count)
+	{
+		return HAL_OK;
+	}
+
+	for (uint32_t i = 0; i < CELL_COUNT; i++)
+	{
+		uint32_t lsb = (r0_nominal[i] + (RESISTANCE_LSB_UOHM / 2)) / RESISTANCE_LSB_UOHM;
+
+		record[i] = (lsb > UINT8_MAX) ? UINT8_MAX : lsb;
+	}
+
+	record[CELL_COUNT] = r0_seeded;
+	record[CELL_COUNT + 1] = r0_seeded >> 8;
+
+	saved_count = estimate_count;
+
+	return eeprom_writeRecord(EEPROM_ADDR_R0, record, sizeof(record));
+}
+
+// CELL_MAX and CELL_AVG summarise the pack, a single high cell is a failing group
+uint32_t resistance_getNominal(batt_cell_E cell)
+{
+	uint32_t r = 0;
+
+	switch (cell)
+	{
+	case CELL_MAX:
+		for (uint32_t i = 0; i < CELL_COUNT; i++)
+		{
+			r = (r0_nominal[i] > r) ? r0_nominal[i] : r;
+		}
+		return r;
+
+	case CELL_AVG:
+		for (uint32_t i = 0; i < CELL_COUNT; i++)
+		{
+			r += r0_nominal[i];
+		}
+		return r / CELL_COUNT;
+
+	default:
+		return (cell < CELL_COUNT) ? r0_nominal[cell] : 0;
+	}
+}
+
+// at the present cell temperature
+uint32_t resistance_getCell(batt_cell_E cell)
+{
+	return (resistance_getNominal(cell) * resistance_tempFactor()) >> 8;
+}
+
+uint32_t resistance_getCount(void)
+{
+	return estimate_count;
+}
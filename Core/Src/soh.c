@@ -0,0 +1,178 @@
+#include "soh.h"
+
+#include <stdlib.h>
+
+#include "battery.h"
+#include "eeprom.h"
+
+#define SOH_MAS_PER_MAH 3600
+#define SOH_NOMINAL_MAS ((int64_t)SOH_NOMINAL_MAH * SOH_MAS_PER_MAH)
+
+#define SOH_SPAN_MAS (SOH_NOMINAL_MAS / 4) // anchors closer than this are mostly ocv error
+#define SOH_CAPACITY_MIN_MAH (SOH_NOMINAL_MAH / 2)
+#define SOH_CAPACITY_MAX_MAH ((SOH_NOMINAL_MAH * 11) / 10)
+#define SOH_FILTER 4
+#define SOH_SAVE_MAH SOH_NOMINAL_MAH // throughput between checkpoints
+#define SOH_CONFIRM_MS 10000
+
+typedef struct
+{
+	uint32_t throughput_mah; // charge and discharge
+	uint16_t capacity_mah;
+	uint8_t learn_count;
+	uint8_t reserved;
+} soh_record_S;
+
+_Static_assert(sizeof(soh_record_S) == EEPROM_SIZE_SOH, "soh record does not match the eeprom map");
+
+static soh_record_S record;
+static uint32_t throughput_mas; // under a mAh
+static uint32_t saved_mah;
+static uint32_t rest_start;
+static uint8_t rested;
+static int64_t charge_total; // mAs taken out since init
+static uint8_t anchor_valid;
+static uint32_t anchor_ocv;
+static int64_t anchor_total;
+static uint32_t candidate_ocv;
+static int64_t candidate_total;
+static uint32_t candidate_tick;
+
+// the charge counted between two rests over the share of the nominal table the
+// ocv moved through is the capacity the pack has now
+static void soh_learn(uint32_t ocv_capacity)
+{
+	int64_t span = (int64_t)anchor_ocv - ocv_capacity;
+
+	if (llabs(span) < SOH_SPAN_MAS)
+	{
+		return;
+	}
+
+	int32_t learned = (((charge_total - anchor_total) * SOH_NOMINAL_MAH) / span);
+
+	// a wrong sign or a wild ratio is a bad anchor, not an aged pack
+	if ((learned < SOH_CAPACITY_MIN_MAH) || (learned > SOH_CAPACITY_MAX_MAH))
+	{
+		return;
+	}
+
+	if (record.learn_count == 0)
+	{
+		record.capacity_mah = learned;
+	}
+	else
+	{
+		record.capacity_mah += (learned - (int32_t)record.capacity_mah) / SOH_FILTER;
+	}
+
+	if (record.learn_count < UINT8_MAX)
+	{
+		record.learn_count++;
+	}
+
+	(void)soh_save();
+}
+
+void soh_init(void)
+{
+	if (eeprom_readRecord(EEPROM_ADDR_SOH, &record, sizeof(record)) != HAL_OK)
+	{
+		record.throughput_mah = 0;
+		record.capacity_mah = SOH_NOMINAL_MAH;
+		record.learn_count = 0;
+		record.reserved = 0;
+	}
+
+	throughput_mas = 0;
+	saved_mah = record.throughput_mah;
+	rest_start = HAL_GetTick();
+	rested = 0;
+	anchor_valid = 0;
+	charge_total = 0;
+}
+
+// charge is the mAs taken out since the last call, ocv_capacity the nominal
+// table read at the present cell voltage
+void soh_update(int32_t charge, uint32_t ocv_capacity)
+{
+	uint32_t now = HAL_GetTick();
+
+	throughput_mas += abs(charge);
+	record.throughput_mah += throughput_mas / SOH_MAS_PER_MAH;
+	throughput_mas %= SOH_MAS_PER_MAH;
+	charge_total += charge;
+
+	if ((record.throughput_mah - saved_mah) >= SOH_SAVE_MAH)
+	{
+		(void)soh_save();
+	}
+
+	if (!batt_isReady() || (abs(batt_getPackCurrent()) > SOH_REST_MA))
+	{
+		rest_start = now;
+		rested = 0;
+		return;
+	}
+
+	if ((now - rest_start) < SOH_REST_MS)
+	{
+		return;
+	}
+
+	if (!rested)
+	{
+		if (anchor_valid)
+		{
+			soh_learn(ocv_capacity);
+		}
+
+		rested = 1;
+		anchor_valid = 1;
+		anchor_ocv = ocv_capacity;
+		anchor_total = charge_total;
+		candidate_ocv = ocv_capacity;
+		candidate_total = charge_total;
+		candidate_tick = now;
+		return;
+	}
+
+	// the anchor follows the rest a confirm period behind, with the current
+	// sampled sparsely the cells can see a load before the current does
+	if ((now - candidate_tick) >= SOH_CONFIRM_MS)
+	{
+		anchor_ocv = candidate_ocv;
+		anchor_total = candidate_total;
+		candidate_ocv = ocv_capacity;
+		candidate_total = charge_total;
+		candidate_tick = now;
+	}
+}
+
+HAL_StatusTypeDef soh_save(void)
+{
+	saved_mah = record.throughput_mah;
+
+	return eeprom_writeRecord(EEPROM_ADDR_SOH, &record, sizeof(record));
+}
+
+uint16_t soh_getCapacity(void)
+{
+	return record.capacity_mah;
+}
+
+uint8_t soh_getPercent(void)
+{
+	return (record.capacity_mah * 100) / SOH_NOMINAL_MAH;
+}
+
+// equivalent full cycles in hundredths, one is a nominal capacity out and back in
+uint32_t soh_getCycles(void)
+{
+	return ((uint64_t)record.throughput_mah * 100) / (2 * SOH_NOMINAL_MAH);
+}
+
+uint8_t soh_getLearnCount(void)
+{
+	return record.learn_count;
+}
@@ -0,0 +1,135 @@
+#include "sop.h"
+
+#include "battery.h"
+#include "resistance.h"
+#include "thermal.h"
+
+// same cell window as DISCHARGE_LIMIT_MV and CHARGE_LIMIT_MV in controller.c
+#define SOP_CELL_MIN_MV 3000
+#define SOP_CELL_MAX_MV 4200
+
+#define SOP_RISE_MA_PER_S 2000 // limits drop at once but recover slowly, the drive never sees a step up
+
+#define SOP_Q8 256
+
+// polarisation adds to r0 the longer a current is held, in q8
+static const int32_t growth_q8[SOP_WINDOW_COUNT] = { 320, 384, 512 };
+
+// ceilings, inside the fuse curves in battery.c from cold. a warm fuse takes
+// the peak windows lower through what is left of its budget
+static const int32_t dsg_cap_ma[SOP_WINDOW_COUNT] = { 35000, 22000, 18000 };
+static const int32_t chg_cap_ma[SOP_WINDOW_COUNT] = { 10000, 8000, 6000 };
+static const uint32_t window_ms[SOP_WINDOW_COUNT] = { 2000, 10000, UINT32_MAX };
+
+static int32_t dsg_limit[SOP_WINDOW_COUNT];
+static int32_t chg_limit[SOP_WINDOW_COUNT];
+static uint32_t last_cell_tick;
+
+// q8, full at or beyond full and zero at or beyond zero
+static int32_t sop_ramp(int32_t value, int32_t full, int32_t zero)
+{
+	int32_t factor = ((value - zero) * SOP_Q8) / (full - zero);
+
+	return (factor < 0) ? 0 : ((factor > SOP_Q8) ? SOP_Q8 : factor);
+}
+
+static int32_t sop_slew(int32_t limit, int32_t target, uint32_t dt)
+{
+	int32_t rise = (SOP_RISE_MA_PER_S * (int32_t)dt) / 1000;
+
+	if (target <= limit)
+	{
+		return target;
+	}
+
+	return ((target - limit) > rise) ? (limit + rise) : target;
+}
+
+void sop_init(void)
+{
+	for (uint32_t i = 0; i < SOP_WINDOW_COUNT; i++)
+	{
+		dsg_limit[i] = 0;
+		chg_limit[i] = 0;
+	}
+
+	last_cell_tick = batt_getCellTick();
+}
+
+// runs once per bq cell read, the weakest cell sets the pack limit
+void sop_update(uint8_t soc)
+{
+	uint32_t cell_tick = batt_getCellTick();
+
+	if (cell_tick == last_cell_tick)
+	{
+		return;
+	}
+
+	uint32_t dt = cell_tick - last_cell_tick;
+	int32_t current = batt_getPackCurrent();
+	int32_t dsg_ma = INT32_MAX;
+	int32_t chg_ma = INT32_MAX;
+
+	last_cell_tick = cell_tick;
+
+	for (uint32_t i = 0; i < CELL_COUNT; i++)
+	{
+		int64_t r = resistance_getCell(i);
+		int64_t ocv = batt_getCellVoltage(i) + ((current * r) / 1000000);
+		int64_t dsg = ((ocv - SOP_CELL_MIN_MV) * 1000000) / r;
+		int64_t chg = ((SOP_CELL_MAX_MV - ocv) * 1000000) / r;
+
+		dsg_ma = (dsg < dsg_ma) ? dsg : dsg_ma;
+		chg_ma = (chg < chg_ma) ? chg : chg_ma;
+	}
+
+	uint8_t t_cold = batt_getTemp(THERMISTOR_1);
+
+	for (uint32_t i = THERMISTOR_2; i <= THERMISTOR_3; i++)
+	{
+		t_cold = (batt_getTemp(i) < t_cold) ? batt_getTemp(i) : t_cold;
+	}
+
+	int32_t dsg_derate = (thermal_getDerate(THERMAL_DISCHARGE) * sop_ramp(soc, 10, 0)) / SOP_Q8;
+	int32_t chg_derate = (((sop_ramp(t_cold, 10, 0) * thermal_getDerate(THERMAL_CHARGE)) / SOP_Q8) * sop_ramp(soc, 95, 100)) / SOP_Q8;
+
+	if (batt_getFetState(FET_DSG) != FET_ON)
+	{
+		dsg_derate = 0;
+	}
+
+	if (batt_getFetState(FET_CHG) != FET_ON)
+	{
+		chg_derate = 0;
+	}
+
+	for (uint32_t w = 0; w < SOP_WINDOW_COUNT; w++)
+	{
+		int32_t dsg = (dsg_ma > 0) ? ((dsg_ma / growth_q8[w]) * SOP_Q8) : 0;
+		int32_t chg = (chg_ma > 0) ? ((chg_ma / growth_q8[w]) * SOP_Q8) : 0;
+
+		int32_t dsg_fuse = batt_getFuseLimit(FET_DSG, window_ms[w]);
+		int32_t chg_fuse = batt_getFuseLimit(FET_CHG, window_ms[w]);
+
+		dsg = (dsg > dsg_cap_ma[w]) ? dsg_cap_ma[w] : dsg;
+		dsg = (dsg > dsg_fuse) ? dsg_fuse : dsg;
+		chg = (chg > chg_cap_ma[w]) ? chg_cap_ma[w] : chg;
+		chg = (chg > chg_fuse) ? chg_fuse : chg;
+
+		dsg_limit[w] = sop_slew(dsg_limit[w], (dsg * dsg_derate) / SOP_Q8, dt);
+		chg_limit[w] = sop_slew(chg_limit[w], (chg * chg_derate) / SOP_Q8, dt);
+	}
+}
+
+// mA the pack can source for the window without a cell crossing its limit
+uint16_t sop_getDischarge(sop_window_E window)
+{
+	return (window < SOP_WINDOW_COUNT) ? dsg_limit[window] : 0;
+}
+
+// mA of regen or charge
+uint16_t sop_getCharge(sop_window_E window)
+{
+	return (window < SOP_WINDOW_COUNT) ? chg_limit[window] : 0;
+}
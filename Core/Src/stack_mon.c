@@ -0,0 +1,75 @@
+#include "stack_mon.h"
+
+#include "stm32l0xx_hal.h"
+
+#define STACK_MON_PATTERN 0xA5A5A5A5
+#define STACK_MON_GUARD_WORDS 16 // left unpainted below the caller's frame
+#define STACK_MON_SCAN_WORDS 64 // per update, a full pass over 4 KB takes 16 loops
+
+#if STACK_MON_ENABLE
+// linker script symbols, everything between the end of .bss and the top of ram
+// is shared by the heap (unused) and the stack growing down into it
+extern uint32_t _ebss;
+extern uint32_t _estack;
+
+static uint32_t *stack_low;
+static uint32_t *stack_cursor;
+#endif
+
+void stack_mon_init(void)
+{
+#if STACK_MON_ENABLE
+	uint32_t *sp = (uint32_t*)__get_MSP() - STACK_MON_GUARD_WORDS;
+
+	for (uint32_t *p = &_ebss; p < sp; p++)
+	{
+		*p = STACK_MON_PATTERN;
+	}
+
+	stack_low = sp;
+	stack_cursor = &_ebss;
+#endif
+}
+
+void stack_mon_update(void)
+{
+#if STACK_MON_ENABLE
+	// walk up from the bottom a few words at a time, the first word that lost
+	// the paint below the previous mark is the new deepest point
+	for (uint32_t i = 0; i < STACK_MON_SCAN_WORDS; i++)
+	{
+		if (stack_cursor >= stack_low)
+		{
+			stack_cursor = &_ebss;
+			return;
+		}
+
+		if (*stack_cursor != STACK_MON_PATTERN)
+		{
+			stack_low = stack_cursor;
+			stack_cursor = &_ebss;
+			return;
+		}
+
+		stack_cursor++;
+	}
+#endif
+}
+
+uint32_t stack_mon_getUsed(void)
+{
+#if STACK_MON_ENABLE
+	return (uint32_t)((uint8_t*)&_estack - (uint8_t*)stack_low);
+#else
+	return 0;
+#endif
+}
+
+uint32_t stack_mon_getFree(void)
+{
+#if STACK_MON_ENABLE
+	return (uint32_t)((uint8_t*)stack_low - (uint8_t*)&_ebss);
+#else
+	return 0;
+#endif
+}
@@ -1,16 +1,18 @@
 #include "tca9534.h"
 
+#include "i2c_trace.h"
+
 #define TCA9534_SET_BIT(bits, bit, value) ((bits & ~(1 << bit)) | (value << bit))
 #define TCA9534_GET_BIT(bits, bit) (bits & (1 << bit))
 
 static HAL_StatusTypeDef TCA9534_readReg(TCA9534_inst_S * inst, uint8_t regAddr, uint8_t *data, uint8_t size)
 {
-	return HAL_I2C_Mem_Read(inst->hi2c, TCA9534_I2C_ADDR << 1, regAddr, 1, data, size, inst->timeout_ms);
+	return i2c_trace_memRead(inst->hi2c, TCA9534_I2C_ADDR << 1, regAddr, 1, data, size, inst->timeout_ms);
 }
 
 static HAL_StatusTypeDef TCA9534_writeReg(TCA9534_inst_S * inst, uint8_t regAddr, uint8_t *data, uint8_t size)
 {
-	return HAL_I2C_Mem_Write(inst->hi2c, TCA9534_I2C_ADDR << 1, regAddr, 1, data, size, inst->timeout_ms);
+	return i2c_trace_memWrite(inst->hi2c, TCA9534_I2C_ADDR << 1, regAddr, 1, data, size, inst->timeout_ms);
 }
 
 HAL_StatusTypeDef TCA9534_init(TCA9534_inst_S *inst, I2C_HandleTypeDef *hi2c, uint32_t timeout_ms)
@@ -78,6 +80,16 @@ HAL_StatusTypeDef TCA9534_update(TCA9534_inst_S *inst)
 	return TCA9534_writeReg(inst, TCA9534_REG_CFG, &inst->config_reg, sizeof(inst->config_reg));
 }
 
+HAL_StatusTypeDef TCA9534_updateOutputs(TCA9534_inst_S *inst)
+{
+	return TCA9534_writeReg(inst, TCA9534_REG_OUT, &inst->output_reg, sizeof(inst->output_reg));
+}
+
+HAL_StatusTypeDef TCA9534_updateInputs(TCA9534_inst_S *inst)
+{
+	return TCA9534_readReg(inst, TCA9534_REG_INP, &inst->input_reg, sizeof(inst->input_reg));
+}
+
 GPIO_PinState TCA9534_readPin(TCA9534_inst_S *inst, TCA9534_channel_E channel)
 {
 	return TCA9534_GET_BIT(inst->input_reg, channel) ? GPIO_PIN_SET : GPIO_PIN_RESET;
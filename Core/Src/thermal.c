@@ -0,0 +1,164 @@
+#include "thermal.h"
+
+#include "battery.h"
+#include "resistance.h"
+
+// one series group of four cells, core to thermistor, tau = c * r = 135 s
+#define THERMAL_CAPACITY_J_PER_K 180
+#define THERMAL_RCS_MK_PER_W 750
+#define THERMAL_HORIZON_Q8 92 // 1 - exp(-60 s / tau), the part of the step the core covers in a minute
+
+#define THERMAL_UC_PER_C 1000000
+#define THERMAL_SURFACE_MS 10000 // smooths the 1 C steps of the thermistor reading
+#define THERMAL_POWER_MS 60000 // the load the prediction assumes carries on
+#define THERMAL_HISTORY_MS 10000
+#define THERMAL_HISTORY_LEN 6 // a minute of surface samples
+#define THERMAL_DT_MAX_MS 1000
+
+// predicted core temperature in C, the fault table trips over temperature at 60 C
+#define THERMAL_DSG_FULL_C 50
+#define THERMAL_DSG_ZERO_C 60
+#define THERMAL_CHG_FULL_C 45
+#define THERMAL_CHG_ZERO_C 55
+
+static int32_t core_uc; // micro C
+static int32_t surface_uc;
+static int32_t predicted_uc;
+static int32_t power_uw; // hottest group, filtered over THERMAL_POWER_MS
+static int32_t history_uc[THERMAL_HISTORY_LEN];
+static uint8_t history_head;
+static uint32_t history_tick;
+static uint32_t last_tick;
+static uint8_t seeded;
+
+static uint16_t thermal_ramp(int32_t temp_uc, int32_t full_c, int32_t zero_c)
+{
+	int64_t full = (int64_t)full_c * THERMAL_UC_PER_C;
+	int64_t zero = (int64_t)zero_c * THERMAL_UC_PER_C;
+
+	if (temp_uc <= full)
+	{
+		return THERMAL_DERATE_FULL;
+	}
+
+	if (temp_uc >= zero)
+	{
+		return 0;
+	}
+
+	return ((zero - temp_uc) * THERMAL_DERATE_FULL) / (zero - full);
+}
+
+static void thermal_seed(int32_t surface)
+{
+	core_uc = surface;
+	surface_uc = surface;
+	predicted_uc = surface;
+	power_uw = 0;
+
+	for (uint32_t i = 0; i < THERMAL_HISTORY_LEN; i++)
+	{
+		history_uc[i] = surface;
+	}
+
+	history_head = 0;
+	history_tick = HAL_GetTick();
+	seeded = 1;
+}
+
+void thermal_init(void)
+{
+	seeded = 0;
+	last_tick = HAL_GetTick();
+}
+
+void thermal_update(void)
+{
+	uint32_t now = HAL_GetTick();
+	uint32_t dt = now - last_tick;
+
+	last_tick = now;
+
+	if (!batt_isReady())
+	{
+		return;
+	}
+
+	int32_t measured = batt_getTemp(TEMP_MAX) * THERMAL_UC_PER_C;
+
+	if (!seeded)
+	{
+		thermal_seed(measured);
+		return;
+	}
+
+	dt = (dt > THERMAL_DT_MAX_MS) ? THERMAL_DT_MAX_MS : dt;
+
+	// the group with the highest resistance heats fastest and sits next to the hottest sensor at worst
+	uint32_t r_max = 0;
+
+	for (uint32_t i = 0; i < CELL_COUNT; i++)
+	{
+		uint32_t r = resistance_getCell(i);
+
+		r_max = (r > r_max) ? r : r_max;
+	}
+
+	int64_t current = batt_getPackCurrent();
+	int32_t heat_mw = (current * current * r_max) / 1000000000;
+
+	surface_uc += ((int64_t)(measured - surface_uc) * dt) / THERMAL_SURFACE_MS;
+	power_uw += ((int64_t)((heat_mw * 1000) - power_uw) * dt) / THERMAL_POWER_MS;
+
+	int32_t flow_mw = (core_uc - surface_uc) / THERMAL_RCS_MK_PER_W;
+
+	// mW * ms over J/K is micro C
+	core_uc += ((int64_t)(heat_mw - flow_mw) * dt) / THERMAL_CAPACITY_J_PER_K;
+
+	if ((now - history_tick) >= THERMAL_HISTORY_MS)
+	{
+		history_tick = now;
+		history_uc[history_head] = surface_uc;
+		history_head = (history_head + 1) % THERMAL_HISTORY_LEN;
+	}
+
+	// the surface keeps rising as it did over the last minute, falling is not counted on
+	int32_t rise = surface_uc - history_uc[history_head];
+	int32_t surface_next = surface_uc + ((rise > 0) ? rise : 0);
+	int32_t steady = surface_next + (((int64_t)power_uw * THERMAL_RCS_MK_PER_W) / 1000);
+	int32_t core_next = core_uc + (((int64_t)(steady - core_uc) * THERMAL_HORIZON_Q8) / THERMAL_DERATE_FULL);
+
+	// heat from outside reaches the thermistor before the core
+	predicted_uc = (core_next > surface_next) ? core_next : surface_next;
+}
+
+// 0.1 C
+int16_t thermal_getCore(void)
+{
+	return core_uc / (THERMAL_UC_PER_C / 10);
+}
+
+// hottest of core and surface a minute ahead at the present load
+int16_t thermal_getPredicted(void)
+{
+	return predicted_uc / (THERMAL_UC_PER_C / 10);
+}
+
+// q8 factor on the current limits, rides on whichever is hotter of now and a minute ahead
+uint16_t thermal_getDerate(thermal_dir_E dir)
+{
+	if (!seeded)
+	{
+		return THERMAL_DERATE_FULL;
+	}
+
+	// a cooling core still has to get there
+	int32_t temp = (predicted_uc > core_uc) ? predicted_uc : core_uc;
+
+	if (dir == THERMAL_CHARGE)
+	{
+		return thermal_ramp(temp, THERMAL_CHG_FULL_C, THERMAL_CHG_ZERO_C);
+	}
+
+	return thermal_ramp(temp, THERMAL_DSG_FULL_C, THERMAL_DSG_ZERO_C);
+}
@@ -0,0 +1,198 @@
+#include "usage.h"
+
+#include <string.h>
+
+#include "battery.h"
+#include "eeprom.h"
+
+#define USAGE_VOLTAGE_BINS 8
+#define USAGE_TEMP_BINS 8
+#define USAGE_CURRENT_BINS 8
+#define USAGE_SOC_BINS 6
+#define USAGE_BINS (USAGE_VOLTAGE_BINS + USAGE_TEMP_BINS + USAGE_CURRENT_BINS + USAGE_SOC_BINS)
+
+#define USAGE_COUNT_BYTES 3
+#define USAGE_STAGE_WORDS ((EEPROM_SIZE_USAGE / 4) + 1) // the record and its trailer
+
+typedef struct
+{
+	const int32_t *bounds; // lower edge of every bin but the first
+	uint8_t bins;
+	uint8_t first;
+} usage_histDef_S;
+
+static const int32_t voltage_bounds[USAGE_VOLTAGE_BINS - 1] = { 3000, 3300, 3500, 3700, 3900, 4050, 4150 }; // mV
+static const int32_t temp_bounds[USAGE_TEMP_BINS - 1] = { 10, 20, 30, 40, 45, 50, 60 }; // C
+static const int32_t current_bounds[USAGE_CURRENT_BINS - 1] = { -5000, -1000, 1000, 5000, 10000, 15000, 20000 }; // mA, discharge positive
+static const int32_t soc_bounds[USAGE_SOC_BINS - 1] = { 10, 30, 50, 70, 90 }; // %
+
+static const usage_histDef_S usage_hist[USAGE_COUNT] =
+{
+	[USAGE_VOLTAGE] = { voltage_bounds, USAGE_VOLTAGE_BINS, 0 },
+	[USAGE_TEMP] = { temp_bounds, USAGE_TEMP_BINS, USAGE_VOLTAGE_BINS },
+	[USAGE_CURRENT] = { current_bounds, USAGE_CURRENT_BINS, USAGE_VOLTAGE_BINS + USAGE_TEMP_BINS },
+	[USAGE_SOC] = { soc_bounds, USAGE_SOC_BINS, USAGE_VOLTAGE_BINS + USAGE_TEMP_BINS + USAGE_CURRENT_BINS },
+};
+
+_Static_assert((USAGE_BINS * USAGE_COUNT_BYTES) <= EEPROM_SIZE_USAGE, "usage counters do not fit the eeprom map");
+
+static uint32_t usage_seconds[USAGE_BINS];
+static uint32_t usage_ms;
+static uint32_t last_tick;
+static uint32_t last_checkpoint;
+static uint32_t stage[USAGE_STAGE_WORDS];
+static uint8_t stage_pos;
+
+// at most bins - 1 compares and no division, cheap enough for the sample rate
+static uint8_t usage_bin(const usage_histDef_S *hist, int32_t value)
+{
+	uint8_t bin = 0;
+
+	while ((bin < (hist->bins - 1)) && (value >= hist->bounds[bin]))
+	{
+		bin++;
+	}
+
+	return bin;
+}
+
+static void usage_add(usage_hist_E hist, int32_t value, uint32_t seconds)
+{
+	uint32_t *count = &usage_seconds[usage_hist[hist].first + usage_bin(&usage_hist[hist], value)];
+
+	*count = ((USAGE_COUNT_MAX - *count) < seconds) ? USAGE_COUNT_MAX : (*count + seconds);
+}
+
+void usage_init(void)
+{
+	uint8_t packed[EEPROM_SIZE_USAGE];
+
+	memset(usage_seconds, 0, sizeof(usage_seconds));
+
+	// a blank or corrupt record starts the histograms over
+	if (eeprom_readRecord(EEPROM_ADDR_USAGE, packed, sizeof(packed)) == HAL_OK)
+	{
+		for (uint32_t i = 0; i < USAGE_BINS; i++)
+		{
+			const uint8_t *bytes = &packed[i * USAGE_COUNT_BYTES];
+
+			usage_seconds[i] = bytes[0] | (bytes[1] << 8) | ((uint32_t)bytes[2] << 16);
+		}
+	}
+
+	usage_ms = 0;
+	last_tick = HAL_GetTick();
+	last_checkpoint = last_tick;
+	stage_pos = USAGE_STAGE_WORDS;
+}
+
+void usage_update(uint8_t soc)
+{
+	uint32_t now = HAL_GetTick();
+	uint32_t seconds = 0;
+
+	usage_ms += now - last_tick;
+	last_tick = now;
+
+	// whole seconds only, the values at the boundary stand for the second before it
+	while (usage_ms >= 1000)
+	{
+		usage_ms -= 1000;
+		seconds++;
+	}
+
+	// the afe reads zeros until it is up
+	if ((seconds == 0) || !batt_isReady())
+	{
+		return;
+	}
+
+	usage_add(USAGE_VOLTAGE, batt_getCellVoltage(CELL_MAX), seconds);
+	usage_add(USAGE_TEMP, batt_getTemp(TEMP_MAX), seconds);
+	usage_add(USAGE_CURRENT, batt_getPackCurrent(), seconds);
+	usage_add(USAGE_SOC, soc, seconds);
+
+	if ((now - last_checkpoint) >= USAGE_CHECKPOINT_MS)
+	{
+		usage_requestCheckpoint();
+	}
+}
+
+static void usage_pack(uint8_t *packed)
+{
+	memset(packed, 0, EEPROM_SIZE_USAGE);
+
+	for (uint32_t i = 0; i < USAGE_BINS; i++)
+	{
+		uint8_t *bytes = &packed[i * USAGE_COUNT_BYTES];
+
+		bytes[0] = usage_seconds[i];
+		bytes[1] = usage_seconds[i] >> 8;
+		bytes[2] = usage_seconds[i] >> 16;
+	}
+}
+
+// the counters as they are now go out a word at a time through usage_service
+void usage_requestCheckpoint(void)
+{
+	usage_pack((uint8_t *)stage);
+
+	stage[USAGE_STAGE_WORDS - 1] = eeprom_recordTrailer(stage, EEPROM_SIZE_USAGE);
+	stage_pos = 0;
+	last_checkpoint = HAL_GetTick();
+}
+
+// at most one changed word per call, each one stalls the core for ~3 ms.
+// returns 1 when it programmed one
+uint8_t usage_service(void)
+{
+	while (stage_pos < USAGE_STAGE_WORDS)
+	{
+		uint32_t addr = EEPROM_ADDR_USAGE + (stage_pos * 4);
+		uint32_t stored;
+
+		stage_pos++;
+
+		// unchanged words are skipped, a checkpoint only wears the bins that moved
+		if ((eeprom_read(addr, &stored, sizeof(stored)) == HAL_OK) && (stored == stage[stage_pos - 1]))
+		{
+			continue;
+		}
+
+		// a failed word leaves the trailer stale, the next checkpoint writes it all again
+		(void)eeprom_write(addr, &stage[stage_pos - 1], sizeof(stage[0]));
+
+		return 1;
+	}
+
+	return 0;
+}
+
+// blocks for every changed word, only for the shutdown path
+HAL_StatusTypeDef usage_checkpoint(void)
+{
+	uint8_t packed[EEPROM_SIZE_USAGE];
+
+	usage_pack(packed);
+
+	stage_pos = USAGE_STAGE_WORDS;
+	last_checkpoint = HAL_GetTick();
+
+	// unchanged words are skipped, a checkpoint only wears the bins that moved
+	return eeprom_writeRecord(EEPROM_ADDR_USAGE, packed, sizeof(packed));
+}
+
+uint8_t usage_getBinCount(usage_hist_E hist)
+{
+	return usage_hist[hist].bins;
+}
+
+uint32_t usage_getSeconds(usage_hist_E hist, uint8_t bin)
+{
+	if (bin >= usage_hist[hist].bins)
+	{
+		return 0;
+	}
+
+	return usage_seconds[usage_hist[hist].first + bin];
+}
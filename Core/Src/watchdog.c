@@ -0,0 +1,165 @@
+#include "watchdog.h"
+
+#include "stm32l0xx_hal.h"
+
+#define WATCHDOG_NOINIT_MAGIC 0x57444F47
+
+#define IWDG_KEY_RELOAD 0xAAAA
+#define IWDG_KEY_ENABLE 0xCCCC
+#define IWDG_KEY_WRITE_ACCESS 0x5555
+
+#define IWDG_LSI_HZ 37000
+#define IWDG_PRESCALER 4 // /64
+#define IWDG_PRESCALER_DIV 64
+#define IWDG_RELOAD ((WATCHDOG_TIMEOUT_MS * (IWDG_LSI_HZ / IWDG_PRESCALER_DIV)) / 1000)
+
+#define IWDG_STANDBY_PRESCALER 6 // /256, with the longest reload about 28 s
+#define IWDG_STANDBY_RELOAD 0xFFF
+
+#define IWDG_UPDATE_TIMEOUT 1000
+
+#define WATCHDOG_SET_BIT(bits, bit, value) ((bits) |= ((value) ? (1 << (bit)) : 0))
+
+// survives every reset but a power cycle, the startup code leaves it alone
+typedef struct
+{
+	uint32_t magic;
+	uint8_t task; // last task to check in
+	uint8_t stalled; // task the supervisor saw miss its deadline
+	uint16_t resets;
+} watchdog_noinit_S;
+
+static watchdog_noinit_S watchdog_noinit __attribute__((section(".noinit")));
+
+static const uint16_t task_deadline_ms[WATCHDOG_TASK_COUNT] = {
+	[WATCHDOG_TASK_SAMPLE] = 50,
+	[WATCHDOG_TASK_UPDATE] = 250,
+	[WATCHDOG_TASK_CONTROL] = 250,
+	[WATCHDOG_TASK_TELEMETRY] = 250,
+};
+
+static uint32_t task_checkin_time[WATCHDOG_TASK_COUNT];
+
+static uint8_t reset_flags;
+static uint8_t reset_task;
+
+static void watchdog_configure(uint32_t prescaler, uint32_t reload)
+{
+	IWDG->KR = IWDG_KEY_WRITE_ACCESS;
+	IWDG->PR = prescaler;
+	IWDG->RLR = reload;
+
+	// bounded, a stuck lsi ends up in the reset we are arming anyway
+	for (uint32_t i = 0; (i < IWDG_UPDATE_TIMEOUT) && (IWDG->SR != 0); i++)
+	{
+	}
+
+	IWDG->KR = IWDG_KEY_RELOAD;
+}
+
+void watchdog_init(void)
+{
+	reset_flags = 0;
+
+	WATCHDOG_SET_BIT(reset_flags, WATCHDOG_RESET_POWER, __HAL_RCC_GET_FLAG(RCC_FLAG_PORRST));
+	WATCHDOG_SET_BIT(reset_flags, WATCHDOG_RESET_PIN, __HAL_RCC_GET_FLAG(RCC_FLAG_PINRST));
+	WATCHDOG_SET_BIT(reset_flags, WATCHDOG_RESET_SOFTWARE, __HAL_RCC_GET_FLAG(RCC_FLAG_SFTRST));
+	WATCHDOG_SET_BIT(reset_flags, WATCHDOG_RESET_IWDG, __HAL_RCC_GET_FLAG(RCC_FLAG_IWDGRST));
+	WATCHDOG_SET_BIT(reset_flags, WATCHDOG_RESET_LOW_POWER, __HAL_RCC_GET_FLAG(RCC_FLAG_LPWRRST));
+	WATCHDOG_SET_BIT(reset_flags, WATCHDOG_RESET_STANDBY, __HAL_PWR_GET_FLAG(PWR_FLAG_SB));
+	WATCHDOG_SET_BIT(reset_flags, WATCHDOG_RESET_WAKEUP, __HAL_PWR_GET_FLAG(PWR_FLAG_WU));
+
+	__HAL_RCC_CLEAR_RESET_FLAGS();
+
+	if ((watchdog_noinit.magic != WATCHDOG_NOINIT_MAGIC) || (reset_flags & (1 << WATCHDOG_RESET_POWER)))
+	{
+		watchdog_noinit.magic = WATCHDOG_NOINIT_MAGIC;
+		watchdog_noinit.task = WATCHDOG_TASK_NONE;
+		watchdog_noinit.stalled = WATCHDOG_TASK_NONE;
+		watchdog_noinit.resets = 0;
+	}
+
+	// the timeouts that wake us from standby are expected, they are not hangs
+	if ((reset_flags & (1 << WATCHDOG_RESET_IWDG)) && !watchdog_isStandbyTimeout())
+	{
+		watchdog_noinit.resets++;
+	}
+
+	reset_task = (watchdog_noinit.stalled << 4) | (watchdog_noinit.task & 0xF);
+
+	watchdog_noinit.task = WATCHDOG_TASK_NONE;
+	watchdog_noinit.stalled = WATCHDOG_TASK_NONE;
+}
+
+void watchdog_start(void)
+{
+	watchdog_restartDeadlines();
+
+	IWDG->KR = IWDG_KEY_ENABLE;
+
+	watchdog_configure(IWDG_PRESCALER, IWDG_RELOAD);
+}
+
+// every task starts a fresh deadline, for deliberate blocking calls like a calibration capture
+void watchdog_restartDeadlines(void)
+{
+	for (uint32_t i = 0; i < WATCHDOG_TASK_COUNT; i++)
+	{
+		task_checkin_time[i] = HAL_GetTick();
+	}
+}
+
+void watchdog_checkIn(watchdog_task_E task)
+{
+	task_checkin_time[task] = HAL_GetTick();
+
+	watchdog_noinit.task = task;
+}
+
+void watchdog_kick(void)
+{
+	uint32_t now = HAL_GetTick();
+
+	for (uint32_t i = 0; i < WATCHDOG_TASK_COUNT; i++)
+	{
+		if ((now - task_checkin_time[i]) > task_deadline_ms[i])
+		{
+			// stop feeding, the iwdg takes it from here
+			watchdog_noinit.stalled = i;
+			return;
+		}
+	}
+
+	// a deadline missed and caught up on, a blocking eeprom write say, is not what a later reset was about
+	watchdog_noinit.stalled = WATCHDOG_TASK_NONE;
+
+	IWDG->KR = IWDG_KEY_RELOAD;
+}
+
+void watchdog_prepareStandby(void)
+{
+	// the iwdg cannot be stopped and keeps counting in standby
+	watchdog_configure(IWDG_STANDBY_PRESCALER, IWDG_STANDBY_RELOAD);
+}
+
+uint8_t watchdog_getResetFlags(void)
+{
+	return reset_flags;
+}
+
+uint8_t watchdog_getResetTask(void)
+{
+	return reset_task;
+}
+
+uint16_t watchdog_getResetCount(void)
+{
+	return watchdog_noinit.resets;
+}
+
+uint8_t watchdog_isStandbyTimeout(void)
+{
+	uint8_t mask = (1 << WATCHDOG_RESET_IWDG) | (1 << WATCHDOG_RESET_STANDBY) | (1 << WATCHDOG_RESET_WAKEUP);
+
+	return (reset_flags & mask) == ((1 << WATCHDOG_RESET_IWDG) | (1 << WATCHDOG_RESET_STANDBY));
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "fake_devices.h"
+
+#include "battery.h"
+#include "bq76930.h"
+#include "controller.h"
+
+// Host timings are only useful relative to each other, the i2c transaction
+// counts carry over to the target directly.
+
+#define BENCH_SIM_MS 10000
+
+extern I2C_HandleTypeDef hi2c1;
+
+static fake_board_S board;
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void bench_report(const char *name, uint64_t ns, uint32_t calls, uint32_t i2c)
+{
+	printf("%-28s %8u calls %10.1f ns/call %8.2f i2c/call\n", name, calls, (double)ns / calls, (double)i2c / calls);
+}
+
+static void bench_controllerRun(const char *name, uint16_t current_adc)
+{
+	fake_board_init(&board);
+	fake_hal_setTick(1000);
+
+	controller_init();
+
+	// settle into idle before measuring
+	for (uint32_t i = 0; i < 2000; i++)
+	{
+		fake_hal_advanceTick(1);
+		controller_run();
+	}
+
+	fake_board_setSense(&board, 0, current_adc);
+
+	uint32_t i2c = fake_hal_getI2CCount();
+	uint64_t start = bench_now();
+
+	for (uint32_t i = 0; i < BENCH_SIM_MS; i++)
+	{
+		fake_hal_advanceTick(1);
+		controller_run();
+	}
+
+	bench_report(name, bench_now() - start, BENCH_SIM_MS, fake_hal_getI2CCount() - i2c);
+}
+
+static void bench_bq76930Update(void)
+{
+	BQ76930_inst_S bq;
+	BQ76930_config_S config = { .scd_thresh = 3, .ocd_thresh = 5, .ov_thresh = 4200, .uv_thresh = 2000 };
+	const uint32_t calls = 10000;
+
+	fake_board_init(&board);
+
+	(void)BQ76930_init(&bq, &hi2c1, &config, 10);
+
+	uint32_t i2c = fake_hal_getI2CCount();
+	uint64_t start = bench_now();
+
+	for (uint32_t i = 0; i < calls; i++)
+	{
+		(void)BQ76930_update(&bq);
+	}
+
+	bench_report("BQ76930_update", bench_now() - start, calls, fake_hal_getI2CCount() - i2c);
+}
+
+static void bench_battUpdate(void)
+{
+	const uint32_t calls = 10000;
+
+	fake_board_init(&board);
+	fake_hal_setTick(1000);
+
+	batt_init();
+
+	uint32_t i2c = fake_hal_getI2CCount();
+	uint64_t start = bench_now();
+
+	for (uint32_t i = 0; i < calls; i++)
+	{
+		fake_hal_advanceTick(100);
+		batt_update();
+	}
+
+	bench_report("batt_update", bench_now() - start, calls, fake_hal_getI2CCount() - i2c);
+}
+
+int main(void)
+{
+	bench_bq76930Update();
+	bench_battUpdate();
+	bench_controllerRun("controller_run idle", 2029);
+	bench_controllerRun("controller_run discharge", 2029 + 100);
+
+	return 0;
+}
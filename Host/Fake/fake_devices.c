@@ -0,0 +1,298 @@
+#include "fake_devices.h"
+
+#include <string.h>
+
+#include "adc121.h"
+#include "bq76930.h"
+#include "tca9534.h"
+
+// adc gain and offset the bq76930 driver assumes
+#define BQ_ADC_GAIN_UV 377
+#define BQ_ADC_OFFSET_MV 46
+
+#define TMUX_SEL_SHIFT 3
+#define TCA_BQ_ALERT 7
+
+uint8_t fake_bq76930_crc8(const uint8_t *data, uint32_t len)
+{
+	uint8_t crc = 0;
+
+	for (uint32_t i = 0; i < len; i++)
+	{
+		crc ^= data[i];
+
+		for (uint32_t j = 0; j < 8; j++)
+		{
+			crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+static HAL_StatusTypeDef fake_bq76930_read(void *ctx, uint8_t reg, uint8_t *data, uint16_t size)
+{
+	fake_bq76930_S *bq = ctx;
+
+	// every data byte is followed by a crc, the first one also covers the address
+	for (uint16_t i = 0; (i + 1) < size; i += 2)
+	{
+		uint8_t value = ((reg + (i / 2)) < FAKE_BQ76930_REG_COUNT) ? bq->regs[reg + (i / 2)] : 0;
+
+		if (i == 0)
+		{
+			uint8_t buf[2] = { (BQ76930_I2C_ADDR << 1) | 1, value };
+
+			data[1] = fake_bq76930_crc8(buf, 2);
+		}
+		else
+		{
+			data[i + 1] = fake_bq76930_crc8(&value, 1);
+		}
+
+		data[i] = value;
+
+		if (bq->crc_error)
+		{
+			data[i + 1] ^= 0xFF;
+		}
+	}
+
+	return HAL_OK;
+}
+
+static HAL_StatusTypeDef fake_bq76930_write(void *ctx, uint8_t reg, const uint8_t *data, uint16_t size)
+{
+	fake_bq76930_S *bq = ctx;
+
+	uint8_t buf[3] = { BQ76930_I2C_ADDR << 1, reg, data[0] };
+
+	if ((size != 2) || (reg >= FAKE_BQ76930_REG_COUNT) || (fake_bq76930_crc8(buf, 3) != data[1]))
+	{
+		bq->write_errors++;
+		return HAL_ERROR;
+	}
+
+	if (reg == BQ76930_REG_SYS_STAT)
+	{
+		// write one to clear
+		bq->regs[reg] &= ~data[0];
+	}
+	else
+	{
+		bq->regs[reg] = data[0];
+	}
+
+	return HAL_OK;
+}
+
+static HAL_StatusTypeDef fake_tca9534_read(void *ctx, uint8_t reg, uint8_t *data, uint16_t size)
+{
+	fake_tca9534_S *tca = ctx;
+
+	// alert is high while any sys_stat flag is latched
+	tca->regs[TCA9534_REG_INP] = (tca->alert->regs[BQ76930_REG_SYS_STAT] & 0x3F) ? (1 << TCA_BQ_ALERT) : 0;
+
+	for (uint16_t i = 0; i < size; i++)
+	{
+		data[i] = tca->regs[(reg + i) % FAKE_TCA9534_REG_COUNT];
+	}
+
+	return HAL_OK;
+}
+
+static HAL_StatusTypeDef fake_tca9534_write(void *ctx, uint8_t reg, const uint8_t *data, uint16_t size)
+{
+	fake_tca9534_S *tca = ctx;
+
+	for (uint16_t i = 0; i < size; i++)
+	{
+		if (((reg + i) % FAKE_TCA9534_REG_COUNT) != TCA9534_REG_INP)
+		{
+			tca->regs[(reg + i) % FAKE_TCA9534_REG_COUNT] = data[i];
+		}
+	}
+
+	return HAL_OK;
+}
+
+static uint16_t fake_adc121_convert(fake_adc121_S *adc)
+{
+	uint8_t mux = (adc->mux->regs[TCA9534_REG_OUT] >> TMUX_SEL_SHIFT) & 3;
+	uint16_t value = adc->input[mux] & 0x0FFF;
+
+	adc->conversions++;
+
+	if (value < adc->lowest)
+	{
+		adc->lowest = value;
+	}
+
+	if (value > adc->highest)
+	{
+		adc->highest = value;
+	}
+
+	if (adc->config & (1 << ADC121_REG_CFG_ALERT_FLAG))
+	{
+		if (value > adc->alert_high)
+		{
+			adc->status |= (1 << ADC121_REG_STS_OVER);
+		}
+
+		if (value < adc->alert_low)
+		{
+			adc->status |= (1 << ADC121_REG_STS_UNDER);
+		}
+	}
+
+	return value;
+}
+
+static uint16_t *fake_adc121_reg16(fake_adc121_S *adc, uint8_t reg)
+{
+	switch (reg)
+	{
+	case ADC121_REG_ALERT_LOW: return &adc->alert_low;
+	case ADC121_REG_ALERT_HIGH: return &adc->alert_high;
+	case ADC121_REG_HYST: return &adc->hyst;
+	case ADC121_REG_LOWEST: return &adc->lowest;
+	case ADC121_REG_HIGHEST: return &adc->highest;
+	default: return NULL;
+	}
+}
+
+static HAL_StatusTypeDef fake_adc121_read(void *ctx, uint8_t reg, uint8_t *data, uint16_t size)
+{
+	fake_adc121_S *adc = ctx;
+	uint16_t *reg16 = fake_adc121_reg16(adc, reg);
+
+	if ((reg == ADC121_REG_RES) && (size == 2))
+	{
+		uint16_t value = fake_adc121_convert(adc);
+
+		if (adc->status)
+		{
+			value |= (1 << ADC121_REG_RES_ALERT);
+		}
+
+		data[0] = value >> 8;
+		data[1] = value & 0xFF;
+	}
+	else if (reg == ADC121_REG_STS)
+	{
+		data[0] = adc->status;
+	}
+	else if (reg == ADC121_REG_CFG)
+	{
+		data[0] = adc->config;
+	}
+	else if ((reg16 != NULL) && (size == 2))
+	{
+		data[0] = *reg16 >> 8;
+		data[1] = *reg16 & 0xFF;
+	}
+	else
+	{
+		return HAL_ERROR;
+	}
+
+	return HAL_OK;
+}
+
+static HAL_StatusTypeDef fake_adc121_write(void *ctx, uint8_t reg, const uint8_t *data, uint16_t size)
+{
+	fake_adc121_S *adc = ctx;
+	uint16_t *reg16 = fake_adc121_reg16(adc, reg);
+
+	if (reg == ADC121_REG_STS)
+	{
+		adc->status &= ~data[0];
+	}
+	else if (reg == ADC121_REG_CFG)
+	{
+		adc->config = data[0];
+	}
+	else if ((reg16 != NULL) && (size == 2))
+	{
+		*reg16 = ((uint16_t)(data[0] << 8) | data[1]) & 0x0FFF;
+	}
+	else
+	{
+		return HAL_ERROR;
+	}
+
+	return HAL_OK;
+}
+
+void fake_board_init(fake_board_S *board)
+{
+	memset(board, 0, sizeof(fake_board_S));
+
+	fake_hal_reset();
+
+	board->adc.mux = &board->tca;
+	board->tca.alert = &board->bq;
+	board->adc.lowest = 0x0FFF;
+	board->adc.alert_high = 0x0FFF;
+	board->tca.regs[TCA9534_REG_OUT] = 0xFF;
+	board->tca.regs[TCA9534_REG_CFG] = 0xFF;
+
+	// nominal pack, 3.7 V cells at 25 C with no current
+	fake_board_setCellVoltages(board, 3700);
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		fake_board_setThermistor(board, i, 10000);
+	}
+
+	fake_board_setSense(board, 0, 2029);
+	fake_board_setSense(board, 1, 2048);
+	fake_board_setSense(board, 2, 3201);
+	fake_board_setSense(board, 3, 0);
+
+	fake_hal_attachI2C(BQ76930_I2C_ADDR, fake_bq76930_read, fake_bq76930_write, &board->bq);
+	fake_hal_attachI2C(TCA9534_I2C_ADDR, fake_tca9534_read, fake_tca9534_write, &board->tca);
+	fake_hal_attachI2C(ADC121_I2C_ADDR, fake_adc121_read, fake_adc121_write, &board->adc);
+}
+
+void fake_board_setCellVoltage(fake_board_S *board, uint32_t bq_cell, uint16_t mv)
+{
+	uint16_t raw = (1000 * ((int32_t)mv - BQ_ADC_OFFSET_MV)) / BQ_ADC_GAIN_UV;
+
+	board->bq.regs[BQ76930_REG_VC1_HI + (2 * bq_cell)] = (raw >> 8) & 0x3F;
+	board->bq.regs[BQ76930_REG_VC1_LO + (2 * bq_cell)] = raw & 0xFF;
+}
+
+void fake_board_setCellVoltages(fake_board_S *board, uint16_t mv)
+{
+	for (uint32_t i = 0; i < BQ76930_CELL_COUNT; i++)
+	{
+		fake_board_setCellVoltage(board, i, mv);
+	}
+}
+
+void fake_board_setThermistor(fake_board_S *board, uint32_t ts, uint32_t ohm)
+{
+	// 10k pullup from 3.3 V
+	uint32_t mv = (3300 * ohm) / (10000 + ohm);
+	uint16_t raw = (1000 * ((int32_t)mv - BQ_ADC_OFFSET_MV)) / BQ_ADC_GAIN_UV;
+
+	board->bq.regs[BQ76930_REG_TS1_HI + (2 * ts)] = (raw >> 8) & 0x3F;
+	board->bq.regs[BQ76930_REG_TS1_LO + (2 * ts)] = raw & 0xFF;
+}
+
+void fake_board_setSense(fake_board_S *board, uint32_t mux, uint16_t adc)
+{
+	board->adc.input[mux] = adc;
+}
+
+uint8_t fake_board_getMux(const fake_board_S *board)
+{
+	return (board->tca.regs[TCA9534_REG_OUT] >> TMUX_SEL_SHIFT) & 3;
+}
+
+uint8_t fake_board_getOutput(const fake_board_S *board, uint32_t channel)
+{
+	return (board->tca.regs[TCA9534_REG_OUT] >> channel) & 1;
+}
@@ -0,0 +1,59 @@
+#ifndef __FAKE_DEVICES_H__
+#define __FAKE_DEVICES_H__
+
+#include "fake_hal.h"
+
+// Register level stand-ins for the three i2c parts on the board. The adc121
+// input follows the tmux select lines on the tca9534 the same way the
+// board is wired, and the bq alert pin is read back through the tca9534.
+
+#define FAKE_BQ76930_REG_COUNT 0x60
+#define FAKE_TCA9534_REG_COUNT 4
+#define FAKE_ADC121_MUX_COUNT 4
+
+typedef struct
+{
+	uint8_t regs[FAKE_BQ76930_REG_COUNT];
+	uint8_t crc_error; // corrupt the crc of every read while set
+	uint32_t write_errors;
+} fake_bq76930_S;
+
+typedef struct
+{
+	uint8_t regs[FAKE_TCA9534_REG_COUNT];
+	const fake_bq76930_S *alert; // drives the bq alert input
+} fake_tca9534_S;
+
+typedef struct
+{
+	uint8_t config;
+	uint8_t status;
+	uint16_t alert_low;
+	uint16_t alert_high;
+	uint16_t hyst;
+	uint16_t lowest;
+	uint16_t highest;
+	uint16_t input[FAKE_ADC121_MUX_COUNT];
+	uint32_t conversions;
+	const fake_tca9534_S *mux;
+} fake_adc121_S;
+
+typedef struct
+{
+	fake_bq76930_S bq;
+	fake_tca9534_S tca;
+	fake_adc121_S adc;
+} fake_board_S;
+
+void fake_board_init(fake_board_S *board);
+
+void fake_board_setCellVoltage(fake_board_S *board, uint32_t bq_cell, uint16_t mv);
+void fake_board_setCellVoltages(fake_board_S *board, uint16_t mv);
+void fake_board_setThermistor(fake_board_S *board, uint32_t ts, uint32_t ohm);
+void fake_board_setSense(fake_board_S *board, uint32_t mux, uint16_t adc);
+uint8_t fake_board_getMux(const fake_board_S *board);
+uint8_t fake_board_getOutput(const fake_board_S *board, uint32_t channel);
+
+uint8_t fake_bq76930_crc8(const uint8_t *data, uint32_t len);
+
+#endif // __FAKE_DEVICES_H__
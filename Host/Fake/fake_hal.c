@@ -0,0 +1,400 @@
+#include "fake_hal.h"
+
+#include <string.h>
+
+#define FAKE_HAL_I2C_ADDR_COUNT 128
+
+typedef struct
+{
+	fake_hal_i2cRead_F read;
+	fake_hal_i2cWrite_F write;
+	void *ctx;
+} fake_hal_i2cDevice_S;
+
+GPIO_TypeDef fake_hal_gpio[3];
+uint8_t fake_hal_eeprom[FAKE_HAL_EEPROM_SIZE];
+uint8_t fake_hal_flash[FAKE_HAL_FLASH_SIZE];
+
+I2C_HandleTypeDef hi2c1;
+UART_HandleTypeDef hlpuart1;
+SysTick_Type fake_hal_systick;
+IWDG_TypeDef fake_hal_iwdg;
+uint32_t SystemCoreClock = 4000000;
+
+static uint32_t tick;
+static fake_hal_i2cDevice_S i2c_devices[FAKE_HAL_I2C_ADDR_COUNT];
+static uint32_t i2c_count;
+static uint8_t uart_buf[FAKE_HAL_UART_BUF_SIZE];
+static uint32_t uart_len;
+static uint32_t uart_count;
+static fake_hal_uartSink_F uart_sink;
+static void *uart_sink_ctx;
+static uint8_t *uart_rx;
+static uint32_t standby_count;
+static uint32_t pwr_flags;
+static uint32_t reset_flags;
+static uint8_t eeprom_unlocked;
+static uint8_t flash_unlocked;
+static uint32_t flash_erase_count;
+static uint32_t flash_program_count;
+static uint32_t eeprom_program_count;
+
+void fake_hal_reset(void)
+{
+	tick = 0;
+	i2c_count = 0;
+	uart_len = 0;
+	uart_count = 0;
+	uart_sink = NULL;
+	uart_sink_ctx = NULL;
+	standby_count = 0;
+	pwr_flags = 0;
+	reset_flags = 0;
+	eeprom_unlocked = 0;
+	flash_unlocked = 0;
+	flash_erase_count = 0;
+	flash_program_count = 0;
+	eeprom_program_count = 0;
+	uart_rx = NULL;
+
+	memset(i2c_devices, 0, sizeof(i2c_devices));
+	memset(fake_hal_gpio, 0, sizeof(fake_hal_gpio));
+	memset(fake_hal_eeprom, 0, sizeof(fake_hal_eeprom));
+	memset(fake_hal_flash, 0, sizeof(fake_hal_flash));
+	memset(&fake_hal_iwdg, 0, sizeof(fake_hal_iwdg));
+
+	hlpuart1.gState = HAL_UART_STATE_READY;
+
+	fake_hal_systick.LOAD = (SystemCoreClock / 1000) - 1;
+	fake_hal_systick.VAL = fake_hal_systick.LOAD;
+}
+
+void fake_hal_setTick(uint32_t t)
+{
+	tick = t;
+}
+
+void fake_hal_advanceTick(uint32_t ms)
+{
+	tick += ms;
+}
+
+void fake_hal_attachI2C(uint8_t addr, fake_hal_i2cRead_F read, fake_hal_i2cWrite_F write, void *ctx)
+{
+	i2c_devices[addr & 0x7F].read = read;
+	i2c_devices[addr & 0x7F].write = write;
+	i2c_devices[addr & 0x7F].ctx = ctx;
+}
+
+uint32_t fake_hal_getI2CCount(void)
+{
+	return i2c_count;
+}
+
+void fake_hal_setPin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state)
+{
+	if (state == GPIO_PIN_SET)
+	{
+		port->IDR |= pin;
+	}
+	else
+	{
+		port->IDR &= ~(uint32_t)pin;
+	}
+}
+
+GPIO_PinState fake_hal_getPin(GPIO_TypeDef *port, uint16_t pin)
+{
+	return (port->ODR & pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+const uint8_t *fake_hal_getUartTx(uint32_t *len)
+{
+	*len = uart_len;
+
+	return uart_buf;
+}
+
+uint32_t fake_hal_getUartTxCount(void)
+{
+	return uart_count;
+}
+
+void fake_hal_setUartSink(fake_hal_uartSink_F sink, void *ctx)
+{
+	uart_sink = sink;
+	uart_sink_ctx = ctx;
+}
+
+// delivers one byte if a receive is pending, like the rx interrupt
+void fake_hal_uartReceive(uint8_t byte)
+{
+	uint8_t *rx = uart_rx;
+
+	if (rx == NULL)
+	{
+		return;
+	}
+
+	uart_rx = NULL;
+	*rx = byte;
+
+	HAL_UART_RxCpltCallback(&hlpuart1);
+}
+
+uint32_t fake_hal_getStandbyCount(void)
+{
+	return standby_count;
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return tick;
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+	tick += Delay;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+	if (PinState != GPIO_PIN_RESET)
+	{
+		GPIOx->ODR |= GPIO_Pin;
+	}
+	else
+	{
+		GPIOx->ODR &= ~(uint32_t)GPIO_Pin;
+	}
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+	return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+	GPIOx->ODR ^= GPIO_Pin;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	(void)hi2c;
+	(void)MemAddSize;
+	(void)Timeout;
+
+	fake_hal_i2cDevice_S *dev = &i2c_devices[(DevAddress >> 1) & 0x7F];
+
+	i2c_count++;
+
+	if (dev->write == NULL)
+	{
+		return HAL_ERROR;
+	}
+
+	return dev->write(dev->ctx, MemAddress, pData, Size);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	(void)hi2c;
+	(void)MemAddSize;
+	(void)Timeout;
+
+	fake_hal_i2cDevice_S *dev = &i2c_devices[(DevAddress >> 1) & 0x7F];
+
+	i2c_count++;
+
+	if (dev->read == NULL)
+	{
+		return HAL_ERROR;
+	}
+
+	return dev->read(dev->ctx, MemAddress, pData, Size);
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	(void)Timeout;
+
+	return HAL_UART_Transmit_IT(huart, pData, Size);
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	(void)huart;
+	(void)Size;
+
+	uart_rx = pData;
+
+	return HAL_OK;
+}
+
+__attribute__((weak)) void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	(void)huart;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size)
+{
+	// transfers complete immediately, the handle never stays busy
+	if (huart->gState != HAL_UART_STATE_READY)
+	{
+		return HAL_BUSY;
+	}
+
+	uart_len = (Size < FAKE_HAL_UART_BUF_SIZE) ? Size : FAKE_HAL_UART_BUF_SIZE;
+	memcpy(uart_buf, pData, uart_len);
+	uart_count++;
+
+	if (uart_sink != NULL)
+	{
+		uart_sink(uart_sink_ctx, pData, Size);
+	}
+
+	return HAL_OK;
+}
+
+void HAL_PWR_EnableWakeUpPin(uint32_t WakeUpPinx)
+{
+	(void)WakeUpPinx;
+}
+
+void HAL_PWR_EnterSTANDBYMode(void)
+{
+	standby_count++;
+}
+
+uint32_t fake_hal_pwrGetFlag(uint32_t flag)
+{
+	return (pwr_flags & flag) == flag;
+}
+
+void fake_hal_pwrClearFlag(uint32_t flag)
+{
+	pwr_flags &= ~flag;
+}
+
+void fake_hal_setPwrFlags(uint32_t flags)
+{
+	pwr_flags = flags;
+}
+
+uint32_t fake_hal_rccGetFlag(uint32_t flag)
+{
+	return (reset_flags & flag) ? 1 : 0;
+}
+
+void fake_hal_rccClearResetFlags(void)
+{
+	reset_flags = 0;
+}
+
+void fake_hal_setResetFlags(uint32_t flags)
+{
+	reset_flags = flags;
+}
+
+uint32_t fake_hal_getFlashEraseCount(void)
+{
+	return flash_erase_count;
+}
+
+uint32_t fake_hal_getFlashProgramCount(void)
+{
+	return flash_program_count;
+}
+
+uint32_t fake_hal_getEepromProgramCount(void)
+{
+	return eeprom_program_count;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_DATAEEPROM_Unlock(void)
+{
+	eeprom_unlocked = 1;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_DATAEEPROM_Lock(void)
+{
+	eeprom_unlocked = 0;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_DATAEEPROM_Program(uint32_t TypeProgram, uint32_t Address, uint32_t Data)
+{
+	// the address was truncated to 32 bits, the offset survives the wrap
+	uint32_t offset = Address - (uint32_t)(uintptr_t)fake_hal_eeprom;
+	uint32_t size = (TypeProgram == FLASH_TYPEPROGRAMDATA_WORD) ? 4 : (TypeProgram == FLASH_TYPEPROGRAMDATA_HALFWORD) ? 2 : 1;
+
+	if (!eeprom_unlocked || ((offset + size) > FAKE_HAL_EEPROM_SIZE))
+	{
+		return HAL_ERROR;
+	}
+
+	memcpy(&fake_hal_eeprom[offset], &Data, size);
+	eeprom_program_count++;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+	flash_unlocked = 1;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+	flash_unlocked = 0;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint32_t Data)
+{
+	uint32_t offset = Address - (uint32_t)(uintptr_t)fake_hal_flash;
+	uint32_t stored;
+
+	if (!flash_unlocked || (TypeProgram != FLASH_TYPEPROGRAM_WORD) || (offset & 3) || ((offset + 4) > FAKE_HAL_FLASH_SIZE))
+	{
+		return HAL_ERROR;
+	}
+
+	memcpy(&stored, &fake_hal_flash[offset], sizeof(stored));
+
+	// the part refuses to program a word that is not erased
+	if (stored != 0)
+	{
+		return HAL_ERROR;
+	}
+
+	memcpy(&fake_hal_flash[offset], &Data, sizeof(Data));
+	flash_program_count++;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError)
+{
+	uint32_t offset = pEraseInit->PageAddress - (uint32_t)(uintptr_t)fake_hal_flash;
+
+	*PageError = 0xFFFFFFFF;
+
+	if (!flash_unlocked || (offset % FLASH_PAGE_SIZE) || ((offset + (pEraseInit->NbPages * FLASH_PAGE_SIZE)) > FAKE_HAL_FLASH_SIZE))
+	{
+		*PageError = pEraseInit->PageAddress;
+		return HAL_ERROR;
+	}
+
+	memset(&fake_hal_flash[offset], 0, pEraseInit->NbPages * FLASH_PAGE_SIZE);
+	flash_erase_count += pEraseInit->NbPages;
+
+	return HAL_OK;
+}
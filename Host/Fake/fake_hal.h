@@ -0,0 +1,35 @@
+#ifndef __FAKE_HAL_H__
+#define __FAKE_HAL_H__
+
+#include "stm32l0xx_hal.h"
+
+#define FAKE_HAL_UART_BUF_SIZE 512
+
+typedef HAL_StatusTypeDef (*fake_hal_i2cRead_F)(void *ctx, uint8_t reg, uint8_t *data, uint16_t size);
+typedef HAL_StatusTypeDef (*fake_hal_i2cWrite_F)(void *ctx, uint8_t reg, const uint8_t *data, uint16_t size);
+typedef void (*fake_hal_uartSink_F)(void *ctx, const uint8_t *data, uint16_t size);
+
+void fake_hal_reset(void);
+
+void fake_hal_setTick(uint32_t tick);
+void fake_hal_advanceTick(uint32_t ms);
+
+void fake_hal_attachI2C(uint8_t addr, fake_hal_i2cRead_F read, fake_hal_i2cWrite_F write, void *ctx);
+uint32_t fake_hal_getI2CCount(void);
+
+void fake_hal_setPin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+GPIO_PinState fake_hal_getPin(GPIO_TypeDef *port, uint16_t pin);
+
+const uint8_t *fake_hal_getUartTx(uint32_t *len);
+uint32_t fake_hal_getUartTxCount(void);
+void fake_hal_setUartSink(fake_hal_uartSink_F sink, void *ctx);
+void fake_hal_uartReceive(uint8_t byte);
+
+uint32_t fake_hal_getStandbyCount(void);
+void fake_hal_setPwrFlags(uint32_t flags);
+void fake_hal_setResetFlags(uint32_t flags);
+uint32_t fake_hal_getFlashEraseCount(void);
+uint32_t fake_hal_getFlashProgramCount(void);
+uint32_t fake_hal_getEepromProgramCount(void);
+
+#endif // __FAKE_HAL_H__
@@ -0,0 +1,181 @@
+#ifndef __STM32L0xx_HAL_H
+#define __STM32L0xx_HAL_H
+
+// Host stand-in for the STM32L0 HAL. Only what Core/Src uses is declared,
+// the behaviour is driven through fake_hal.h.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define __IO volatile
+
+typedef enum
+{
+	HAL_OK = 0x00U,
+	HAL_ERROR = 0x01U,
+	HAL_BUSY = 0x02U,
+	HAL_TIMEOUT = 0x03U,
+} HAL_StatusTypeDef;
+
+typedef enum
+{
+	GPIO_PIN_RESET = 0U,
+	GPIO_PIN_SET,
+} GPIO_PinState;
+
+typedef struct
+{
+	uint32_t ODR;
+	uint32_t IDR;
+} GPIO_TypeDef;
+
+typedef struct
+{
+	uint32_t Instance;
+} I2C_HandleTypeDef;
+
+typedef uint32_t HAL_UART_StateTypeDef;
+
+#define HAL_UART_STATE_READY 0x00000020U
+#define HAL_UART_STATE_BUSY_TX 0x00000021U
+
+typedef struct
+{
+	uint32_t Instance;
+	__IO HAL_UART_StateTypeDef gState;
+} UART_HandleTypeDef;
+
+typedef struct
+{
+	uint32_t Instance;
+} DMA_HandleTypeDef;
+
+extern GPIO_TypeDef fake_hal_gpio[3];
+
+#define GPIOA (&fake_hal_gpio[0])
+#define GPIOB (&fake_hal_gpio[1])
+#define GPIOC (&fake_hal_gpio[2])
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+#define PWR_FLAG_WU (1U << 0)
+#define PWR_FLAG_SB (1U << 1)
+#define PWR_WAKEUP_PIN1 (1U << 8)
+
+#define __HAL_PWR_GET_FLAG(__FLAG__) fake_hal_pwrGetFlag(__FLAG__)
+#define __HAL_PWR_CLEAR_FLAG(__FLAG__) fake_hal_pwrClearFlag(__FLAG__)
+
+#define RCC_FLAG_OBLRST (1U << 0)
+#define RCC_FLAG_PINRST (1U << 1)
+#define RCC_FLAG_PORRST (1U << 2)
+#define RCC_FLAG_SFTRST (1U << 3)
+#define RCC_FLAG_IWDGRST (1U << 4)
+#define RCC_FLAG_LPWRRST (1U << 5)
+
+#define __HAL_RCC_GET_FLAG(__FLAG__) fake_hal_rccGetFlag(__FLAG__)
+#define __HAL_RCC_CLEAR_RESET_FLAGS() fake_hal_rccClearResetFlags()
+
+typedef struct
+{
+	__IO uint32_t KR;
+	__IO uint32_t PR;
+	__IO uint32_t RLR;
+	__IO uint32_t SR;
+	__IO uint32_t WINR;
+} IWDG_TypeDef;
+
+extern IWDG_TypeDef fake_hal_iwdg;
+
+#define IWDG (&fake_hal_iwdg)
+
+#define FAKE_HAL_EEPROM_SIZE 256
+
+extern uint8_t fake_hal_eeprom[FAKE_HAL_EEPROM_SIZE];
+
+#define DATA_EEPROM_BASE ((uintptr_t)fake_hal_eeprom)
+#define DATA_EEPROM_END (DATA_EEPROM_BASE + FAKE_HAL_EEPROM_SIZE - 1)
+
+// program flash reads as zero when erased, like the part
+#define FAKE_HAL_FLASH_SIZE (32 * 1024)
+
+extern uint8_t fake_hal_flash[FAKE_HAL_FLASH_SIZE];
+
+#define FLASH_BASE ((uintptr_t)fake_hal_flash)
+#define FLASH_PAGE_SIZE (128U)
+#define FLASH_TYPEPROGRAM_WORD (0x02U)
+#define FLASH_TYPEERASE_PAGES (0x00U)
+
+typedef struct
+{
+	uint32_t TypeErase;
+	uint32_t PageAddress;
+	uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEPROGRAMDATA_BYTE (0x00U)
+#define FLASH_TYPEPROGRAMDATA_HALFWORD (0x01U)
+#define FLASH_TYPEPROGRAMDATA_WORD (0x02U)
+
+typedef struct
+{
+	__IO uint32_t CTRL;
+	__IO uint32_t LOAD;
+	__IO uint32_t VAL;
+	__IO uint32_t CALIB;
+} SysTick_Type;
+
+// VAL only moves when a test writes it, so host timings stay deterministic
+extern SysTick_Type fake_hal_systick;
+extern uint32_t SystemCoreClock;
+
+#define SysTick (&fake_hal_systick)
+
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart);
+
+void HAL_PWR_EnableWakeUpPin(uint32_t WakeUpPinx);
+void HAL_PWR_EnterSTANDBYMode(void);
+uint32_t fake_hal_pwrGetFlag(uint32_t flag);
+void fake_hal_pwrClearFlag(uint32_t flag);
+uint32_t fake_hal_rccGetFlag(uint32_t flag);
+void fake_hal_rccClearResetFlags(void);
+
+HAL_StatusTypeDef HAL_FLASHEx_DATAEEPROM_Unlock(void);
+HAL_StatusTypeDef HAL_FLASHEx_DATAEEPROM_Lock(void);
+HAL_StatusTypeDef HAL_FLASHEx_DATAEEPROM_Program(uint32_t TypeProgram, uint32_t Address, uint32_t Data);
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint32_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError);
+
+#endif /* __STM32L0xx_HAL_H */
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fake_hal.h"
+
+#include "adc121.h"
+#include "blackbox.h"
+#include "bq76930.h"
+#include "controller.h"
+#include "datalog.h"
+#include "eeprom.h"
+#include "i2c_trace.h"
+#include "tca9534.h"
+
+// Feeds a captured uart stream (telemetry frames and i2c trace chunks) back
+// into the unmodified drivers and controller. Every transaction the code
+// issues is checked against the trace, and the telemetry it sends against
+// the recorded frames.
+
+#define REPLAY_PAYLOAD_MAX 64
+#define REPLAY_TAIL_MS 1000
+
+typedef struct
+{
+	uint32_t tick;
+	uint8_t device;
+	uint8_t write;
+	uint8_t error;
+	uint8_t reg;
+	uint8_t len;
+	uint8_t payload_len;
+	uint8_t payload[REPLAY_PAYLOAD_MAX];
+} replay_record_S;
+
+static uint8_t *stream;
+static uint32_t stream_len;
+static replay_record_S *records;
+static uint32_t record_count;
+static uint32_t record_index;
+static controller_data_S *frames;
+static uint32_t frame_count;
+static uint32_t frame_index;
+static uint32_t frame_matched;
+static uint32_t frame_mismatch_first = UINT32_MAX;
+static uint8_t replay_gap;
+static uint8_t replay_diverged;
+static uint8_t replay_verbose;
+
+static const char *device_name[4] = { "bq", "tca", "adc", "mark" };
+
+static void replay_demux(const uint8_t *buf, uint32_t len)
+{
+	uint32_t frames_max = (len / sizeof(controller_data_S)) + 1;
+	uint8_t seq = 0;
+	uint8_t seq_valid = 0;
+	uint32_t skipped = 0;
+
+	frames = malloc(frames_max * sizeof(controller_data_S));
+	stream = malloc(len);
+
+	for (uint32_t i = 0; i < len;)
+	{
+		uint32_t code = CONTROLLER_DATA_CODE;
+
+		if (((i + sizeof(controller_data_S)) <= len) && (memcmp(&buf[i], &code, sizeof(code)) == 0))
+		{
+			memcpy(&frames[frame_count++], &buf[i], sizeof(controller_data_S));
+			i += sizeof(controller_data_S);
+		}
+		else if (((i + I2C_TRACE_CHUNK_HEADER) <= len) && (buf[i] == I2C_TRACE_SYNC_0) && (buf[i + 1] == I2C_TRACE_SYNC_1) && ((i + I2C_TRACE_CHUNK_HEADER + buf[i + 2]) <= len))
+		{
+			uint8_t chunk_len = buf[i + 2];
+
+			// a lost chunk leaves a hole in the record stream, stop there
+			if (seq_valid && (buf[i + 3] != seq))
+			{
+				replay_gap = 1;
+			}
+
+			if (!replay_gap)
+			{
+				memcpy(&stream[stream_len], &buf[i + I2C_TRACE_CHUNK_HEADER], chunk_len);
+				stream_len += chunk_len;
+			}
+
+			seq = buf[i + 3] + 1;
+			seq_valid = 1;
+			i += I2C_TRACE_CHUNK_HEADER + chunk_len;
+		}
+		else if (((i + BLACKBOX_CHUNK_HEADER) <= len) && (buf[i] == BLACKBOX_SYNC_0) && (buf[i + 1] == BLACKBOX_SYNC_1) && ((i + BLACKBOX_CHUNK_HEADER + buf[i + 2]) <= len))
+		{
+			// fault captures carry nothing the replay needs
+			i += BLACKBOX_CHUNK_HEADER + buf[i + 2];
+		}
+		else if (((i + DATALOG_CHUNK_HEADER) <= len) && (buf[i] == DATALOG_SYNC_0) && (buf[i + 1] == DATALOG_SYNC_1) && ((i + DATALOG_CHUNK_HEADER + buf[i + 2]) <= len))
+		{
+			i += DATALOG_CHUNK_HEADER + buf[i + 2];
+		}
+		else
+		{
+			skipped++;
+			i++;
+		}
+	}
+
+	if (skipped)
+	{
+		printf("skipped %u bytes of unframed data\n", skipped);
+	}
+}
+
+static uint8_t replay_varint(uint32_t *pos, uint32_t *value)
+{
+	uint32_t shift = 0;
+
+	*value = 0;
+
+	while (*pos < stream_len)
+	{
+		uint8_t b = stream[(*pos)++];
+
+		*value |= (uint32_t)(b & 0x7F) << shift;
+		shift += 7;
+
+		if (!(b & 0x80))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void replay_decode(void)
+{
+	uint32_t pos = 0;
+	uint32_t tick = 0;
+	uint32_t capacity = 1024;
+
+	records = malloc(capacity * sizeof(replay_record_S));
+
+	while (pos < stream_len)
+	{
+		replay_record_S rec;
+		uint8_t flags = stream[pos++];
+		uint32_t delta;
+
+		memset(&rec, 0, sizeof(rec));
+
+		if (!replay_varint(&pos, &delta) || (pos >= stream_len))
+		{
+			break;
+		}
+
+		tick += delta;
+
+		rec.device = flags >> 6;
+
+		if (rec.device == I2C_TRACE_DEV_MARK)
+		{
+			rec.reg = flags & 0x3F;
+			rec.payload_len = stream[pos++];
+		}
+		else
+		{
+			rec.write = (flags & I2C_TRACE_FLAG_WRITE) ? 1 : 0;
+			rec.error = (flags & I2C_TRACE_FLAG_ERROR) ? 1 : 0;
+			rec.len = flags & I2C_TRACE_LEN_MASK;
+			rec.reg = stream[pos++];
+			rec.payload_len = (rec.error && !rec.write) ? 0 : rec.len;
+		}
+
+		if (((pos + rec.payload_len) > stream_len) || (rec.payload_len > REPLAY_PAYLOAD_MAX))
+		{
+			break;
+		}
+
+		memcpy(rec.payload, &stream[pos], rec.payload_len);
+		pos += rec.payload_len;
+
+		if ((rec.device == I2C_TRACE_DEV_MARK) && (rec.reg == I2C_TRACE_MARK_START))
+		{
+			memcpy(&tick, rec.payload, sizeof(tick));
+		}
+
+		rec.tick = tick;
+
+		if (record_count == capacity)
+		{
+			capacity *= 2;
+			records = realloc(records, capacity * sizeof(replay_record_S));
+		}
+
+		records[record_count++] = rec;
+	}
+}
+
+static void replay_diverge(const char *what, const replay_record_S *rec, uint8_t device, uint8_t write, uint8_t reg, uint16_t size)
+{
+	replay_diverged = 1;
+
+	printf("diverged at record %u (tick %u): %s\n", record_index, HAL_GetTick(), what);
+	printf("  trace  %s %s reg 0x%02X len %u tick %u\n", device_name[rec->device], rec->write ? "wr" : "rd", rec->reg, rec->len, rec->tick);
+	printf("  replay %s %s reg 0x%02X len %u\n", device_name[device], write ? "wr" : "rd", reg, size);
+}
+
+static HAL_StatusTypeDef replay_transaction(uint8_t device, uint8_t write, uint8_t reg, uint8_t *data, uint16_t size)
+{
+	// markers carry no bus traffic, a drop marker ends the replayable part
+	while ((record_index < record_count) && (records[record_index].device == I2C_TRACE_DEV_MARK))
+	{
+		if (records[record_index].reg == I2C_TRACE_MARK_DROP)
+		{
+			replay_gap = 1;
+			record_count = record_index;
+			break;
+		}
+
+		record_index++;
+	}
+
+	if (replay_diverged || (record_index >= record_count))
+	{
+		return HAL_ERROR;
+	}
+
+	const replay_record_S *rec = &records[record_index];
+	uint8_t len = (size > I2C_TRACE_LEN_MASK) ? I2C_TRACE_LEN_MASK : size;
+
+	if ((rec->device != device) || (rec->write != write) || (rec->reg != reg) || (rec->len != len))
+	{
+		replay_diverge("transaction differs", rec, device, write, reg, size);
+		return HAL_ERROR;
+	}
+
+	// the target stalled on the bus or elsewhere, catch the clock up
+	if (rec->tick > HAL_GetTick())
+	{
+		fake_hal_setTick(rec->tick);
+	}
+	else if (rec->tick < HAL_GetTick())
+	{
+		replay_diverge("transaction issued late", rec, device, write, reg, size);
+		return HAL_ERROR;
+	}
+
+	if (write)
+	{
+		if (memcmp(rec->payload, data, rec->payload_len) != 0)
+		{
+			replay_diverge("write payload differs", rec, device, write, reg, size);
+			return HAL_ERROR;
+		}
+	}
+	else
+	{
+		memcpy(data, rec->payload, rec->payload_len);
+	}
+
+	if (replay_verbose)
+	{
+		printf("%8u %-3s %s 0x%02X", rec->tick, device_name[device], write ? "wr" : "rd", reg);
+
+		for (uint32_t i = 0; i < rec->payload_len; i++)
+		{
+			printf(" %02X", rec->payload[i]);
+		}
+
+		printf("%s\n", rec->error ? " error" : "");
+	}
+
+	record_index++;
+
+	return rec->error ? HAL_ERROR : HAL_OK;
+}
+
+static HAL_StatusTypeDef replay_read(void *ctx, uint8_t reg, uint8_t *data, uint16_t size)
+{
+	return replay_transaction((uint8_t)(uintptr_t)ctx, 0, reg, data, size);
+}
+
+static HAL_StatusTypeDef replay_write(void *ctx, uint8_t reg, const uint8_t *data, uint16_t size)
+{
+	return replay_transaction((uint8_t)(uintptr_t)ctx, 1, reg, (uint8_t *)data, size);
+}
+
+static void replay_uartSink(void *ctx, const uint8_t *data, uint16_t size)
+{
+	(void)ctx;
+
+	if ((size != sizeof(controller_data_S)) || (((const controller_data_S *)data)->code != CONTROLLER_DATA_CODE))
+	{
+		return;
+	}
+
+	if (frame_index < frame_count)
+	{
+		if (memcmp(&frames[frame_index], data, sizeof(controller_data_S)) == 0)
+		{
+			frame_matched++;
+		}
+		else if (frame_mismatch_first == UINT32_MAX)
+		{
+			frame_mismatch_first = frame_index;
+		}
+	}
+
+	frame_index++;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--verbose") == 0)
+		{
+			replay_verbose = 1;
+		}
+		else
+		{
+			path = argv[i];
+		}
+	}
+
+	FILE *f = (path != NULL) ? fopen(path, "rb") : NULL;
+
+	if (f == NULL)
+	{
+		printf("usage: bms_replay <capture.bin> [--verbose]\n");
+		return 2;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	uint8_t *buf = malloc(size);
+
+	if (fread(buf, 1, size, f) != (size_t)size)
+	{
+		fclose(f);
+		return 2;
+	}
+
+	fclose(f);
+
+	replay_demux(buf, size);
+	replay_decode();
+
+	if ((record_count == 0) || (records[0].device != I2C_TRACE_DEV_MARK) || (records[0].reg != I2C_TRACE_MARK_START))
+	{
+		printf("no trace session in %s\n", path);
+		return 2;
+	}
+
+	fake_hal_reset();
+	fake_hal_setTick(records[0].tick);
+	fake_hal_setUartSink(replay_uartSink, NULL);
+	fake_hal_attachI2C(BQ76930_I2C_ADDR, replay_read, replay_write, (void *)(uintptr_t)I2C_TRACE_DEV_BQ);
+	fake_hal_attachI2C(TCA9534_I2C_ADDR, replay_read, replay_write, (void *)(uintptr_t)I2C_TRACE_DEV_TCA);
+	fake_hal_attachI2C(ADC121_I2C_ADDR, replay_read, replay_write, (void *)(uintptr_t)I2C_TRACE_DEV_ADC);
+
+	// restore the calibration the session ran with
+	for (uint32_t i = 0; i < record_count; i++)
+	{
+		if ((records[i].device == I2C_TRACE_DEV_MARK) && (records[i].reg == I2C_TRACE_MARK_CAL))
+		{
+			(void)eeprom_writeRecord(EEPROM_ADDR_CAL, records[i].payload, records[i].payload_len);
+			break;
+		}
+	}
+
+	controller_init();
+
+	uint32_t end_tick = records[record_count - 1].tick + REPLAY_TAIL_MS;
+
+	while (!replay_diverged && (record_index < record_count) && (HAL_GetTick() < end_tick))
+	{
+		fake_hal_advanceTick(1);
+
+		controller_run();
+	}
+
+	uint32_t compared = (frame_index < frame_count) ? frame_index : frame_count;
+
+	printf("records    %u of %u replayed, %.1f s%s\n", record_index, record_count, (records[record_count - 1].tick - records[0].tick) / 1000.0, replay_gap ? ", stopped at a trace gap" : "");
+	printf("telemetry  %u of %u frames match\n", frame_matched, compared);
+
+	if (frame_mismatch_first != UINT32_MAX)
+	{
+		printf("first telemetry mismatch at frame %u\n", frame_mismatch_first);
+	}
+
+	free(buf);
+	free(stream);
+	free(records);
+	free(frames);
+
+	return (replay_diverged || (frame_matched != compared)) ? 1 : 0;
+}
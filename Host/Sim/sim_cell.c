@@ -0,0 +1,70 @@
+#include "sim_cell.h"
+
+#define OCV_TABLE_LEN 11
+
+#define RC_R1_SCALE 0.6 // r1 relative to r0
+#define RC_TAU_S 20.0
+
+#define OCV_COLD_MV_PER_C 2.2 // below 25 C, rested cells sit lower in the cold
+
+// nmc 18650, mV at 0, 10, .. 100 % soc
+static const double ocv_table[OCV_TABLE_LEN] =
+{
+	2700, 3400, 3520, 3600, 3660, 3720, 3800, 3890, 3980, 4070, 4180,
+};
+
+void sim_cell_init(sim_cell_S *cell, double capacity_mah, double soc, double r0_ohm)
+{
+	cell->capacity_mas = capacity_mah * 3600.0;
+	cell->charge_mas = soc * cell->capacity_mas;
+	cell->r0_ohm = r0_ohm;
+	cell->r1_ohm = r0_ohm * RC_R1_SCALE;
+	cell->tau_s = RC_TAU_S;
+	cell->v_rc = 0;
+	cell->current_ma = 0;
+	cell->temp_c = 25;
+}
+
+void sim_cell_step(sim_cell_S *cell, double current_ma, double dt_s)
+{
+	cell->current_ma = current_ma;
+	cell->charge_mas -= current_ma * dt_s;
+
+	if (cell->charge_mas < 0)
+	{
+		cell->charge_mas = 0;
+	}
+
+	if (cell->charge_mas > cell->capacity_mas)
+	{
+		cell->charge_mas = cell->capacity_mas;
+	}
+
+	// rc voltage relaxes towards i * r1
+	cell->v_rc += ((current_ma * cell->r1_ohm) - cell->v_rc) * (dt_s / cell->tau_s);
+}
+
+double sim_cell_getSoc(const sim_cell_S *cell)
+{
+	return cell->charge_mas / cell->capacity_mas;
+}
+
+double sim_cell_getOcv(const sim_cell_S *cell)
+{
+	double x = sim_cell_getSoc(cell) * (OCV_TABLE_LEN - 1);
+	double cold = (cell->temp_c < 25) ? ((25 - cell->temp_c) * OCV_COLD_MV_PER_C) : 0;
+	int i = (int)x;
+
+	if (i >= (OCV_TABLE_LEN - 1))
+	{
+		return ocv_table[OCV_TABLE_LEN - 1] - cold;
+	}
+
+	return ocv_table[i] + ((ocv_table[i + 1] - ocv_table[i]) * (x - i)) - cold;
+}
+
+double sim_cell_getVoltage(const sim_cell_S *cell)
+{
+	// mA * ohm is mV
+	return sim_cell_getOcv(cell) - (cell->current_ma * cell->r0_ohm) - cell->v_rc;
+}
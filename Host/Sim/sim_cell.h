@@ -0,0 +1,27 @@
+#ifndef __SIM_CELL_H__
+#define __SIM_CELL_H__
+
+#include <stdint.h>
+
+// Thevenin model of one parallel cell group, ocv(soc) + r0 + one rc pair.
+// Currents are in mA, positive out of the cell (discharge).
+
+typedef struct
+{
+	double capacity_mas;
+	double charge_mas;
+	double r0_ohm;
+	double r1_ohm;
+	double tau_s;
+	double v_rc;
+	double current_ma;
+	double temp_c;
+} sim_cell_S;
+
+void sim_cell_init(sim_cell_S *cell, double capacity_mah, double soc, double r0_ohm);
+void sim_cell_step(sim_cell_S *cell, double current_ma, double dt_s);
+double sim_cell_getOcv(const sim_cell_S *cell);
+double sim_cell_getVoltage(const sim_cell_S *cell);
+double sim_cell_getSoc(const sim_cell_S *cell);
+
+#endif // __SIM_CELL_H__
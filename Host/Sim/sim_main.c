@@ -0,0 +1,421 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fake_hal.h"
+#include "sim_pack.h"
+#include "sim_profile.h"
+
+#include "blackbox.h"
+#include "controller.h"
+#include "datalog.h"
+#include "energy.h"
+#include "i2c_trace.h"
+#include "resistance.h"
+#include "soh.h"
+#include "thermal.h"
+
+// Runs the real controller loop against the simulated pack with injected
+// time and reports soc error, balancing time and fault reaction latency.
+
+#define SIM_STEP_MS 1
+#define SIM_REPORT_MS 1000
+
+#define HAZARD_OC_MA 45000 // past the top of the fuse curve, has to go within ms
+#define HAZARD_OV_MV 4200
+#define HAZARD_UV_MV 2000
+#define HAZARD_OT_C 60
+
+typedef enum
+{
+	HAZARD_OC,
+	HAZARD_OV,
+	HAZARD_UV,
+	HAZARD_OT,
+	HAZARD_COUNT,
+} sim_hazard_E;
+
+typedef struct
+{
+	uint8_t active;
+	uint32_t onset_ms;
+	uint32_t count;
+	uint32_t latency_max_ms;
+} sim_hazardStat_S;
+
+static const char *hazard_name[HAZARD_COUNT] = { "oc", "ov", "uv", "ot" };
+
+static sim_pack_S pack;
+static sim_profile_S profile;
+static sim_hazardStat_S hazard[HAZARD_COUNT];
+static controller_data_S telemetry;
+static uint8_t telemetry_valid;
+static uint32_t uart_bytes;
+static uint8_t blackbox_buf[sizeof(blackbox_header_S) + (BLACKBOX_LEN * sizeof(blackbox_sample_S))];
+static uint32_t blackbox_len;
+static uint32_t blackbox_dumps;
+
+static void sim_uartSink(void *ctx, const uint8_t *data, uint16_t size)
+{
+	FILE *capture = ctx;
+
+	uart_bytes += size;
+
+	if (capture != NULL)
+	{
+		fwrite(data, 1, size, capture);
+	}
+
+	if ((size > BLACKBOX_CHUNK_HEADER) && (data[0] == BLACKBOX_SYNC_0) && (data[1] == BLACKBOX_SYNC_1))
+	{
+		uint8_t len = data[2];
+
+		// keep the last capture, a new one starts at sequence 0
+		if (data[3] == 0)
+		{
+			blackbox_len = 0;
+			blackbox_dumps++;
+		}
+
+		if ((blackbox_len + len) <= sizeof(blackbox_buf))
+		{
+			memcpy(&blackbox_buf[blackbox_len], &data[BLACKBOX_CHUNK_HEADER], len);
+			blackbox_len += len;
+		}
+
+		return;
+	}
+
+	// trace chunks share the uart, only whole frames are telemetry
+	if ((size == sizeof(controller_data_S)) && (((const controller_data_S *)data)->code == CONTROLLER_DATA_CODE))
+	{
+		memcpy(&telemetry, data, sizeof(controller_data_S));
+		telemetry_valid = 1;
+	}
+}
+
+static uint8_t sim_readTelemetry(controller_data_S *data)
+{
+	*data = telemetry;
+
+	return telemetry_valid;
+}
+
+static void sim_checkHazards(uint32_t now)
+{
+	uint8_t present[HAZARD_COUNT] = { 0 };
+	uint8_t cleared[HAZARD_COUNT];
+
+	present[HAZARD_OC] = pack.current_ma > HAZARD_OC_MA;
+	present[HAZARD_OT] = sim_pack_getMaxTemp(&pack) > HAZARD_OT_C;
+
+	for (uint32_t i = 0; i < SIM_CELL_COUNT; i++)
+	{
+		double v = sim_pack_getCellVoltage(&pack, i);
+
+		present[HAZARD_OV] |= v > HAZARD_OV_MV;
+		present[HAZARD_UV] |= v < HAZARD_UV_MV;
+	}
+
+	// a hazard is handled once the fet feeding it is open
+	cleared[HAZARD_OC] = !pack.dsg_on;
+	cleared[HAZARD_UV] = !pack.dsg_on;
+	cleared[HAZARD_OV] = !pack.chg_on;
+	cleared[HAZARD_OT] = !pack.dsg_on && !pack.chg_on;
+
+	for (uint32_t i = 0; i < HAZARD_COUNT; i++)
+	{
+		if (!hazard[i].active && present[i] && !cleared[i])
+		{
+			hazard[i].active = 1;
+			hazard[i].onset_ms = now;
+			hazard[i].count++;
+		}
+		else if (hazard[i].active && (cleared[i] || !present[i]))
+		{
+			uint32_t latency = now - hazard[i].onset_ms;
+
+			hazard[i].active = 0;
+
+			if (cleared[i] && (latency > hazard[i].latency_max_ms))
+			{
+				hazard[i].latency_max_ms = latency;
+			}
+		}
+	}
+}
+
+static void sim_usage(void)
+{
+	printf("usage: bms_sim <profile> [--soc 0..1] [--soc-spread 0..1] [--capacity mAh] [--ambient C] [--seed n]\n");
+	printf("               [--trace file.csv] [--capture file.bin] [--max-soc-error pct] [--max-latency ms]\n");
+}
+
+int main(int argc, char **argv)
+{
+	sim_packConfig_S config =
+	{
+		.capacity_mah = 12000,
+		.soc = 0.6,
+		.soc_spread = 0.02,
+		.capacity_spread = 0.03,
+		.r0_ohm = 0.010,
+		.ambient_c = 25,
+		.seed = 1,
+	};
+
+	const char *profile_path = NULL;
+	const char *trace_path = NULL;
+	const char *capture_path = NULL;
+	double max_soc_error = -1;
+	double max_latency = -1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i], "--soc") == 0) && ((i + 1) < argc))
+		{
+			config.soc = atof(argv[++i]);
+		}
+		else if ((strcmp(argv[i], "--soc-spread") == 0) && ((i + 1) < argc))
+		{
+			config.soc_spread = atof(argv[++i]);
+		}
+		else if ((strcmp(argv[i], "--capacity") == 0) && ((i + 1) < argc))
+		{
+			config.capacity_mah = atof(argv[++i]);
+		}
+		else if ((strcmp(argv[i], "--ambient") == 0) && ((i + 1) < argc))
+		{
+			config.ambient_c = atof(argv[++i]);
+		}
+		else if ((strcmp(argv[i], "--seed") == 0) && ((i + 1) < argc))
+		{
+			config.seed = atoi(argv[++i]);
+		}
+		else if ((strcmp(argv[i], "--trace") == 0) && ((i + 1) < argc))
+		{
+			trace_path = argv[++i];
+		}
+		else if ((strcmp(argv[i], "--capture") == 0) && ((i + 1) < argc))
+		{
+			capture_path = argv[++i];
+		}
+		else if ((strcmp(argv[i], "--max-soc-error") == 0) && ((i + 1) < argc))
+		{
+			max_soc_error = atof(argv[++i]);
+		}
+		else if ((strcmp(argv[i], "--max-latency") == 0) && ((i + 1) < argc))
+		{
+			max_latency = atof(argv[++i]);
+		}
+		else if (argv[i][0] != '-')
+		{
+			profile_path = argv[i];
+		}
+		else
+		{
+			sim_usage();
+			return 2;
+		}
+	}
+
+	if ((profile_path == NULL) || (sim_profile_load(&profile, profile_path) != 0))
+	{
+		sim_usage();
+		return 2;
+	}
+
+	FILE *trace = (trace_path != NULL) ? fopen(trace_path, "w") : NULL;
+
+	if (trace != NULL)
+	{
+		fprintf(trace, "time_s,state,capacity_mas,true_mas,soc,current_ma,load_ma,v_min,v_max,spread_mv,t_max,faults\n");
+	}
+
+	// raw uart stream, the same bytes a logger on the pack would record
+	FILE *capture = (capture_path != NULL) ? fopen(capture_path, "wb") : NULL;
+
+	fake_hal_reset();
+	fake_hal_setUartSink(sim_uartSink, capture);
+	sim_pack_init(&pack, &config);
+	sim_pack_attach(&pack);
+
+	controller_init();
+
+	uint32_t duration = sim_profile_getDuration(&profile);
+	double nominal_mas = config.capacity_mah * 3600.0;
+	double soc_error_max = 0;
+	double soc_error_sq = 0;
+	uint32_t soc_error_count = 0;
+	uint32_t balance_ms = 0;
+	uint32_t sop_over_s = 0;
+	double true_out_mwh = 0;
+	int16_t thermal_peak = INT16_MIN;
+	uint32_t derate_s = 0;
+	double true_in_mwh = 0;
+	uint32_t now = 0;
+	controller_data_S data;
+	struct timespec wall_start;
+	struct timespec wall_end;
+
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+	while ((now < duration) && (fake_hal_getStandbyCount() == 0))
+	{
+		const sim_profileStep_S *step = sim_profile_get(&profile, now);
+
+		sim_pack_step(&pack, step->current_ma, step->charger_mv, SIM_STEP_MS);
+
+		double cell_sum_mv = 0;
+
+		for (uint32_t i = 0; i < SIM_CELL_COUNT; i++)
+		{
+			cell_sum_mv += sim_pack_getCellVoltage(&pack, i);
+		}
+
+		double step_mwh = (cell_sum_mv * pack.current_ma * SIM_STEP_MS) / 3.6e9;
+
+		true_out_mwh += (step_mwh > 0) ? step_mwh : 0;
+		true_in_mwh -= (step_mwh < 0) ? step_mwh : 0;
+
+		fake_hal_advanceTick(SIM_STEP_MS);
+		now += SIM_STEP_MS;
+
+		controller_run();
+
+		sim_checkHazards(now);
+
+		if (controller_getState() == STATE_BALANCE)
+		{
+			balance_ms += SIM_STEP_MS;
+		}
+
+		if (((now % SIM_REPORT_MS) == 0) && sim_readTelemetry(&data))
+		{
+			double true_mas = sim_pack_getCharge(&pack);
+
+			if ((data.state == STATE_IDLE) || (data.state == STATE_DISCHARGE) || (data.state == STATE_CHARGE) || (data.state == STATE_BALANCE))
+			{
+				double error = fabs(((double)data.capacity - true_mas) / nominal_mas) * 100.0;
+
+				soc_error_max = (error > soc_error_max) ? error : soc_error_max;
+				soc_error_sq += error * error;
+				soc_error_count++;
+			}
+
+			// the profile load does not listen to the limits, count how often it would have been cut
+			if ((data.state == STATE_DISCHARGE) && (pack.current_ma > data.sop_dsg[SOP_PEAK_2S]))
+			{
+				sop_over_s++;
+			}
+
+			thermal_peak = (data.t_predicted > thermal_peak) ? data.t_predicted : thermal_peak;
+
+			if (thermal_getDerate(THERMAL_DISCHARGE) < THERMAL_DERATE_FULL)
+			{
+				derate_s++;
+			}
+
+			if (trace != NULL)
+			{
+				double v_min = sim_pack_getCellVoltage(&pack, 0);
+				double v_max = v_min;
+
+				for (uint32_t i = 1; i < SIM_CELL_COUNT; i++)
+				{
+					double v = sim_pack_getCellVoltage(&pack, i);
+
+					v_min = (v < v_min) ? v : v_min;
+					v_max = (v > v_max) ? v : v_max;
+				}
+
+				fprintf(trace, "%u,%d,%u,%.0f,%u,%.0f,%d,%.0f,%.0f,%.1f,%.1f,%u\n", now / 1000, data.state, data.capacity, true_mas, data.soc, pack.current_ma, step->current_ma, v_min, v_max, sim_pack_getCellSpread(&pack), sim_pack_getMaxTemp(&pack), data.faults);
+			}
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+	double wall_s = (wall_end.tv_sec - wall_start.tv_sec) + ((wall_end.tv_nsec - wall_start.tv_nsec) / 1e9);
+	double soc_error_rms = soc_error_count ? sqrt(soc_error_sq / soc_error_count) : 0;
+	uint32_t latency_max = 0;
+
+	if (trace != NULL)
+	{
+		fclose(trace);
+	}
+
+	if (capture != NULL)
+	{
+		fclose(capture);
+	}
+
+	printf("simulated         %.1f s in %.2f s wall (%.0fx)\n", now / 1000.0, wall_s, (now / 1000.0) / wall_s);
+	printf("final state       %d%s\n", controller_getState(), fake_hal_getStandbyCount() ? " (standby)" : "");
+	printf("soc error         %.2f %% rms, %.2f %% max\n", soc_error_rms, soc_error_max);
+	printf("balancing         %.1f s, spread %.1f mV\n", balance_ms / 1000.0, sim_pack_getCellSpread(&pack));
+	printf("i2c transactions  %u, bq write errors %u\n", fake_hal_getI2CCount(), pack.bq_write_errors);
+	printf("uart              %.0f B/s, trace drops %u\n", uart_bytes / (now / 1000.0), i2c_trace_getDropped());
+	if (telemetry.wake_dsg_ms != CONTROLLER_WAKE_PENDING)
+	{
+		printf("wake to dsg       %u ms\n", telemetry.wake_dsg_ms);
+	}
+	else
+	{
+		printf("wake to dsg       never\n");
+	}
+	printf("r0 estimate       %.1f mohm mean, %.1f max at 25 C over %u steps (model %.1f)\n", resistance_getNominal(CELL_AVG) / 1000.0, resistance_getNominal(CELL_MAX) / 1000.0, resistance_getCount(), config.r0_ohm * 1000);
+	printf("soh               %u %%, %u mAh learned %u times (model %.0f mAh), %.2f cycles\n", soh_getPercent(), soh_getCapacity(), soh_getLearnCount(), config.capacity_mah, soh_getCycles() / 100.0);
+	printf("sop               dsg %.1f / %.1f / %.1f A, chg %.1f / %.1f / %.1f A (2 s / 10 s / continuous), load above the 2 s limit %u s\n", telemetry.sop_dsg[SOP_PEAK_2S] / 1000.0, telemetry.sop_dsg[SOP_PEAK_10S] / 1000.0, telemetry.sop_dsg[SOP_CONTINUOUS] / 1000.0, telemetry.sop_chg[SOP_PEAK_2S] / 1000.0, telemetry.sop_chg[SOP_PEAK_10S] / 1000.0, telemetry.sop_chg[SOP_CONTINUOUS] / 1000.0, sop_over_s);
+	printf("energy            out %.1f Wh (model %.1f), in %.1f Wh (model %.1f), %d W over 60 s, tte %u min, ttf %u min\n", energy_getDischarged() / 1000.0, true_out_mwh / 1000.0, energy_getCharged() / 1000.0, true_in_mwh / 1000.0, telemetry.power[ENERGY_WINDOW_60S], telemetry.tte, telemetry.ttf);
+	printf("thermal           core %.1f C (model %.1f C), %.1f C peak a minute ahead, discharge derated %u s\n", thermal_getCore() / 10.0, sim_pack_getMaxTemp(&pack), thermal_peak / 10.0, derate_s);
+	printf("datalog           %u records kept, %u page erases, %u words programmed\n", datalog_getRecordCount(), fake_hal_getFlashEraseCount(), fake_hal_getFlashProgramCount());
+
+	if (blackbox_len >= sizeof(blackbox_header_S))
+	{
+		const blackbox_header_S *header = (const blackbox_header_S *)blackbox_buf;
+		const blackbox_sample_S *samples = (const blackbox_sample_S *)&blackbox_buf[sizeof(blackbox_header_S)];
+		uint32_t count = (blackbox_len - sizeof(blackbox_header_S)) / sizeof(blackbox_sample_S);
+		int32_t peak = 0;
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			peak = (abs(samples[i].current) > abs(peak)) ? samples[i].current : peak;
+		}
+
+		printf("blackbox          %u dumps, fault %u at %u ms, %u/%u samples over %u ms, peak %.1f A\n", blackbox_dumps, header->fault, header->tick, count, header->count, count ? (uint16_t)(samples[count - 1].tick - samples[0].tick) : 0, peak / 100.0);
+	}
+
+	for (uint32_t i = 0; i < HAZARD_COUNT; i++)
+	{
+		if (hazard[i].count)
+		{
+			printf("hazard %-10s %u events, %u ms max reaction%s\n", hazard_name[i], hazard[i].count, hazard[i].latency_max_ms, hazard[i].active ? ", still active" : "");
+
+			latency_max = (hazard[i].latency_max_ms > latency_max) ? hazard[i].latency_max_ms : latency_max;
+
+			if (hazard[i].active)
+			{
+				latency_max = UINT32_MAX;
+			}
+		}
+	}
+
+	sim_profile_free(&profile);
+
+	if ((max_soc_error >= 0) && (soc_error_max > max_soc_error))
+	{
+		printf("FAIL soc error above %.2f %%\n", max_soc_error);
+		return 1;
+	}
+
+	if ((max_latency >= 0) && (latency_max > max_latency))
+	{
+		printf("FAIL fault reaction above %.0f ms\n", max_latency);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,626 @@
+#include "sim_pack.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "fake_devices.h"
+
+#include "adc121.h"
+#include "bq76930.h"
+#include "tca9534.h"
+
+#define BQ_ADC_GAIN_UV 377
+#define BQ_ADC_OFFSET_MV 46
+#define BQ_ADC_PERIOD_MS 250
+#define BQ_OV_TRIP_FIXED 0x2008
+#define BQ_UV_TRIP_FIXED 0x1000
+#define BQ_DIE_TEMP_MV 1200
+
+#define SENSE_R_MOHM 1.0
+#define BALANCE_R_OHM 82.0
+#define PCH_R_OHM 100.0
+#define FET_R_OHM 0.002
+#define LOAD_C_F 0.002
+#define LOAD_LEAK_OHM 20000.0
+
+#define CELL_RTH_K_W 2.0
+#define CELL_TAU_S 600.0
+#define FET_RTH_K_W 5.0
+#define FET_TAU_S 60.0
+
+#define HALL_ZERO_MV 1635.0
+#define HALL_MA_PER_MV 62.5
+#define HALL_WARMUP_MS 5
+#define ADC_REF_MV 3300.0
+#define DIVIDER_RATIO 18.647
+
+#define NTC_R25_OHM 10000.0
+#define NTC_BETA 3435.0
+#define NTC_PULLUP_OHM 10000.0
+
+#define TMUX_SEL_SHIFT 3
+
+// board channels on the tca9534, see battery.c
+#define TCA_PCHG_EN 0
+#define TCA_PMON_EN 1
+#define TCA_CP_EN 2
+#define TCA_SNS_EN 5
+#define TCA_TMUX_EN 6
+#define TCA_BQ_ALERT 7
+
+// cell 9 and 14 inputs of the bq are shorted on the 13s layout
+static const uint8_t bq_cell_map[SIM_CELL_COUNT] = { 0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 14 };
+static const uint8_t thermistor_cell[3] = { 0, 6, 12 };
+
+static const uint8_t ocd_thresh_mv[2][16] =
+{
+	{ 8, 11, 14, 17, 19, 22, 25, 28, 31, 33, 36, 39, 42, 44, 47, 50 },
+	{ 17, 22, 28, 33, 39, 44, 50, 56, 61, 67, 72, 78, 83, 89, 94, 100 },
+};
+static const uint16_t ocd_delay_ms[8] = { 8, 20, 40, 80, 160, 320, 640, 1280 };
+static const uint8_t scd_thresh_mv[2][8] =
+{
+	{ 22, 33, 44, 56, 67, 78, 89, 100 },
+	{ 44, 67, 89, 111, 133, 155, 178, 200 },
+};
+static const uint8_t ov_delay_s[4] = { 1, 2, 4, 8 };
+static const uint8_t uv_delay_s[4] = { 1, 4, 8, 16 };
+
+static uint16_t sim_pack_bqRaw(double mv)
+{
+	double raw = ((mv - BQ_ADC_OFFSET_MV) * 1000.0) / BQ_ADC_GAIN_UV;
+
+	if (raw < 0)
+	{
+		return 0;
+	}
+
+	return (raw > 0x3FFF) ? 0x3FFF : (uint16_t)raw;
+}
+
+static double sim_pack_ntcMv(double temp_c)
+{
+	double r = NTC_R25_OHM * exp(NTC_BETA * ((1.0 / (temp_c + 273.15)) - (1.0 / 298.15)));
+
+	return (ADC_REF_MV * r) / (NTC_PULLUP_OHM + r);
+}
+
+static uint8_t sim_pack_tcaOutput(const sim_pack_S *pack, uint32_t channel)
+{
+	// pins configured as inputs float low through the board pulldowns
+	uint8_t out = pack->tca_regs[TCA9534_REG_OUT] & ~pack->tca_regs[TCA9534_REG_CFG];
+
+	return (out >> channel) & 1;
+}
+
+static void sim_pack_bqSetRaw(sim_pack_S *pack, uint8_t reg_hi, uint16_t raw)
+{
+	pack->bq_regs[reg_hi] = (raw >> 8) & 0x3F;
+	pack->bq_regs[reg_hi + 1] = raw & 0xFF;
+}
+
+static void sim_pack_bqRefresh(sim_pack_S *pack)
+{
+	for (uint32_t i = 0; i < BQ76930_CELL_COUNT; i++)
+	{
+		sim_pack_bqSetRaw(pack, BQ76930_REG_VC1_HI + (2 * i), 0);
+	}
+
+	for (uint32_t i = 0; i < SIM_CELL_COUNT; i++)
+	{
+		sim_pack_bqSetRaw(pack, BQ76930_REG_VC1_HI + (2 * bq_cell_map[i]), sim_pack_bqRaw(sim_pack_getCellVoltage(pack, i)));
+	}
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		double mv = BQ_DIE_TEMP_MV;
+
+		if (pack->bq_regs[BQ76930_REG_SYS_CTRL1] & (1 << BQ76930_REG_SYS_CTRL1_TEMP_SEL))
+		{
+			mv = sim_pack_ntcMv(pack->cells[thermistor_cell[i]].temp_c);
+		}
+
+		sim_pack_bqSetRaw(pack, BQ76930_REG_TS1_HI + (2 * i), sim_pack_bqRaw(mv));
+	}
+}
+
+static void sim_pack_bqProtect(sim_pack_S *pack, double sense_mv, uint32_t dt_ms)
+{
+	uint8_t *stat = &pack->bq_regs[BQ76930_REG_SYS_STAT];
+	uint8_t *ctrl2 = &pack->bq_regs[BQ76930_REG_SYS_CTRL2];
+	uint8_t protect1 = pack->bq_regs[BQ76930_REG_PROTECT1];
+	uint8_t protect2 = pack->bq_regs[BQ76930_REG_PROTECT2];
+	uint8_t protect3 = pack->bq_regs[BQ76930_REG_PROTECT3];
+	uint8_t rsns = (protect1 >> 7) & 1;
+
+	// scd delays are all under one step
+	if (sense_mv >= scd_thresh_mv[rsns][protect1 & 0x7])
+	{
+		*stat |= (1 << BQ76930_REG_SYS_STAT_SCD);
+		*ctrl2 &= ~(1 << BQ76930_REG_SYS_CTRL2_DSG_ON);
+	}
+
+	pack->ocd_ms = (sense_mv >= ocd_thresh_mv[rsns][protect2 & 0xF]) ? (pack->ocd_ms + dt_ms) : 0;
+
+	if (pack->ocd_ms >= ocd_delay_ms[(protect2 >> 4) & 0x7])
+	{
+		*stat |= (1 << BQ76930_REG_SYS_STAT_OCD);
+		*ctrl2 &= ~(1 << BQ76930_REG_SYS_CTRL2_DSG_ON);
+	}
+
+	if (!(pack->bq_regs[BQ76930_REG_SYS_CTRL1] & (1 << BQ76930_REG_SYS_CTRL1_ADC_EN)))
+	{
+		return;
+	}
+
+	uint16_t ov_raw = BQ_OV_TRIP_FIXED | (pack->bq_regs[BQ76930_REG_OV_TRIP] << 4);
+	uint16_t uv_raw = BQ_UV_TRIP_FIXED | (pack->bq_regs[BQ76930_REG_UV_TRIP] << 4);
+	uint8_t ov = 0;
+	uint8_t uv = 0;
+
+	for (uint32_t i = 0; i < SIM_CELL_COUNT; i++)
+	{
+		uint16_t raw = sim_pack_bqRaw(sim_pack_getCellVoltage(pack, i));
+
+		ov |= (raw >= ov_raw);
+		uv |= (raw <= uv_raw);
+	}
+
+	pack->ov_ms = ov ? (pack->ov_ms + dt_ms) : 0;
+	pack->uv_ms = uv ? (pack->uv_ms + dt_ms) : 0;
+
+	if (pack->ov_ms >= (1000 * ov_delay_s[(protect3 >> 4) & 0x3]))
+	{
+		*stat |= (1 << BQ76930_REG_SYS_STAT_OV);
+		*ctrl2 &= ~(1 << BQ76930_REG_SYS_CTRL2_CHG_ON);
+	}
+
+	if (pack->uv_ms >= (1000 * uv_delay_s[(protect3 >> 6) & 0x3]))
+	{
+		*stat |= (1 << BQ76930_REG_SYS_STAT_UV);
+		*ctrl2 &= ~(1 << BQ76930_REG_SYS_CTRL2_DSG_ON);
+	}
+}
+
+static HAL_StatusTypeDef sim_pack_bqRead(void *ctx, uint8_t reg, uint8_t *data, uint16_t size)
+{
+	sim_pack_S *pack = ctx;
+
+	for (uint16_t i = 0; (i + 1) < size; i += 2)
+	{
+		uint8_t value = ((reg + (i / 2)) < SIM_BQ_REG_COUNT) ? pack->bq_regs[reg + (i / 2)] : 0;
+
+		if (i == 0)
+		{
+			uint8_t buf[2] = { (BQ76930_I2C_ADDR << 1) | 1, value };
+
+			data[1] = fake_bq76930_crc8(buf, 2);
+		}
+		else
+		{
+			data[i + 1] = fake_bq76930_crc8(&value, 1);
+		}
+
+		data[i] = value;
+	}
+
+	return HAL_OK;
+}
+
+static HAL_StatusTypeDef sim_pack_bqWrite(void *ctx, uint8_t reg, const uint8_t *data, uint16_t size)
+{
+	sim_pack_S *pack = ctx;
+
+	uint8_t buf[3] = { BQ76930_I2C_ADDR << 1, reg, data[0] };
+
+	if ((size != 2) || (reg >= SIM_BQ_REG_COUNT) || (fake_bq76930_crc8(buf, 3) != data[1]))
+	{
+		pack->bq_write_errors++;
+		return HAL_ERROR;
+	}
+
+	uint8_t stat = pack->bq_regs[BQ76930_REG_SYS_STAT];
+
+	switch (reg)
+	{
+	case BQ76930_REG_SYS_STAT:
+		pack->bq_regs[reg] &= ~data[0];
+		break;
+
+	case BQ76930_REG_SYS_CTRL2:
+		pack->bq_regs[reg] = data[0];
+
+		// the fets stay off while their fault is latched
+		if (stat & ((1 << BQ76930_REG_SYS_STAT_OCD) | (1 << BQ76930_REG_SYS_STAT_SCD) | (1 << BQ76930_REG_SYS_STAT_UV)))
+		{
+			pack->bq_regs[reg] &= ~(1 << BQ76930_REG_SYS_CTRL2_DSG_ON);
+		}
+
+		if (stat & (1 << BQ76930_REG_SYS_STAT_OV))
+		{
+			pack->bq_regs[reg] &= ~(1 << BQ76930_REG_SYS_CTRL2_CHG_ON);
+		}
+		break;
+
+	default:
+		pack->bq_regs[reg] = data[0];
+		break;
+	}
+
+	return HAL_OK;
+}
+
+static HAL_StatusTypeDef sim_pack_tcaRead(void *ctx, uint8_t reg, uint8_t *data, uint16_t size)
+{
+	sim_pack_S *pack = ctx;
+
+	uint8_t inp = pack->tca_regs[TCA9534_REG_OUT] & ~pack->tca_regs[TCA9534_REG_CFG];
+
+	if (pack->bq_regs[BQ76930_REG_SYS_STAT] & 0x3F)
+	{
+		inp |= (1 << TCA_BQ_ALERT);
+	}
+
+	pack->tca_regs[TCA9534_REG_INP] = inp ^ pack->tca_regs[TCA9534_REG_POL];
+
+	for (uint16_t i = 0; i < size; i++)
+	{
+		data[i] = pack->tca_regs[(reg + i) % SIM_TCA_REG_COUNT];
+	}
+
+	return HAL_OK;
+}
+
+static HAL_StatusTypeDef sim_pack_tcaWrite(void *ctx, uint8_t reg, const uint8_t *data, uint16_t size)
+{
+	sim_pack_S *pack = ctx;
+
+	for (uint16_t i = 0; i < size; i++)
+	{
+		if (((reg + i) % SIM_TCA_REG_COUNT) != TCA9534_REG_INP)
+		{
+			pack->tca_regs[(reg + i) % SIM_TCA_REG_COUNT] = data[i];
+		}
+	}
+
+	return HAL_OK;
+}
+
+static double sim_pack_adcInputMv(sim_pack_S *pack)
+{
+	if (!sim_pack_tcaOutput(pack, TCA_TMUX_EN))
+	{
+		return 0;
+	}
+
+	switch ((pack->tca_regs[TCA9534_REG_OUT] >> TMUX_SEL_SHIFT) & 3)
+	{
+	case 0:
+		// hall output sits at ground until the sensor has powered up
+		if (pack->sns_on_ms < HALL_WARMUP_MS)
+		{
+			return 0;
+		}
+		return HALL_ZERO_MV + (pack->current_ma / HALL_MA_PER_MV);
+
+	case 1:
+		return sim_pack_ntcMv(pack->fet_temp_c);
+
+	case 2:
+		return sim_pack_tcaOutput(pack, TCA_PMON_EN) ? (pack->load_mv / DIVIDER_RATIO) : 0;
+
+	case 3:
+	default:
+		return pack->charger_mv / DIVIDER_RATIO;
+	}
+}
+
+static uint16_t sim_pack_adcConvert(sim_pack_S *pack)
+{
+	// +-1 count of noise from a small lcg
+	pack->adc_noise = (pack->adc_noise * 1103515245) + 12345;
+
+	int32_t value = (int32_t)((sim_pack_adcInputMv(pack) * 4096.0) / ADC_REF_MV) + (int32_t)((pack->adc_noise >> 16) % 3) - 1;
+
+	if (value < 0)
+	{
+		value = 0;
+	}
+
+	if (value > 0x0FFF)
+	{
+		value = 0x0FFF;
+	}
+
+	if (value < pack->adc_lowest)
+	{
+		pack->adc_lowest = value;
+	}
+
+	if (value > pack->adc_highest)
+	{
+		pack->adc_highest = value;
+	}
+
+	if (pack->adc_config & (1 << ADC121_REG_CFG_ALERT_FLAG))
+	{
+		if (value > pack->adc_alert_high)
+		{
+			pack->adc_status |= (1 << ADC121_REG_STS_OVER);
+		}
+		else if (value < pack->adc_alert_low)
+		{
+			pack->adc_status |= (1 << ADC121_REG_STS_UNDER);
+		}
+		else if (!(pack->adc_config & (1 << ADC121_REG_CFG_ALERT_HOLD)) && (value >= (pack->adc_alert_low + pack->adc_hyst)) && (value <= (pack->adc_alert_high - pack->adc_hyst)))
+		{
+			pack->adc_status = 0;
+		}
+	}
+
+	return value;
+}
+
+static uint16_t *sim_pack_adcReg16(sim_pack_S *pack, uint8_t reg)
+{
+	switch (reg)
+	{
+	case ADC121_REG_ALERT_LOW: return &pack->adc_alert_low;
+	case ADC121_REG_ALERT_HIGH: return &pack->adc_alert_high;
+	case ADC121_REG_HYST: return &pack->adc_hyst;
+	case ADC121_REG_LOWEST: return &pack->adc_lowest;
+	case ADC121_REG_HIGHEST: return &pack->adc_highest;
+	default: return NULL;
+	}
+}
+
+static HAL_StatusTypeDef sim_pack_adcRead(void *ctx, uint8_t reg, uint8_t *data, uint16_t size)
+{
+	sim_pack_S *pack = ctx;
+	uint16_t *reg16 = sim_pack_adcReg16(pack, reg);
+
+	if ((reg == ADC121_REG_RES) && (size == 2))
+	{
+		uint16_t value = sim_pack_adcConvert(pack);
+
+		if (pack->adc_status)
+		{
+			value |= (1 << ADC121_REG_RES_ALERT);
+		}
+
+		data[0] = value >> 8;
+		data[1] = value & 0xFF;
+	}
+	else if (reg == ADC121_REG_STS)
+	{
+		data[0] = pack->adc_status;
+	}
+	else if (reg == ADC121_REG_CFG)
+	{
+		data[0] = pack->adc_config;
+	}
+	else if ((reg16 != NULL) && (size == 2))
+	{
+		data[0] = *reg16 >> 8;
+		data[1] = *reg16 & 0xFF;
+	}
+	else
+	{
+		return HAL_ERROR;
+	}
+
+	return HAL_OK;
+}
+
+static HAL_StatusTypeDef sim_pack_adcWrite(void *ctx, uint8_t reg, const uint8_t *data, uint16_t size)
+{
+	sim_pack_S *pack = ctx;
+	uint16_t *reg16 = sim_pack_adcReg16(pack, reg);
+
+	if (reg == ADC121_REG_STS)
+	{
+		pack->adc_status &= ~data[0];
+	}
+	else if (reg == ADC121_REG_CFG)
+	{
+		pack->adc_config = data[0];
+	}
+	else if ((reg16 != NULL) && (size == 2))
+	{
+		*reg16 = ((uint16_t)(data[0] << 8) | data[1]) & 0x0FFF;
+	}
+	else
+	{
+		return HAL_ERROR;
+	}
+
+	return HAL_OK;
+}
+
+void sim_pack_init(sim_pack_S *pack, const sim_packConfig_S *config)
+{
+	memset(pack, 0, sizeof(sim_pack_S));
+
+	pack->config = *config;
+
+	for (uint32_t i = 0; i < SIM_CELL_COUNT; i++)
+	{
+		// spread evenly and reproducibly around the mean, shuffled by the seed
+		double k = (((i * 7 + config->seed) % SIM_CELL_COUNT) / (double)(SIM_CELL_COUNT - 1)) - 0.5;
+
+		sim_cell_init(&pack->cells[i], config->capacity_mah * (1.0 + (k * config->capacity_spread)), config->soc + (k * config->soc_spread), config->r0_ohm);
+
+		pack->cells[i].temp_c = config->ambient_c;
+	}
+
+	pack->fet_temp_c = config->ambient_c;
+	pack->adc_lowest = 0x0FFF;
+	pack->adc_alert_high = 0x0FFF;
+	pack->adc_noise = config->seed;
+
+	// power on defaults, all tca pins are inputs
+	pack->tca_regs[TCA9534_REG_OUT] = 0xFF;
+	pack->tca_regs[TCA9534_REG_CFG] = 0xFF;
+}
+
+void sim_pack_attach(sim_pack_S *pack)
+{
+	fake_hal_attachI2C(BQ76930_I2C_ADDR, sim_pack_bqRead, sim_pack_bqWrite, pack);
+	fake_hal_attachI2C(TCA9534_I2C_ADDR, sim_pack_tcaRead, sim_pack_tcaWrite, pack);
+	fake_hal_attachI2C(ADC121_I2C_ADDR, sim_pack_adcRead, sim_pack_adcWrite, pack);
+}
+
+void sim_pack_step(sim_pack_S *pack, int32_t load_ma, uint32_t charger_mv, uint32_t dt_ms)
+{
+	double dt_s = dt_ms / 1000.0;
+	uint8_t ctrl2 = pack->bq_regs[BQ76930_REG_SYS_CTRL2];
+	uint8_t cp = sim_pack_tcaOutput(pack, TCA_CP_EN);
+
+	// high side fets need the charge pump for gate drive
+	pack->chg_on = cp && (ctrl2 & (1 << BQ76930_REG_SYS_CTRL2_CHG_ON));
+	pack->dsg_on = cp && (ctrl2 & (1 << BQ76930_REG_SYS_CTRL2_DSG_ON));
+	pack->pch_on = sim_pack_tcaOutput(pack, TCA_PCHG_EN);
+	pack->sns_on_ms = sim_pack_tcaOutput(pack, TCA_SNS_EN) ? (pack->sns_on_ms + dt_ms) : 0;
+	pack->charger_mv = charger_mv;
+
+	double ocv_sum = 0;
+	double r0_sum = 0;
+	double terminal_sum = 0;
+
+	for (uint32_t i = 0; i < SIM_CELL_COUNT; i++)
+	{
+		ocv_sum += sim_cell_getOcv(&pack->cells[i]) - pack->cells[i].v_rc;
+		r0_sum += pack->cells[i].r0_ohm;
+		terminal_sum += sim_pack_getCellVoltage(pack, i);
+	}
+
+	double current = 0;
+
+	if ((load_ma < 0) && pack->chg_on)
+	{
+		current = load_ma;
+
+		// cc up to the requested current, tapering as the pack reaches the charger voltage
+		if (charger_mv > 0)
+		{
+			double cv = -(charger_mv - ocv_sum) / r0_sum;
+
+			current = (cv > load_ma) ? cv : load_ma;
+			current = (current > 0) ? 0 : current;
+		}
+	}
+	else if ((load_ma > 0) && pack->dsg_on)
+	{
+		current = load_ma;
+	}
+
+	double precharge = 0;
+
+	if (pack->dsg_on)
+	{
+		pack->load_mv = terminal_sum - (current * FET_R_OHM);
+	}
+	else if ((charger_mv > 0) && pack->chg_on)
+	{
+		pack->load_mv = charger_mv;
+	}
+	else
+	{
+		double load = (pack->load_mv / LOAD_LEAK_OHM) + ((load_ma > 0) ? load_ma : 0);
+
+		if (pack->pch_on)
+		{
+			precharge = (terminal_sum - pack->load_mv) / PCH_R_OHM;
+		}
+
+		pack->load_mv += (precharge - load) * dt_s / LOAD_C_F;
+
+		if (pack->load_mv < 0)
+		{
+			pack->load_mv = 0;
+		}
+	}
+
+	pack->current_ma = current + precharge;
+
+	for (uint32_t i = 0; i < SIM_CELL_COUNT; i++)
+	{
+		sim_cell_S *cell = &pack->cells[i];
+		double bleed = sim_pack_getBalancing(pack, i) ? (sim_pack_getCellVoltage(pack, i) / BALANCE_R_OHM) : 0;
+		double heat_w = (pack->current_ma / 1000.0) * (pack->current_ma / 1000.0) * cell->r0_ohm;
+
+		sim_cell_step(cell, pack->current_ma + bleed, dt_s);
+
+		cell->temp_c += ((pack->config.ambient_c + (heat_w * CELL_RTH_K_W)) - cell->temp_c) * (dt_s / CELL_TAU_S);
+	}
+
+	double fet_w = (current / 1000.0) * (current / 1000.0) * FET_R_OHM;
+
+	pack->fet_temp_c += ((pack->config.ambient_c + (fet_w * FET_RTH_K_W)) - pack->fet_temp_c) * (dt_s / FET_TAU_S);
+
+	sim_pack_bqProtect(pack, (pack->current_ma / 1000.0) * SENSE_R_MOHM, dt_ms);
+
+	pack->bq_adc_ms += dt_ms;
+
+	if (pack->bq_adc_ms >= BQ_ADC_PERIOD_MS)
+	{
+		pack->bq_adc_ms = 0;
+
+		if (pack->bq_regs[BQ76930_REG_SYS_CTRL1] & (1 << BQ76930_REG_SYS_CTRL1_ADC_EN))
+		{
+			sim_pack_bqRefresh(pack);
+		}
+	}
+}
+
+double sim_pack_getCellVoltage(const sim_pack_S *pack, uint32_t cell)
+{
+	return sim_cell_getVoltage(&pack->cells[cell]);
+}
+
+double sim_pack_getCellSpread(const sim_pack_S *pack)
+{
+	double v_min = sim_cell_getOcv(&pack->cells[0]);
+	double v_max = v_min;
+
+	for (uint32_t i = 1; i < SIM_CELL_COUNT; i++)
+	{
+		double v = sim_cell_getOcv(&pack->cells[i]);
+
+		v_min = (v < v_min) ? v : v_min;
+		v_max = (v > v_max) ? v : v_max;
+	}
+
+	return v_max - v_min;
+}
+
+double sim_pack_getCharge(const sim_pack_S *pack)
+{
+	double charge = 0;
+
+	for (uint32_t i = 0; i < SIM_CELL_COUNT; i++)
+	{
+		charge += pack->cells[i].charge_mas;
+	}
+
+	return charge / SIM_CELL_COUNT;
+}
+
+double sim_pack_getMaxTemp(const sim_pack_S *pack)
+{
+	double t = pack->cells[0].temp_c;
+
+	for (uint32_t i = 1; i < SIM_CELL_COUNT; i++)
+	{
+		t = (pack->cells[i].temp_c > t) ? pack->cells[i].temp_c : t;
+	}
+
+	return t;
+}
+
+uint8_t sim_pack_getBalancing(const sim_pack_S *pack, uint32_t cell)
+{
+	uint32_t bq_cell = bq_cell_map[cell];
+
+	return (pack->bq_regs[BQ76930_REG_CELLBAL1 + (bq_cell / 5)] >> (bq_cell % 5)) & 1;
+}
@@ -0,0 +1,75 @@
+#ifndef __SIM_PACK_H__
+#define __SIM_PACK_H__
+
+#include <stdint.h>
+
+#include "sim_cell.h"
+
+// Behavioural model of the 13S4P pack and board around the controller. The
+// three i2c parts are register level models on top of the cell, fet, load
+// and thermal physics, attached to the fake hal i2c bus.
+
+#define SIM_CELL_COUNT 13
+#define SIM_BQ_REG_COUNT 0x60
+#define SIM_TCA_REG_COUNT 4
+
+typedef struct
+{
+	double capacity_mah;
+	double soc; // mean initial soc, 0..1
+	double soc_spread; // initial soc spread across cells, 0..1
+	double capacity_spread;
+	double r0_ohm;
+	double ambient_c;
+	uint32_t seed;
+} sim_packConfig_S;
+
+typedef struct
+{
+	sim_cell_S cells[SIM_CELL_COUNT];
+	sim_packConfig_S config;
+
+	// bq76930
+	uint8_t bq_regs[SIM_BQ_REG_COUNT];
+	uint32_t bq_adc_ms;
+	uint32_t ocd_ms;
+	uint32_t scd_ms;
+	uint32_t ov_ms;
+	uint32_t uv_ms;
+
+	// tca9534
+	uint8_t tca_regs[SIM_TCA_REG_COUNT];
+	uint32_t sns_on_ms;
+
+	// adc121
+	uint8_t adc_config;
+	uint8_t adc_status;
+	uint16_t adc_alert_low;
+	uint16_t adc_alert_high;
+	uint16_t adc_hyst;
+	uint16_t adc_lowest;
+	uint16_t adc_highest;
+	uint32_t adc_noise;
+
+	// board
+	double load_mv;
+	double current_ma;
+	double charger_mv;
+	double fet_temp_c;
+	uint8_t chg_on;
+	uint8_t dsg_on;
+	uint8_t pch_on;
+	uint32_t bq_write_errors;
+} sim_pack_S;
+
+void sim_pack_init(sim_pack_S *pack, const sim_packConfig_S *config);
+void sim_pack_attach(sim_pack_S *pack);
+void sim_pack_step(sim_pack_S *pack, int32_t load_ma, uint32_t charger_mv, uint32_t dt_ms);
+
+double sim_pack_getCellVoltage(const sim_pack_S *pack, uint32_t cell);
+double sim_pack_getCellSpread(const sim_pack_S *pack);
+double sim_pack_getCharge(const sim_pack_S *pack);
+double sim_pack_getMaxTemp(const sim_pack_S *pack);
+uint8_t sim_pack_getBalancing(const sim_pack_S *pack, uint32_t cell);
+
+#endif // __SIM_PACK_H__
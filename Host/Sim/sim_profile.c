@@ -0,0 +1,73 @@
+#include "sim_profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int sim_profile_load(sim_profile_S *profile, const char *path)
+{
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL)
+	{
+		return -1;
+	}
+
+	uint32_t capacity = 64;
+	char line[256];
+
+	profile->steps = malloc(capacity * sizeof(sim_profileStep_S));
+	profile->count = 0;
+	profile->index = 0;
+
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		double time_s;
+		double current_a;
+		double charger_v = 0;
+
+		if ((line[0] == '#') || (sscanf(line, "%lf %lf %lf", &time_s, &current_a, &charger_v) < 2))
+		{
+			continue;
+		}
+
+		if (profile->count == capacity)
+		{
+			capacity *= 2;
+			profile->steps = realloc(profile->steps, capacity * sizeof(sim_profileStep_S));
+		}
+
+		sim_profileStep_S *step = &profile->steps[profile->count++];
+
+		step->time_ms = (uint32_t)(time_s * 1000);
+		step->current_ma = (int32_t)(current_a * 1000);
+		step->charger_mv = (uint32_t)(charger_v * 1000);
+	}
+
+	fclose(f);
+
+	return (profile->count > 0) ? 0 : -1;
+}
+
+void sim_profile_free(sim_profile_S *profile)
+{
+	free(profile->steps);
+
+	profile->steps = NULL;
+	profile->count = 0;
+}
+
+const sim_profileStep_S *sim_profile_get(sim_profile_S *profile, uint32_t time_ms)
+{
+	// time only moves forward, walk from the last step
+	while (((profile->index + 1) < profile->count) && (profile->steps[profile->index + 1].time_ms <= time_ms))
+	{
+		profile->index++;
+	}
+
+	return &profile->steps[profile->index];
+}
+
+uint32_t sim_profile_getDuration(const sim_profile_S *profile)
+{
+	return profile->steps[profile->count - 1].time_ms;
+}
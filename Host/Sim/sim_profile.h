@@ -0,0 +1,30 @@
+#ifndef __SIM_PROFILE_H__
+#define __SIM_PROFILE_H__
+
+#include <stdint.h>
+
+// Load profile, one step per line: time_s current_a [charger_v]
+// Positive current is drawn from the pack, a charger voltage connects a
+// charger that pushes current into the pack up to -current_a. Each step
+// holds until the next line, '#' starts a comment.
+
+typedef struct
+{
+	uint32_t time_ms;
+	int32_t current_ma;
+	uint32_t charger_mv;
+} sim_profileStep_S;
+
+typedef struct
+{
+	sim_profileStep_S *steps;
+	uint32_t count;
+	uint32_t index;
+} sim_profile_S;
+
+int sim_profile_load(sim_profile_S *profile, const char *path);
+void sim_profile_free(sim_profile_S *profile);
+const sim_profileStep_S *sim_profile_get(sim_profile_S *profile, uint32_t time_ms);
+uint32_t sim_profile_getDuration(const sim_profile_S *profile);
+
+#endif // __SIM_PROFILE_H__
@@ -0,0 +1,33 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// minimal assert framework, a failing check returns from the test function
+
+typedef void (*test_F)(void);
+
+extern uint32_t test_failed;
+
+void test_run(const char *name, test_F fn);
+void test_fail(const char *file, int line, const char *expr, long long a, long long b);
+
+#define TEST_RUN(fn) test_run(#fn, fn)
+
+#define TEST_ASSERT(cond) \
+	do { if (!(cond)) { test_fail(__FILE__, __LINE__, #cond, 0, 0); return; } } while (0)
+
+#define TEST_ASSERT_EQ(a, b) \
+	do { long long _a = (a); long long _b = (b); \
+		if (_a != _b) { test_fail(__FILE__, __LINE__, #a " == " #b, _a, _b); return; } } while (0)
+
+#define TEST_ASSERT_NEAR(a, b, tol) \
+	do { long long _a = (a); long long _b = (b); \
+		if ((_a - _b > (tol)) || (_b - _a > (tol))) { test_fail(__FILE__, __LINE__, #a " ~= " #b, _a, _b); return; } } while (0)
+
+void test_drivers(void);
+void test_battery(void);
+void test_controller(void);
+
+#endif // __TEST_H__
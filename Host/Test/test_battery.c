@@ -0,0 +1,347 @@
+#include "test.h"
+
+#include "fake_devices.h"
+
+#include "battery.h"
+#include "blackbox.h"
+#include "eeprom.h"
+
+// adc counts for the default current calibration, 62.5 mA/mV about 1635 mV
+#define CURRENT_ZERO_ADC 2029
+#define CURRENT_ADC_PER_A 20
+
+extern UART_HandleTypeDef hlpuart1;
+
+static fake_board_S board;
+
+static void run(uint32_t ms)
+{
+	for (uint32_t i = 0; i < ms; i++)
+	{
+		fake_hal_advanceTick(1);
+
+		batt_sample();
+
+		if ((HAL_GetTick() % 100) == 0)
+		{
+			batt_update();
+		}
+	}
+}
+
+static void setup(void)
+{
+	fake_board_init(&board);
+	fake_hal_setTick(1000);
+
+	batt_init();
+}
+
+static void closeFets(void)
+{
+	batt_setFetState(FET_CHG, FET_ON);
+	batt_setFetState(FET_DSG, FET_ON);
+}
+
+static void test_eeprom_recordRoundTrip(void)
+{
+	uint32_t data[3] = { 1, 2, 3 };
+	uint32_t out[3];
+
+	fake_hal_reset();
+
+	TEST_ASSERT_EQ(eeprom_readRecord(0x40, out, sizeof(out)), HAL_ERROR);
+	TEST_ASSERT_EQ(eeprom_writeRecord(0x40, data, sizeof(data)), HAL_OK);
+	TEST_ASSERT_EQ(eeprom_readRecord(0x40, out, sizeof(out)), HAL_OK);
+	TEST_ASSERT_EQ(out[2], 3);
+
+	fake_hal_eeprom[0x44] ^= 1;
+
+	TEST_ASSERT_EQ(eeprom_readRecord(0x40, out, sizeof(out)), HAL_ERROR);
+	TEST_ASSERT_EQ(eeprom_write(0x41, data, 4), HAL_ERROR);
+	TEST_ASSERT_EQ(eeprom_write(0xFC, data, 8), HAL_ERROR);
+}
+
+static void test_battery_initReadsPack(void)
+{
+	setup();
+
+	TEST_ASSERT_EQ(batt_getFaultMask(), 0);
+
+	run(1000);
+
+	TEST_ASSERT_NEAR(batt_getCellVoltage(CELL_SUM), 13 * 3700, 13);
+	TEST_ASSERT_NEAR(batt_getPackVoltage(), 48100, 50);
+	TEST_ASSERT_NEAR(batt_getTemp(TEMP_FET), 25, 2);
+	TEST_ASSERT_NEAR(batt_getTemp(TEMP_MAX), 25, 2);
+}
+
+static void test_battery_currentConversion(void)
+{
+	setup();
+	closeFets();
+
+	run(200);
+
+	TEST_ASSERT_NEAR(batt_getPackCurrent(), 0, 100);
+
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (10 * CURRENT_ADC_PER_A));
+
+	run(200);
+
+	TEST_ASSERT_NEAR(batt_getPackCurrent(), 10000, 200);
+	TEST_ASSERT_NEAR(batt_getPackCurrentFast(), 10000, 200);
+}
+
+static void test_battery_chargeIntegration(void)
+{
+	setup();
+	closeFets();
+
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (10 * CURRENT_ADC_PER_A));
+
+	run(100);
+	(void)batt_takeCharge();
+	run(1000);
+
+	// 10 A for a second, minus the pack windows the fast filter holds across
+	TEST_ASSERT_NEAR(batt_takeCharge(), 10000, 300);
+}
+
+static void test_battery_currentAlertOpensFets(void)
+{
+	setup();
+	closeFets();
+
+	run(200);
+
+	TEST_ASSERT_EQ(board.bq.regs[0x05] & 0x3, 0x3);
+
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (50 * CURRENT_ADC_PER_A));
+
+	run(10);
+
+	TEST_ASSERT_EQ(batt_getFetState(FET_DSG), FET_OFF);
+	TEST_ASSERT_EQ(board.bq.regs[0x05] & 0x3, 0);
+	TEST_ASSERT_NEAR(batt_getOverCurrentPeak(), 50000, 500);
+
+	run(100);
+
+	TEST_ASSERT_EQ(batt_getFault(FAULT_OC), 1);
+}
+
+static void test_battery_fuseCurve(void)
+{
+	setup();
+	closeFets();
+
+	run(200);
+
+	// a 35 A burst rides through, ~40 % of the way to its trip
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (35 * CURRENT_ADC_PER_A));
+
+	run(1000);
+
+	TEST_ASSERT_EQ(batt_getFetState(FET_DSG), FET_ON);
+	TEST_ASSERT_NEAR(batt_getFuseHeat(), 39, 3);
+
+	// rated current drains it
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (15 * CURRENT_ADC_PER_A));
+
+	run(15000);
+
+	TEST_ASSERT_EQ(batt_getFuseHeat(), 0);
+
+	// 30 A held trips after 3.5 s
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (30 * CURRENT_ADC_PER_A));
+
+	run(3400);
+
+	TEST_ASSERT_EQ(batt_getFetState(FET_DSG), FET_ON);
+
+	run(200);
+
+	TEST_ASSERT_EQ(batt_getFetState(FET_DSG), FET_OFF);
+	TEST_ASSERT_EQ(board.bq.regs[0x05] & 0x3, 0);
+
+	run(100);
+
+	TEST_ASSERT_EQ(batt_getFault(FAULT_OC), 1);
+}
+
+static void test_blackbox_capturesAlert(void)
+{
+	blackbox_header_S header;
+	blackbox_sample_S sample;
+
+	setup();
+	blackbox_init();
+	closeFets();
+
+	run(500);
+
+	TEST_ASSERT_EQ(blackbox_getHeader(&header), HAL_ERROR);
+
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (50 * CURRENT_ADC_PER_A));
+
+	// with the fets open the current is only visited in windows, the post-trigger timeout ends it
+	run(BLACKBOX_POST_TIMEOUT_MS + 100);
+	blackbox_update();
+
+	TEST_ASSERT_EQ(blackbox_getHeader(&header), HAL_OK);
+	TEST_ASSERT_EQ(header.fault, FAULT_OC);
+	TEST_ASSERT_EQ(header.count, BLACKBOX_LEN);
+	TEST_ASSERT(header.trigger < (BLACKBOX_LEN - 1));
+
+	// the qualifying sample still has the fets closed, the ones after it do not
+	TEST_ASSERT_EQ(blackbox_getSample(header.trigger, &sample), HAL_OK);
+	TEST_ASSERT_NEAR(sample.current, 5000, 50);
+	TEST_ASSERT_EQ(sample.fet, BLACKBOX_FET_CHG | BLACKBOX_FET_DSG);
+	TEST_ASSERT_EQ(blackbox_getSample(header.trigger + 1, &sample), HAL_OK);
+	TEST_ASSERT_EQ(sample.fet, 0);
+	TEST_ASSERT_EQ(blackbox_getSample(0, &sample), HAL_OK);
+	TEST_ASSERT_NEAR(sample.current, 0, 50);
+
+	uint16_t first_tick = sample.tick;
+
+	// a reset restores the capture from eeprom and dumps it once
+	blackbox_init();
+
+	TEST_ASSERT(blackbox_isDumping());
+	TEST_ASSERT_EQ(blackbox_getHeader(&header), HAL_OK);
+	TEST_ASSERT_EQ(header.stored, 1);
+	TEST_ASSERT_EQ(header.count, BLACKBOX_LEN);
+	TEST_ASSERT_EQ(blackbox_getSample(header.trigger, &sample), HAL_OK);
+	TEST_ASSERT_NEAR(sample.current, 5000, 64);
+	TEST_ASSERT_EQ(blackbox_getSample(0, &sample), HAL_OK);
+	TEST_ASSERT_EQ(sample.tick, first_tick);
+
+	uint32_t total = sizeof(blackbox_header_S) + (BLACKBOX_LEN * sizeof(blackbox_sample_S));
+	uint32_t sent = 0;
+
+	while (blackbox_isDumping())
+	{
+		uint32_t len;
+
+		TEST_ASSERT_EQ(blackbox_drain(&hlpuart1), HAL_OK);
+
+		const uint8_t *tx = fake_hal_getUartTx(&len);
+
+		TEST_ASSERT_EQ(tx[0], BLACKBOX_SYNC_0);
+		TEST_ASSERT_EQ(tx[1], BLACKBOX_SYNC_1);
+		TEST_ASSERT_EQ(len, BLACKBOX_CHUNK_HEADER + tx[2]);
+
+		sent += tx[2];
+	}
+
+	TEST_ASSERT_EQ(sent, total);
+	TEST_ASSERT_EQ(blackbox_getHeader(&header), HAL_ERROR);
+}
+
+static void test_blackbox_capturesBqTrip(void)
+{
+	blackbox_header_S header;
+	blackbox_sample_S sample;
+
+	setup();
+	blackbox_init();
+	closeFets();
+
+	// just past an update and clear of the pack voltage visit, the next sys_stat read is 100 ms out
+	run(520);
+
+	// a short spike under the adc121 window, then the bq scd opens the fets on its own
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (45 * CURRENT_ADC_PER_A));
+
+	run(4);
+
+	uint32_t trip_tick = HAL_GetTick();
+
+	board.bq.regs[0x00] |= (1 << 1);
+	board.bq.regs[0x05] &= ~0x3;
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC);
+
+	run(BLACKBOX_POST_TIMEOUT_MS + 100);
+	blackbox_update();
+
+	TEST_ASSERT_EQ(blackbox_getHeader(&header), HAL_OK);
+	TEST_ASSERT_EQ(header.fault, FAULT_SC);
+	TEST_ASSERT((header.tick - trip_tick) <= 2);
+	TEST_ASSERT_EQ(batt_getFault(FAULT_SC), 1);
+
+	// the spike sits inside the pre-trigger window
+	uint8_t spike = 0;
+
+	for (uint32_t i = 0; i <= header.trigger; i++)
+	{
+		TEST_ASSERT_EQ(blackbox_getSample(i, &sample), HAL_OK);
+
+		spike |= (sample.current > 4000);
+	}
+
+	TEST_ASSERT(spike);
+}
+
+static void test_battery_storageRailsOff(void)
+{
+	setup();
+
+	run(3000);
+
+	// sense rails only come up for the sparse storage windows
+	TEST_ASSERT(batt_getQuiescentCurrent() < 2000);
+	TEST_ASSERT_EQ(fake_board_getOutput(&board, 5), 0);
+
+	closeFets();
+
+	run(1000);
+
+	TEST_ASSERT(batt_getQuiescentCurrent() > 10000);
+}
+
+static void test_battery_calibrationPersists(void)
+{
+	batt_cal_S cal;
+
+	setup();
+	closeFets();
+
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + 10);
+
+	// refused with a current path, and until the sensor has settled after one
+	TEST_ASSERT_EQ(batt_calibrateOffset(SENSE_CURRENT), HAL_ERROR);
+
+	batt_setFetState(FET_CHG, FET_OFF);
+	batt_setFetState(FET_DSG, FET_OFF);
+
+	TEST_ASSERT_EQ(batt_calibrateOffset(SENSE_CURRENT), HAL_ERROR);
+
+	run(500);
+
+	TEST_ASSERT_EQ(batt_calibrateOffset(SENSE_CURRENT), HAL_OK);
+	TEST_ASSERT_EQ(batt_saveCalibration(), HAL_OK);
+
+	batt_init();
+	batt_getCalibration(SENSE_CURRENT, &cal);
+
+	TEST_ASSERT_EQ(cal.offset, (CURRENT_ZERO_ADC + 10) << 8);
+
+	closeFets();
+	run(200);
+
+	TEST_ASSERT_NEAR(batt_getPackCurrent(), 0, 100);
+}
+
+void test_battery(void)
+{
+	TEST_RUN(test_eeprom_recordRoundTrip);
+	TEST_RUN(test_battery_initReadsPack);
+	TEST_RUN(test_battery_currentConversion);
+	TEST_RUN(test_battery_chargeIntegration);
+	TEST_RUN(test_battery_currentAlertOpensFets);
+	TEST_RUN(test_battery_fuseCurve);
+	TEST_RUN(test_blackbox_capturesAlert);
+	TEST_RUN(test_blackbox_capturesBqTrip);
+	TEST_RUN(test_battery_storageRailsOff);
+	TEST_RUN(test_battery_calibrationPersists);
+}
@@ -0,0 +1,790 @@
+#include "test.h"
+
+#include "fake_devices.h"
+
+#include "controller.h"
+#include "datalog.h"
+#include "energy.h"
+#include "thermal.h"
+#include "main.h"
+#include "resistance.h"
+#include "soh.h"
+#include "sop.h"
+#include "usage.h"
+#include "watchdog.h"
+
+#include <string.h>
+
+#define CURRENT_ZERO_ADC 2029
+#define CURRENT_ADC_PER_A 20
+
+static fake_board_S board;
+static uint32_t datalog_bytes;
+static uint16_t datalog_chunk_max;
+
+static void datalogSink(void *ctx, const uint8_t *data, uint16_t size)
+{
+	(void)ctx;
+
+	if ((size == (DATALOG_CHUNK_HEADER + data[2])) && (data[0] == DATALOG_SYNC_0) && (data[1] == DATALOG_SYNC_1))
+	{
+		datalog_bytes += data[2];
+		datalog_chunk_max = (size > datalog_chunk_max) ? size : datalog_chunk_max;
+	}
+}
+
+static void run(uint32_t ms)
+{
+	for (uint32_t i = 0; i < ms; i++)
+	{
+		fake_hal_advanceTick(1);
+
+		controller_run();
+	}
+}
+
+static void setup(void)
+{
+	fake_board_init(&board);
+	fake_hal_setTick(1000);
+
+	controller_init();
+}
+
+static void test_controller_bootToIdle(void)
+{
+	setup();
+
+	run(50);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_OFF);
+
+	// the afe reads clean on the first loop, no fixed wait in off
+	run(450);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_IDLE);
+	TEST_ASSERT_EQ(board.bq.regs[0x05] & 0x3, 0x3);
+	TEST_ASSERT(fake_hal_getUartTxCount() > 0);
+}
+
+static void frameCapture(void *ctx, const uint8_t *data, uint16_t size)
+{
+	if (size == sizeof(controller_data_S))
+	{
+		memcpy(ctx, data, size);
+	}
+}
+
+static void test_controller_wakeToDischarge(void)
+{
+	controller_data_S frame = { 0 };
+	uint32_t dsg_tick = 0;
+
+	setup();
+
+	// let the last frame of the previous run go out first
+	run(1);
+
+	fake_hal_setUartSink(frameCapture, &frame);
+
+	while ((dsg_tick == 0) && (HAL_GetTick() < 1500))
+	{
+		run(1);
+
+		dsg_tick = (board.bq.regs[0x05] & 0x2) ? HAL_GetTick() : 0;
+
+		// nothing to report until the fet is really on
+		TEST_ASSERT((frame.code != CONTROLLER_DATA_CODE) || dsg_tick || (frame.wake_dsg_ms == CONTROLLER_WAKE_PENDING));
+	}
+
+	TEST_ASSERT(dsg_tick != 0);
+
+	run(100);
+
+	fake_hal_setUartSink(NULL, NULL);
+
+	// stamped in the loop that wrote sys_ctrl2
+	TEST_ASSERT_EQ(frame.code, CONTROLLER_DATA_CODE);
+	TEST_ASSERT_EQ(frame.wake_dsg_ms, dsg_tick - 1000);
+}
+
+static void sendCommand(const uint8_t *bytes, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i++)
+	{
+		fake_hal_uartReceive(bytes[i]);
+	}
+}
+
+static void test_controller_calibrationCommands(void)
+{
+	controller_data_S frame = { 0 };
+	batt_cal_S cal = { 0 };
+
+	setup();
+
+	run(500);
+
+	fake_hal_setUartSink(frameCapture, &frame);
+
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + 10);
+
+	// idle has the fets closed, whatever flows would be taken as the zero
+	const uint8_t offset[] = { CONTROLLER_CMD_CAL_OFFSET, SENSE_CURRENT };
+
+	batt_getCalibration(SENSE_CURRENT, &cal);
+
+	int32_t offset_default = cal.offset;
+
+	sendCommand(offset, sizeof(offset));
+	run(200);
+
+	batt_getCalibration(SENSE_CURRENT, &cal);
+
+	TEST_ASSERT_EQ(frame.cal_status, HAL_ERROR);
+	TEST_ASSERT_EQ(cal.offset, offset_default);
+
+	// a latched bq fault opens them, the zero is taken once the sensor has settled
+	board.bq.regs[0x00] |= (1 << 2);
+
+	run(700);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_FAULT);
+
+	sendCommand(offset, sizeof(offset));
+
+	// the loop that blocked on the capture still feeds the watchdog
+	for (uint32_t i = 0; (i < 200) && (cal.offset != ((CURRENT_ZERO_ADC + 10) << 8)); i++)
+	{
+		IWDG->KR = 0;
+		run(1);
+		batt_getCalibration(SENSE_CURRENT, &cal);
+	}
+
+	TEST_ASSERT_EQ(cal.offset, (CURRENT_ZERO_ADC + 10) << 8);
+	TEST_ASSERT_EQ(IWDG->KR, 0xAAAA);
+
+	run(200);
+
+	TEST_ASSERT_EQ(frame.cal_status, HAL_OK);
+
+	// 10 A reference, read as 12.5 A through the default gain
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + 10 + 250);
+
+	const uint8_t gain[] = { CONTROLLER_CMD_CAL_GAIN, SENSE_CURRENT, 0x10, 0x27, 0x00, 0x00 };
+
+	sendCommand(gain, sizeof(gain));
+
+	// the open fets leave current on the storage schedule
+	run(1100);
+
+	TEST_ASSERT_EQ(frame.cal_status, HAL_OK);
+	TEST_ASSERT_NEAR(batt_getPackCurrent(), 10000, 100);
+
+	// past the discharge fuse rating the capture would run unprotected
+	const uint8_t gain_high[] = { CONTROLLER_CMD_CAL_GAIN, SENSE_CURRENT, 0xA8, 0x61, 0x00, 0x00 };
+
+	sendCommand(gain_high, sizeof(gain_high));
+	run(200);
+
+	TEST_ASSERT_EQ(frame.cal_status, HAL_ERROR);
+
+	const uint8_t save[] = { CONTROLLER_CMD_CAL_SAVE };
+
+	sendCommand(save, sizeof(save));
+	run(200);
+
+	TEST_ASSERT_EQ(frame.cal_status, HAL_OK);
+
+	batt_cal_S saved;
+
+	batt_getCalibration(SENSE_CURRENT, &cal);
+	batt_resetCalibration();
+	batt_init();
+	batt_getCalibration(SENSE_CURRENT, &saved);
+
+	TEST_ASSERT_EQ(saved.gain, cal.gain);
+
+	// an unknown sense is refused
+	const uint8_t bad[] = { CONTROLLER_CMD_CAL_OFFSET, SENSE_COUNT };
+
+	sendCommand(bad, sizeof(bad));
+	run(200);
+
+	fake_hal_setUartSink(NULL, NULL);
+
+	TEST_ASSERT_EQ(frame.cal_status, HAL_ERROR);
+}
+
+static void test_controller_bootWithoutAfe(void)
+{
+	fake_board_init(&board);
+	fake_hal_attachI2C(0x08, NULL, NULL, NULL);
+	fake_hal_setTick(1000);
+
+	controller_init();
+
+	run(500);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_OFF);
+
+	run(1000);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_FAULT);
+}
+
+static void test_controller_prechargeIntoShort(void)
+{
+	setup();
+
+	// the bus never comes up
+	fake_board_setSense(&board, 2, 0);
+
+	run(600);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_FAULT);
+	TEST_ASSERT(batt_getFault(FAULT_PRECHARGE));
+	TEST_ASSERT_EQ(board.bq.regs[0x05] & 0x3, 0);
+}
+
+static void test_controller_dischargeAndBack(void)
+{
+	setup();
+
+	run(2000);
+
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (5 * CURRENT_ADC_PER_A));
+
+	run(500);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_DISCHARGE);
+
+	// a short stop does not count
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC);
+
+	run(500);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_DISCHARGE);
+
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (5 * CURRENT_ADC_PER_A));
+
+	run(500);
+
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC);
+
+	run(1500);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_IDLE);
+
+	controller_logEntry_S entry;
+
+	TEST_ASSERT_EQ(controller_getLogEntry(0, &entry), HAL_OK);
+	TEST_ASSERT_EQ(entry.from, STATE_DISCHARGE);
+	TEST_ASSERT_EQ(entry.to, STATE_IDLE);
+	TEST_ASSERT_EQ(entry.cause, CAUSE_CURRENT);
+
+	TEST_ASSERT_EQ(controller_getLogEntry(3, &entry), HAL_OK);
+	TEST_ASSERT_EQ(entry.from, STATE_OFF);
+	TEST_ASSERT_EQ(entry.cause, CAUSE_AFE_READY);
+	TEST_ASSERT_EQ(controller_getLogEntry(4, &entry), HAL_ERROR);
+}
+
+static void test_controller_faultOnOverTemp(void)
+{
+	setup();
+
+	run(2000);
+
+	// 60 C itself is still inside the limit
+	fake_board_setThermistor(&board, 1, 2140);
+	run(3000);
+
+	TEST_ASSERT_EQ(batt_getTemp(TEMP_MAX), 60);
+	TEST_ASSERT_EQ(batt_getFaultCount(FAULT_OT), 0);
+
+	fake_board_setThermistor(&board, 1, 10000);
+	run(300);
+
+	// a short spike is filtered by the set time
+	fake_board_setThermistor(&board, 1, 1900);
+	run(300);
+	fake_board_setThermistor(&board, 1, 10000);
+	run(300);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_IDLE);
+	TEST_ASSERT_EQ(batt_getFaultCount(FAULT_OT), 0);
+
+	fake_board_setThermistor(&board, 1, 1900);
+
+	run(2200);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_FAULT);
+	TEST_ASSERT_EQ(board.bq.regs[0x05] & 0x3, 0);
+	TEST_ASSERT_EQ(batt_getFaultCount(FAULT_OT), 1);
+
+	// over-temperature recovers on its own once the pack has cooled
+	fake_board_setThermistor(&board, 1, 10000);
+
+	run(9000);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_FAULT);
+
+	run(3000);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_IDLE);
+	TEST_ASSERT(!batt_getFault(FAULT_OT));
+}
+
+static void test_controller_longPressShutdown(void)
+{
+	setup();
+
+	run(2000);
+
+	fake_hal_setPin(BUTTON_GPIO_Port, BUTTON_Pin, GPIO_PIN_SET);
+
+	run(2500);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_SHUTDOWN);
+	// standby returns on the host, the loop keeps asking for it
+	TEST_ASSERT(fake_hal_getStandbyCount() > 0);
+}
+
+static void test_controller_watchdogStall(void)
+{
+	setup();
+
+	run(500);
+
+	// the loop still spins but only sampling checks in
+	fake_hal_advanceTick(300);
+	watchdog_checkIn(WATCHDOG_TASK_SAMPLE);
+
+	IWDG->KR = 0;
+	watchdog_kick();
+
+	TEST_ASSERT_EQ(IWDG->KR, 0);
+
+	uint16_t resets = watchdog_getResetCount();
+
+	// reboot, the no-init record is all that is left of the previous run
+	fake_board_init(&board);
+	fake_hal_setTick(1000);
+	fake_hal_setResetFlags(RCC_FLAG_IWDGRST);
+
+	controller_init();
+
+	TEST_ASSERT(watchdog_getResetFlags() & (1 << WATCHDOG_RESET_IWDG));
+	TEST_ASSERT_EQ(watchdog_getResetTask(), (WATCHDOG_TASK_UPDATE << 4) | WATCHDOG_TASK_SAMPLE);
+	TEST_ASSERT_EQ(watchdog_getResetCount(), resets + 1);
+
+	run(500);
+
+	TEST_ASSERT_EQ(IWDG->KR, 0xAAAA);
+}
+
+static void test_controller_watchdogLateCheckIn(void)
+{
+	setup();
+
+	run(500);
+
+	// sampling runs late once and catches up
+	fake_hal_advanceTick(60);
+	watchdog_kick();
+
+	run(500);
+
+	TEST_ASSERT_EQ(IWDG->KR, 0xAAAA);
+
+	// then the loop hangs without reaching the supervisor again
+	fake_board_init(&board);
+	fake_hal_setTick(1000);
+	fake_hal_setResetFlags(RCC_FLAG_IWDGRST);
+
+	controller_init();
+
+	TEST_ASSERT_EQ(watchdog_getResetTask() >> 4, WATCHDOG_TASK_NONE);
+}
+
+static void test_controller_watchdogStandbyTimeout(void)
+{
+	fake_board_init(&board);
+	fake_hal_setResetFlags(RCC_FLAG_IWDGRST);
+	fake_hal_setPwrFlags(PWR_FLAG_SB);
+
+	uint16_t resets = watchdog_getResetCount();
+
+	controller_init();
+
+	TEST_ASSERT_EQ(fake_hal_getStandbyCount(), 1);
+	TEST_ASSERT_EQ(watchdog_getResetCount(), resets);
+}
+
+static void test_controller_datalogSurvivesReset(void)
+{
+	datalog_record_S record;
+
+	setup();
+
+	run((2 * DATALOG_PERIOD_MS) + 500);
+
+	TEST_ASSERT_EQ(datalog_getBoot(), 0);
+	TEST_ASSERT_EQ(datalog_getRecordCount(), 2);
+	TEST_ASSERT_EQ(datalog_getRecord(0, &record), HAL_OK);
+	TEST_ASSERT_EQ(record.state, STATE_IDLE);
+	TEST_ASSERT_EQ(record.time_s, (1000 + (2 * DATALOG_PERIOD_MS)) / 1000);
+	TEST_ASSERT(record.v_min > 3000);
+	TEST_ASSERT(record.v_min <= record.v_max);
+	TEST_ASSERT_NEAR(record.i_mean, 0, 10);
+
+	// a record torn by a power loss fails its crc and is skipped
+	fake_hal_flash[DATALOG_OFFSET + sizeof(datalog_pageHeader_S) + sizeof(datalog_record_S) + 4] ^= 0xFF;
+
+	controller_init();
+
+	TEST_ASSERT_EQ(datalog_getBoot(), 1);
+	TEST_ASSERT_EQ(datalog_getRecordCount(), 1);
+
+	run(DATALOG_PERIOD_MS + 500);
+
+	// the new boot opened a fresh page behind the old one
+	TEST_ASSERT_EQ(datalog_getRecordCount(), 2);
+	TEST_ASSERT_EQ(datalog_getRecord(0, &record), HAL_OK);
+	TEST_ASSERT_EQ(record.time_s, (1000 + (3 * DATALOG_PERIOD_MS) + 500) / 1000);
+
+	datalog_bytes = 0;
+	datalog_chunk_max = 0;
+	fake_hal_setUartSink(datalogSink, NULL);
+	fake_hal_uartReceive(DATALOG_CMD_DUMP);
+
+	run(1000);
+
+	// every page, in chunks short enough to clear the uart before the telemetry frame
+	TEST_ASSERT_EQ(datalog_bytes, DATALOG_DUMP_SIZE);
+	TEST_ASSERT_EQ(datalog_chunk_max, DATALOG_CHUNK_HEADER + DATALOG_CHUNK_SIZE);
+	TEST_ASSERT(!datalog_isDumping());
+
+	fake_hal_setUartSink(NULL, NULL);
+}
+
+static void test_controller_usageHistograms(void)
+{
+	setup();
+
+	fake_board_setCellVoltages(&board, 3800);
+
+	run(10500);
+
+	uint32_t total = 0;
+
+	for (uint8_t i = 0; i < usage_getBinCount(USAGE_CURRENT); i++)
+	{
+		total += usage_getSeconds(USAGE_CURRENT, i);
+	}
+
+	// every second after the afe came up, all of it at rest
+	TEST_ASSERT_NEAR(total, 10, 1);
+	TEST_ASSERT_EQ(usage_getSeconds(USAGE_CURRENT, 2), total);
+	TEST_ASSERT_EQ(usage_getSeconds(USAGE_VOLTAGE, 4), total);
+
+	// the hourly checkpoint goes out a word per pass from the slack slot
+	usage_requestCheckpoint();
+
+	uint32_t programs = fake_hal_getEepromProgramCount();
+
+	for (uint32_t i = 0; i < 200; i++)
+	{
+		uint32_t before = fake_hal_getEepromProgramCount();
+
+		run(1);
+
+		TEST_ASSERT(fake_hal_getEepromProgramCount() <= (before + 1));
+	}
+
+	TEST_ASSERT(fake_hal_getEepromProgramCount() > (programs + 1));
+
+	controller_init();
+
+	TEST_ASSERT_EQ(usage_getSeconds(USAGE_CURRENT, 2), total);
+
+	run(1000);
+
+	// shutdown still writes it in one go
+	TEST_ASSERT_EQ(usage_checkpoint(), HAL_OK);
+
+	uint32_t seconds = usage_getSeconds(USAGE_CURRENT, 2);
+
+	controller_init();
+
+	TEST_ASSERT_EQ(usage_getSeconds(USAGE_CURRENT, 2), seconds);
+
+	run(5000);
+
+	TEST_ASSERT_NEAR(usage_getSeconds(USAGE_CURRENT, 2), seconds + 5, 1);
+}
+
+static void test_controller_resistanceFromStep(void)
+{
+	setup();
+
+	fake_board_setCellVoltages(&board, 3800);
+
+	run(2000);
+
+	TEST_ASSERT_EQ(resistance_getCount(), 0);
+	TEST_ASSERT_EQ(resistance_getNominal(CELL_AVG), RESISTANCE_DEFAULT_UOHM);
+
+	// 20 mohm cells sag 100 mV under 5 A
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (5 * CURRENT_ADC_PER_A));
+	fake_board_setCellVoltages(&board, 3700);
+
+	run(1000);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_DISCHARGE);
+	TEST_ASSERT_EQ(resistance_getCount(), 1);
+	TEST_ASSERT_NEAR(resistance_getNominal(CELL_AVG), 20000, 1500);
+	TEST_ASSERT_NEAR(resistance_getNominal(CELL_MAX), 20000, 1500);
+
+	TEST_ASSERT_EQ(resistance_save(), HAL_OK);
+
+	controller_init();
+
+	TEST_ASSERT_NEAR(resistance_getNominal(CELL_AVG), 20000, 1500);
+}
+
+static void test_controller_sopLimits(void)
+{
+	setup();
+
+	fake_board_setCellVoltages(&board, 3800);
+
+	run(500);
+
+	TEST_ASSERT_EQ(controller_getState(), STATE_IDLE);
+
+	// recovers at the slew rate, then the hardware caps hold
+	run(2000);
+
+	TEST_ASSERT(sop_getDischarge(SOP_PEAK_2S) < 8000);
+
+	run(16000);
+
+	TEST_ASSERT_EQ(sop_getDischarge(SOP_PEAK_2S), 35000);
+	TEST_ASSERT_EQ(sop_getDischarge(SOP_CONTINUOUS), 18000);
+	TEST_ASSERT_EQ(sop_getCharge(SOP_PEAK_2S), 10000);
+
+	// 100 mV above the cutoff leaves ~7 A for 2 s through the default r0, the
+	// low soc taper takes more off
+	fake_board_setCellVoltages(&board, 3100);
+
+	run(300);
+
+	TEST_ASSERT(sop_getDischarge(SOP_PEAK_2S) > 0);
+	TEST_ASSERT(sop_getDischarge(SOP_PEAK_2S) < 7400);
+	TEST_ASSERT(sop_getDischarge(SOP_PEAK_10S) < sop_getDischarge(SOP_PEAK_2S));
+	TEST_ASSERT(sop_getDischarge(SOP_CONTINUOUS) < sop_getDischarge(SOP_PEAK_10S));
+	TEST_ASSERT_EQ(sop_getCharge(SOP_PEAK_2S), 10000);
+
+	fake_board_setCellVoltages(&board, 2990);
+
+	run(300);
+
+	TEST_ASSERT_EQ(sop_getDischarge(SOP_PEAK_2S), 0);
+}
+
+// sense counts the pack reads as at most ma, the drive regulates to what the bms publishes
+static uint16_t currentAdc(int32_t ma)
+{
+	batt_cal_S cal;
+
+	batt_getCalibration(SENSE_CURRENT, &cal);
+
+	return (cal.offset + (((int64_t)ma * (1000 << 8)) / cal.gain)) >> 8;
+}
+
+static void test_controller_sopFollowsFuse(void)
+{
+	setup();
+
+	fake_board_setCellVoltages(&board, 3800);
+
+	run(20000);
+
+	// the drive takes everything the 10 s window offers, then everything the 2 s one does
+	uint16_t peak_10s = sop_getDischarge(SOP_PEAK_10S);
+
+	TEST_ASSERT_EQ(peak_10s, 22000);
+
+	fake_board_setSense(&board, 0, currentAdc(peak_10s));
+
+	run(10000);
+
+	uint16_t peak_2s = sop_getDischarge(SOP_PEAK_2S);
+
+	TEST_ASSERT(batt_getFuseHeat() > 70);
+	TEST_ASSERT(peak_2s < 25000);
+	TEST_ASSERT(sop_getDischarge(SOP_PEAK_10S) < peak_2s);
+
+	fake_board_setSense(&board, 0, currentAdc(peak_2s));
+
+	run(2000);
+
+	TEST_ASSERT(!batt_getFault(FAULT_OC));
+	TEST_ASSERT_EQ(batt_getFetState(FET_DSG), FET_ON);
+
+	// the cap again once the fuse has drained at rest
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC);
+
+	run(45000);
+
+	TEST_ASSERT_EQ(sop_getDischarge(SOP_PEAK_2S), 35000);
+}
+
+static void test_controller_sohLearnsCapacity(void)
+{
+	setup();
+
+	TEST_ASSERT_EQ(soh_getCapacity(), SOH_NOMINAL_MAH);
+
+	fake_board_setCellVoltages(&board, 4000);
+
+	run(SOH_REST_MS + 1000);
+
+	// 4.0 V to 3.6 V is 5120 mAh of a new pack, an 80 % pack gets there on 4096 mAh
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (20 * CURRENT_ADC_PER_A));
+	fake_board_setCellVoltages(&board, 3800);
+
+	run(4096 * 3600 / 20);
+
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC);
+	fake_board_setCellVoltages(&board, 3600);
+
+	run(SOH_REST_MS + 1000);
+
+	TEST_ASSERT_EQ(soh_getLearnCount(), 1);
+	TEST_ASSERT_NEAR(soh_getCapacity(), 9600, 300);
+	TEST_ASSERT_NEAR(soh_getPercent(), 80, 3);
+	TEST_ASSERT_NEAR(soh_getCycles(), 17, 1);
+
+	controller_init();
+
+	TEST_ASSERT_NEAR(soh_getCapacity(), 9600, 300);
+	TEST_ASSERT_EQ(soh_getLearnCount(), 1);
+}
+
+static void test_controller_energyEstimates(void)
+{
+	setup();
+
+	fake_board_setCellVoltages(&board, 3700);
+
+	run(2000);
+
+	TEST_ASSERT_EQ(energy_getTimeToEmpty(), ENERGY_TIME_UNKNOWN);
+
+	// 48.1 V at 10 A
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (10 * CURRENT_ADC_PER_A));
+
+	run(10000);
+
+	TEST_ASSERT_NEAR(energy_getPower(ENERGY_WINDOW_10S), 481000 * 63 / 100, 25000);
+	TEST_ASSERT(energy_getPower(ENERGY_WINDOW_60S) < energy_getPower(ENERGY_WINDOW_10S));
+
+	run(290000);
+
+	TEST_ASSERT_NEAR(energy_getPower(ENERGY_WINDOW_10S), 481000, 10000);
+	TEST_ASSERT_NEAR(energy_getPower(ENERGY_WINDOW_60S), 481000, 10000);
+	TEST_ASSERT_NEAR(energy_getDischarged(), 481 * 300 / 3.6, 1500);
+
+	// ~5100 mAh of usable charge left at 3.7 V less the 0.8 Ah just used, at 48.1 V and 481 W
+	TEST_ASSERT_NEAR(energy_getTimeToEmpty(), 26, 2);
+	TEST_ASSERT_EQ(energy_getTimeToFull(), ENERGY_TIME_UNKNOWN);
+
+	uint32_t discharged = energy_getDischarged();
+
+	// charging drives every filter negative
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC - (4 * CURRENT_ADC_PER_A));
+
+	run(300000);
+
+	TEST_ASSERT_NEAR(energy_getPower(ENERGY_WINDOW_10S), -192400, 10000);
+	TEST_ASSERT_NEAR(energy_getPower(ENERGY_WINDOW_60S), -192400, 10000);
+	TEST_ASSERT(energy_getPower(ENERGY_WINDOW_300S) < 0);
+	TEST_ASSERT_NEAR(energy_getCharged(), 192.4 * 300 / 3.6, 1000);
+	TEST_ASSERT_NEAR(energy_getDischarged(), discharged, 20); // the loop that straddles the step
+
+	// ~6.1 Ah to the charge limit at 4 A
+	TEST_ASSERT_NEAR(energy_getTimeToFull(), 92, 5);
+	TEST_ASSERT_EQ(energy_getTimeToEmpty(), ENERGY_TIME_UNKNOWN);
+}
+
+static void test_controller_thermalDerating(void)
+{
+	setup();
+
+	fake_board_setCellVoltages(&board, 3800);
+
+	// 20 A through the default r0 heats the core of a group ~2.3 C over its surface
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC + (20 * CURRENT_ADC_PER_A));
+
+	run(120000);
+
+	int32_t surface = batt_getTemp(TEMP_MAX) * 10;
+
+	TEST_ASSERT_NEAR(thermal_getCore(), surface + 19, 5);
+	TEST_ASSERT(thermal_getPredicted() > thermal_getCore());
+	TEST_ASSERT_EQ(sop_getDischarge(SOP_CONTINUOUS), 18000);
+	TEST_ASSERT_EQ(sop_getCharge(SOP_CONTINUOUS), 6000);
+
+	// a warm pack at rest only tapers regen
+	fake_board_setSense(&board, 0, CURRENT_ZERO_ADC);
+	fake_board_setThermistor(&board, 1, 3319);
+
+	run(120000);
+
+	TEST_ASSERT_EQ(sop_getDischarge(SOP_CONTINUOUS), 18000);
+	TEST_ASSERT(sop_getCharge(SOP_CONTINUOUS) > 0);
+	TEST_ASSERT(sop_getCharge(SOP_CONTINUOUS) < 6000);
+
+	// still climbing, the limits come down well before the sensor trips
+	fake_board_setThermistor(&board, 1, 2709);
+
+	run(20000);
+
+	uint16_t climbing = sop_getDischarge(SOP_CONTINUOUS);
+
+	TEST_ASSERT(climbing < 9000);
+	TEST_ASSERT_EQ(sop_getCharge(SOP_CONTINUOUS), 0);
+	TEST_ASSERT(!batt_getFault(FAULT_OT));
+	TEST_ASSERT(controller_getState() != STATE_FAULT);
+
+	// and give some back once it levels off
+	run(100000);
+
+	TEST_ASSERT(sop_getDischarge(SOP_CONTINUOUS) > climbing);
+	TEST_ASSERT(sop_getDischarge(SOP_CONTINUOUS) < 18000);
+}
+
+void test_controller(void)
+{
+	TEST_RUN(test_controller_bootToIdle);
+	TEST_RUN(test_controller_wakeToDischarge);
+	TEST_RUN(test_controller_bootWithoutAfe);
+	TEST_RUN(test_controller_calibrationCommands);
+	TEST_RUN(test_controller_prechargeIntoShort);
+	TEST_RUN(test_controller_dischargeAndBack);
+	TEST_RUN(test_controller_faultOnOverTemp);
+	TEST_RUN(test_controller_longPressShutdown);
+	TEST_RUN(test_controller_watchdogStall);
+	TEST_RUN(test_controller_watchdogLateCheckIn);
+	TEST_RUN(test_controller_datalogSurvivesReset);
+	TEST_RUN(test_controller_usageHistograms);
+	TEST_RUN(test_controller_resistanceFromStep);
+	TEST_RUN(test_controller_sopLimits);
+	TEST_RUN(test_controller_sopFollowsFuse);
+	TEST_RUN(test_controller_sohLearnsCapacity);
+	TEST_RUN(test_controller_energyEstimates);
+	TEST_RUN(test_controller_thermalDerating);
+	TEST_RUN(test_controller_watchdogStandbyTimeout);
+}
@@ -0,0 +1,337 @@
+#include "test.h"
+
+#include "fake_devices.h"
+
+#include "adc121.h"
+#include "bq76930.h"
+#include "i2c_trace.h"
+#include "ocv.h"
+#include "profile.h"
+#include "tca9534.h"
+
+#include <string.h>
+
+extern I2C_HandleTypeDef hi2c1;
+extern UART_HandleTypeDef hlpuart1;
+
+static fake_board_S board;
+static uint8_t uart_stream[4096];
+static uint32_t uart_stream_len;
+
+static void uartCapture(void *ctx, const uint8_t *data, uint16_t size)
+{
+	(void)ctx;
+
+	memcpy(&uart_stream[uart_stream_len], data, size);
+	uart_stream_len += size;
+}
+
+static void test_adc121_updateDecodesAlert(void)
+{
+	ADC121_inst_S adc;
+
+	fake_board_init(&board);
+	fake_board_setSense(&board, 0, 0x0800);
+
+	TEST_ASSERT_EQ(ADC121_init(&adc, &hi2c1, 10), HAL_OK);
+	TEST_ASSERT_EQ(ADC121_setAlertWindow(&adc, 0x0100, 0x0900, 0x10), HAL_OK);
+	TEST_ASSERT_EQ(ADC121_enableAlert(&adc, 1), HAL_OK);
+
+	board.tca.regs[TCA9534_REG_OUT] = 0;
+
+	TEST_ASSERT_EQ(ADC121_update(&adc), HAL_OK);
+	TEST_ASSERT_EQ(ADC121_read(&adc), 0x0800);
+	TEST_ASSERT_EQ(ADC121_getAlert(&adc), 0);
+
+	fake_board_setSense(&board, 0, 0x0A00);
+
+	TEST_ASSERT_EQ(ADC121_update(&adc), HAL_OK);
+	TEST_ASSERT_EQ(ADC121_read(&adc), 0x0A00);
+	TEST_ASSERT_EQ(ADC121_getAlert(&adc), 1);
+
+	// latched until cleared
+	fake_board_setSense(&board, 0, 0x0800);
+
+	TEST_ASSERT_EQ(ADC121_update(&adc), HAL_OK);
+	TEST_ASSERT_EQ(ADC121_getAlert(&adc), 1);
+
+	TEST_ASSERT_EQ(ADC121_clearAlert(&adc), HAL_OK);
+	TEST_ASSERT_EQ(ADC121_update(&adc), HAL_OK);
+	TEST_ASSERT_EQ(ADC121_getAlert(&adc), 0);
+}
+
+static void test_adc121_extremes(void)
+{
+	ADC121_inst_S adc;
+	uint16_t lowest;
+	uint16_t highest;
+
+	fake_board_init(&board);
+	board.tca.regs[TCA9534_REG_OUT] = 0;
+
+	TEST_ASSERT_EQ(ADC121_init(&adc, &hi2c1, 10), HAL_OK);
+	TEST_ASSERT_EQ(ADC121_resetExtremes(&adc), HAL_OK);
+
+	fake_board_setSense(&board, 0, 0x0300);
+	TEST_ASSERT_EQ(ADC121_update(&adc), HAL_OK);
+	fake_board_setSense(&board, 0, 0x0C00);
+	TEST_ASSERT_EQ(ADC121_update(&adc), HAL_OK);
+
+	TEST_ASSERT_EQ(ADC121_readExtremes(&adc, &lowest, &highest), HAL_OK);
+	TEST_ASSERT_EQ(lowest, 0x0300);
+	TEST_ASSERT_EQ(highest, 0x0C00);
+}
+
+static void test_adc121_missingDevice(void)
+{
+	ADC121_inst_S adc;
+
+	fake_hal_reset();
+
+	TEST_ASSERT_EQ(ADC121_init(&adc, &hi2c1, 10), HAL_ERROR);
+}
+
+static void test_tca9534_updateOutputsWritesOnlyOut(void)
+{
+	TCA9534_inst_S tca;
+
+	fake_board_init(&board);
+
+	TEST_ASSERT_EQ(TCA9534_init(&tca, &hi2c1, 10), HAL_OK);
+
+	TCA9534_writePin(&tca, TCA9534_CHANNEL_2, GPIO_PIN_RESET);
+
+	uint32_t count = fake_hal_getI2CCount();
+
+	TEST_ASSERT_EQ(TCA9534_updateOutputs(&tca), HAL_OK);
+	TEST_ASSERT_EQ(fake_hal_getI2CCount() - count, 1);
+	TEST_ASSERT_EQ(board.tca.regs[TCA9534_REG_OUT], 0xFD);
+}
+
+static void test_bq76930_cellVoltage(void)
+{
+	BQ76930_inst_S bq;
+	BQ76930_config_S config = { .scd_thresh = 3, .ocd_thresh = 5, .ov_thresh = 4200, .uv_thresh = 2000 };
+
+	fake_board_init(&board);
+	fake_board_setCellVoltage(&board, BQ76930_CELL_3, 3300);
+
+	TEST_ASSERT_EQ(BQ76930_init(&bq, &hi2c1, &config, 10), HAL_OK);
+	TEST_ASSERT_EQ(BQ76930_update(&bq), HAL_OK);
+
+	TEST_ASSERT_NEAR(BQ76930_getVoltage(&bq, BQ76930_CELL_1), 3700, 1);
+	TEST_ASSERT_NEAR(BQ76930_getVoltage(&bq, BQ76930_CELL_3), 3300, 1);
+	TEST_ASSERT_NEAR(BQ76930_getTemp(&bq, BQ76930_TEMP_1), 25, 2);
+	TEST_ASSERT_EQ(board.bq.write_errors, 0);
+}
+
+static void test_bq76930_crcError(void)
+{
+	BQ76930_inst_S bq;
+	BQ76930_config_S config = { .scd_thresh = 3, .ocd_thresh = 5, .ov_thresh = 4200, .uv_thresh = 2000 };
+
+	fake_board_init(&board);
+
+	TEST_ASSERT_EQ(BQ76930_init(&bq, &hi2c1, &config, 10), HAL_OK);
+
+	board.bq.crc_error = 1;
+
+	TEST_ASSERT_EQ(BQ76930_update(&bq), HAL_ERROR);
+}
+
+static void test_bq76930_updateFetsKeepsCtrl2(void)
+{
+	BQ76930_inst_S bq;
+	BQ76930_config_S config = { .scd_thresh = 3, .ocd_thresh = 5, .ov_thresh = 4200, .uv_thresh = 2000 };
+
+	fake_board_init(&board);
+
+	TEST_ASSERT_EQ(BQ76930_init(&bq, &hi2c1, &config, 10), HAL_OK);
+
+	board.bq.regs[BQ76930_REG_SYS_CTRL2] = 0x40;
+
+	BQ76930_setDischarge(&bq, BQ76930_FET_STATE_ON);
+
+	TEST_ASSERT_EQ(BQ76930_updateFets(&bq), HAL_OK);
+	TEST_ASSERT_EQ(board.bq.regs[BQ76930_REG_SYS_CTRL2], 0x42);
+}
+
+static void drainAll(void)
+{
+	uint32_t len;
+
+	do
+	{
+		len = uart_stream_len;
+
+		(void)i2c_trace_drain(&hlpuart1);
+	} while (uart_stream_len != len);
+}
+
+static void test_i2cTrace_recordEncoding(void)
+{
+	ADC121_inst_S adc;
+
+	fake_board_init(&board);
+	fake_hal_setUartSink(uartCapture, NULL);
+	fake_hal_setTick(100);
+	board.tca.regs[TCA9534_REG_OUT] = 0;
+	fake_board_setSense(&board, 0, 0x0123);
+	uart_stream_len = 0;
+
+	i2c_trace_init();
+
+	TEST_ASSERT_EQ(ADC121_init(&adc, &hi2c1, 10), HAL_OK);
+
+	fake_hal_advanceTick(3);
+
+	TEST_ASSERT_EQ(ADC121_update(&adc), HAL_OK);
+	TEST_ASSERT_EQ(i2c_trace_drain(&hlpuart1), HAL_OK);
+
+	// chunk header, start marker with the absolute tick, then the two records
+	const uint8_t expected[] =
+	{
+		I2C_TRACE_SYNC_0, I2C_TRACE_SYNC_1, 16, 0,
+		0xC0 | I2C_TRACE_MARK_START, 0, 4, 100, 0, 0, 0,
+		(I2C_TRACE_DEV_ADC << 6) | I2C_TRACE_FLAG_WRITE | 1, 0, ADC121_REG_CFG, ADC121_CYCLE_2048 << ADC121_REG_CFG_CYCLE,
+		(I2C_TRACE_DEV_ADC << 6) | 2, 3, ADC121_REG_RES, 0x01, 0x23,
+	};
+
+	TEST_ASSERT_EQ(uart_stream_len, sizeof(expected));
+	TEST_ASSERT(memcmp(uart_stream, expected, sizeof(expected)) == 0);
+}
+
+static void test_i2cTrace_dropMarker(void)
+{
+	ADC121_inst_S adc;
+
+	fake_board_init(&board);
+	fake_hal_setUartSink(uartCapture, NULL);
+	uart_stream_len = 0;
+
+	i2c_trace_init();
+
+	TEST_ASSERT_EQ(ADC121_init(&adc, &hi2c1, 10), HAL_OK);
+
+	// fill the buffer without draining it
+	for (uint32_t i = 0; i < (I2C_TRACE_BUF_SIZE / 4); i++)
+	{
+		TEST_ASSERT_EQ(ADC121_update(&adc), HAL_OK);
+	}
+
+	TEST_ASSERT(i2c_trace_getDropped() > 0);
+
+	drainAll();
+
+	// the first record after the gap says how many went missing
+	uart_stream_len = 0;
+
+	TEST_ASSERT_EQ(ADC121_update(&adc), HAL_OK);
+
+	drainAll();
+
+	TEST_ASSERT(uart_stream_len > I2C_TRACE_CHUNK_HEADER);
+	TEST_ASSERT_EQ(uart_stream[I2C_TRACE_CHUNK_HEADER], 0xC0 | I2C_TRACE_MARK_DROP);
+}
+
+#if PROFILE_ENABLE
+static void profileSpan(uint32_t tick, uint32_t us)
+{
+	uint32_t cycles = us * (SystemCoreClock / 1000000);
+
+	fake_hal_setTick(tick);
+	SysTick->VAL = SysTick->LOAD;
+	profile_start(PROFILE_STAGE_BQ);
+
+	fake_hal_setTick(tick + (cycles / (SysTick->LOAD + 1)));
+	SysTick->VAL = SysTick->LOAD - (cycles % (SysTick->LOAD + 1));
+	profile_stop(PROFILE_STAGE_BQ);
+}
+
+static void test_profile_stats(void)
+{
+	profile_stats_S stats;
+
+	profile_init();
+
+	profileSpan(100, 10);
+	profileSpan(200, 300);
+	profileSpan(300, 2500);
+
+	profile_export(&stats);
+	TEST_ASSERT_EQ(stats.stage, PROFILE_STAGE_ADC);
+	TEST_ASSERT_EQ(stats.count, 0);
+
+	profile_export(&stats);
+	TEST_ASSERT_EQ(stats.stage, PROFILE_STAGE_BQ);
+	TEST_ASSERT_EQ(stats.count, 3);
+	TEST_ASSERT_EQ(stats.min_us, 10);
+	TEST_ASSERT_EQ(stats.max_us, 2500);
+	TEST_ASSERT_EQ(stats.mean_us, 936);
+	TEST_ASSERT_EQ(stats.hist[0], 1);
+	TEST_ASSERT_EQ(stats.hist[3], 1);
+	TEST_ASSERT_EQ(stats.hist[4], 1);
+
+	// exporting restarts the window for the next lap
+	for (uint32_t i = 0; i < PROFILE_STAGE_COUNT; i++)
+	{
+		profile_export(&stats);
+	}
+
+	TEST_ASSERT_EQ(stats.stage, PROFILE_STAGE_BQ);
+	TEST_ASSERT_EQ(stats.count, 0);
+}
+#endif
+
+static void test_ocv_roundTrip(void)
+{
+	static const uint8_t temps[] = { 0, 5, 10, 17, 25, 33, 45, 60 };
+
+	// the 25 C column is the old single temperature table
+	TEST_ASSERT_EQ(ocv_getVoltage(360, 25), 3600);
+	TEST_ASSERT_EQ(ocv_getSoc(4000, 25), 787);
+
+	for (uint32_t t = 0; t < sizeof(temps); t++)
+	{
+		for (uint16_t soc = 0; soc <= OCV_SOC_FULL; soc += 5)
+		{
+			TEST_ASSERT_NEAR(ocv_getSoc(ocv_getVoltage(soc, temps[t]), temps[t]), soc, 2);
+		}
+	}
+
+	// cold cells rest lower, the same voltage is more charge
+	TEST_ASSERT(ocv_getVoltage(500, 0) < ocv_getVoltage(500, 25));
+	TEST_ASSERT(ocv_getSoc(3700, 0) > (ocv_getSoc(3700, 25) + 40));
+	TEST_ASSERT_EQ(ocv_getSoc(2000, 10), 0);
+	TEST_ASSERT_EQ(ocv_getSoc(4300, 10), OCV_SOC_FULL);
+
+	// -10 C, the reading stops at the bottom of the table and the lookup stays on the cold column
+	BQ76930_inst_S bq;
+	BQ76930_config_S config = { .scd_thresh = 3, .ocd_thresh = 5, .ov_thresh = 4200, .uv_thresh = 2000 };
+
+	fake_board_init(&board);
+	fake_board_setThermistor(&board, 0, 55300);
+
+	TEST_ASSERT_EQ(BQ76930_init(&bq, &hi2c1, &config, 10), HAL_OK);
+	TEST_ASSERT_EQ(BQ76930_update(&bq), HAL_OK);
+
+	TEST_ASSERT_EQ(BQ76930_getTemp(&bq, BQ76930_TEMP_1), 0);
+	TEST_ASSERT_EQ(ocv_getSoc(3700, BQ76930_getTemp(&bq, BQ76930_TEMP_1)), ocv_getSoc(3700, 0));
+}
+
+void test_drivers(void)
+{
+	TEST_RUN(test_adc121_updateDecodesAlert);
+	TEST_RUN(test_adc121_extremes);
+	TEST_RUN(test_adc121_missingDevice);
+	TEST_RUN(test_tca9534_updateOutputsWritesOnlyOut);
+	TEST_RUN(test_bq76930_cellVoltage);
+	TEST_RUN(test_bq76930_crcError);
+	TEST_RUN(test_bq76930_updateFetsKeepsCtrl2);
+	TEST_RUN(test_i2cTrace_recordEncoding);
+	TEST_RUN(test_i2cTrace_dropMarker);
+#if PROFILE_ENABLE
+	TEST_RUN(test_profile_stats);
+#endif
+	TEST_RUN(test_ocv_roundTrip);
+}
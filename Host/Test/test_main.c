@@ -0,0 +1,39 @@
+#include "test.h"
+
+uint32_t test_failed;
+
+static uint32_t test_count;
+static uint8_t test_current_failed;
+
+void test_run(const char *name, test_F fn)
+{
+	test_count++;
+	test_current_failed = 0;
+
+	fn();
+
+	printf("%s %s\n", test_current_failed ? "FAIL" : "ok  ", name);
+}
+
+void test_fail(const char *file, int line, const char *expr, long long a, long long b)
+{
+	if (!test_current_failed)
+	{
+		test_failed++;
+	}
+
+	test_current_failed = 1;
+
+	printf("  %s:%d: %s (%lld, %lld)\n", file, line, expr, a, b);
+}
+
+int main(void)
+{
+	test_drivers();
+	test_battery();
+	test_controller();
+
+	printf("%u tests, %u failed\n", test_count, test_failed);
+
+	return test_failed ? 1 : 0;
+}